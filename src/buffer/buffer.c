@@ -20,6 +20,7 @@ buffer_t *buffer_init(buffer_t *buffer, size_t size, allocator_t *alloc)
     buffer->size = 0;
     buffer->capacity = 0;
     buffer->outside = false;
+    buffer->inline_ptr = NULL;
 
     buffer_resize(buffer, size);
   } else if (! buffer) {
@@ -29,6 +30,27 @@ buffer_t *buffer_init(buffer_t *buffer, size_t size, allocator_t *alloc)
   return buffer;
 }
 
+buffer_t *buffer_init_inline(buffer_t *buffer, void *storage, size_t capacity, allocator_t *alloc)
+{
+  if (buffer && (storage || capacity == 0)) {
+    if (alloc == NULL)
+      alloc = g_default_allocator;
+
+    buffer->alloc = alloc;
+    buffer->ptr = capacity ? (char *)storage : NULL;
+    buffer->size = 0;
+    buffer->capacity = capacity;
+    buffer->outside = false;
+    buffer->inline_ptr = buffer->ptr;
+  } else if (! buffer) {
+    s_log_error("Attempt to initialize a NULL buffer.");
+  } else {
+    s_log_error("Cannot initialize a buffer with NULL inline storage.");
+  }
+
+  return buffer;
+}
+
 buffer_t *buffer_init_with_pointer(buffer_t *buffer, size_t size, void *p, allocator_t *alloc)
 {
   if (buffer && p) {
@@ -40,6 +62,7 @@ buffer_t *buffer_init_with_pointer(buffer_t *buffer, size_t size, void *p, alloc
     buffer->size = size;
     buffer->capacity = size;
     buffer->outside = true;
+    buffer->inline_ptr = NULL;
   } else if (! p) {
     s_log_error("Cannot initialize a buffer with a NULL pointer.");
   } else if (! buffer) {
@@ -57,7 +80,7 @@ int buffer_destroy(buffer_t *buffer)
     return -1;
   }
 
-  if (buffer->ptr && ! buffer->outside)
+  if (buffer->ptr && ! buffer->outside && buffer->ptr != buffer->inline_ptr)
     com_free(buffer->alloc, buffer->ptr);
 
   memset(buffer, 0, sizeof(*buffer));
@@ -130,7 +153,18 @@ int buffer_reserve(buffer_t *buf, size_t capacity)
   if (new_capacity < capacity)
     new_capacity = capacity;
 
-  new_buf = com_realloc(buf->alloc, buf->ptr, new_capacity);
+  if (buf->ptr == NULL) {
+    // first allocation -- nothing to keep, so skip zeroing and take any slack
+    new_buf = com_malloc_usable(buf->alloc, new_capacity, &new_capacity);
+  } else if (buf->ptr == buf->inline_ptr) {
+    // spilling out of inline storage -- copy what's there, leave the storage
+    new_buf = com_malloc_usable(buf->alloc, new_capacity, &new_capacity);
+    if (new_buf)
+      memcpy(new_buf, buf->ptr, buf->size);
+  } else {
+    new_buf = com_realloc(buf->alloc, buf->ptr, new_capacity);
+  }
+
   if (! new_buf) {
     s_log_error("Failed to reallocate memory for a buffer.");
     errno = ENOMEM;
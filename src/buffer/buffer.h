@@ -22,9 +22,15 @@ struct s_buffer {
   size_t size;
   size_t capacity;
   bool outside;
+  /* storage passed to buffer_init_inline, if any -- never freed */
+  char *inline_ptr;
 };
 
 buffer_t *buffer_init(buffer_t *buffer, size_t capacity, allocator_t *alloc);
+/*! Initializes an empty buffer that writes into storage until it needs more
+    than capacity bytes, then moves to memory from the allocator. The storage
+    must outlive the buffer and must not move while the buffer is in use. */
+buffer_t *buffer_init_inline(buffer_t *buffer, void *storage, size_t capacity, allocator_t *alloc);
 buffer_t *buffer_init_with_pointer(buffer_t *buffer, size_t size, void *p, allocator_t *alloc);
 int buffer_destroy(buffer_t *buffer);
 
@@ -43,17 +43,19 @@ void entity_destroy(entity_t *self)
   if (self->parent) {
     entity_remove_from_parent(self);
   }
-  list_remove(self->parentnode);
+  list_unlink(&self->parentnode);
 
   listnode_t *node = list_first_node(&self->children);
   while (node) {
-    entity_t *child = (entity_t *)node->pointer;
+    entity_t *child = list_container(node, entity_t, parentnode);
     node = listnode_next(node);
     entity_remove_from_parent(child);
   }
 
   list_destroy(&self->children);
 
+  slotmap_remove(&self->scene->entity_handles, self->handle);
+
   com_free(self->alloc, self);
 }
 
@@ -74,22 +76,30 @@ entity_t *entity_new(scene_t *scene, const char *name, entity_t *parent, allocat
   entity_t *self = com_malloc(alloc, sizeof(*self));
 
   if (self) {
+    // not all allocators zero memory
+    memset(self, 0, sizeof(*self));
     self->alloc = alloc;
     self->scene = scene;
+    self->handle = slotmap_insert(&scene->entity_handles, &self);
+    if (self->handle == SLOTMAP_NULL_HANDLE) {
+      s_log_error("Unable to allocate a handle for entity.");
+      com_free(alloc, self);
+      return NULL;
+    }
 
     vec3_copy(g_vec3_zero, self->position);
     vec3_copy(g_vec3_one, self->scale);
     quat_identity(self->rotation);
     mat4_identity(self->transform);
 
-    list_init(&self->children, alloc);
+    list_init_intrusive(&self->children);
 
     if (parent) {
       self->parent = parent;
-      self->parentnode = list_append(&parent->children, self);
+      list_append_node(&parent->children, &self->parentnode);
     } else {
       self->parent = NULL;
-      self->parentnode = list_append(&scene->entities, self);
+      list_append_node(&scene->entities, &self->parentnode);
     }
 
     if (name != NULL)
@@ -105,16 +115,16 @@ void entity_add_child(entity_t *self, entity_t *child)
     s_log_error("Attempting to add an entity as a child it already has a parent.\n");
     return;
   }
-  list_remove(child->parentnode);
-  child->parentnode = list_append(&self->children, child);
+  list_unlink(&child->parentnode);
+  list_append_node(&self->children, &child->parentnode);
   child->parent = self;
 }
 
 void entity_remove_from_parent(entity_t *self)
 {
   if (self->parent) {
-    list_remove(self->parentnode);
-    self->parentnode = list_append(&self->scene->entities, self);
+    list_unlink(&self->parentnode);
+    list_append_node(&self->scene->entities, &self->parentnode);
     self->parent = NULL;
   } else {
     s_log_error("Attempting to remove entity from a parent when it has no parent.\n");
@@ -123,14 +133,20 @@ void entity_remove_from_parent(entity_t *self)
 
 void entity_set_name(entity_t *self, const char *name)
 {
-  if (name) {
-    strncpy(self->name, name, ENTITY_NAME_MAX_LEN);
-  } else {
-    memset(self->name, 0, ENTITY_NAME_MAX_LEN);
-  }
+  self->name = name ? atom_intern(name) : NULL;
+}
+
+void entity_set_name_atom(entity_t *self, atom_t name)
+{
+  self->name = name;
 }
 
 const char *entity_get_name(const entity_t *self)
+{
+  return self->name ? atom_str(self->name) : "";
+}
+
+atom_t entity_get_name_atom(const entity_t *self)
 {
   return self->name;
 }
@@ -231,11 +247,9 @@ static void entity_invalidate_transform(entity_t *self, bool invalid_local, bool
 
   entity_set_flag(self, flag);
 
-  listnode_t *node = list_first_node(&self->children);
-  while (node) {
-    entity_invalidate_transform((entity_t *)node->pointer, false, invalid_local);
-    node = listnode_next(node);
-  }
+  entity_t *child;
+  list_foreach_entry(child, &self->children, entity_t, parentnode)
+    entity_invalidate_transform(child, false, invalid_local);
 }
 
 static void entity_build_matrices(entity_t *self)
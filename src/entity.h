@@ -12,6 +12,7 @@
 #include <maths/maths.h>
 #include <structs/list.h>
 #include <memory/allocator.h>
+#include <structs/atom.h>
 
 #ifdef __SNOW__ENTITY_C__
 #define S_INLINE
@@ -24,8 +25,6 @@ extern "C"
 {
 #endif /* __cplusplus */
 
-#define ENTITY_NAME_MAX_LEN (64)
-
 enum
 {
   DIRTY_TRANSFORM   =0x1<<0,  /*! Transformation matrix is dirty. */
@@ -47,10 +46,15 @@ struct s_entity
 {
   allocator_t *alloc;
   struct s_scene *scene;
+  /*! The entity's handle in its scene. See ::scene_get_entity. */
+  handle_t handle;
 
+  /*! Child entities, linked through their parentnode. */
   list_t children;
 
-  listnode_t *parentnode;
+  /*! Node in the parent's children, or in the scene's root entities if the
+      entity has no parent. */
+  listnode_t parentnode;
   entity_t *parent;
 
   /*! internal flags */
@@ -62,9 +66,16 @@ struct s_entity
   vec3_t position;
   vec3_t scale;
 
-  char name[ENTITY_NAME_MAX_LEN];
+  /*! The entity's name, or NULL if it has none. */
+  atom_t name;
 };
 
+/*! Allocates a new entity in the scene. If parent is NULL, the entity is
+    added to the scene's root entities. If alloc is NULL, the default
+    allocator is used.
+*/
+entity_t *entity_new(struct s_scene *scene, const char *name, entity_t *parent, allocator_t *alloc);
+
 /*! Destroys and deallocates an entity. This will destroy all child entities
     as well.
 */
@@ -75,12 +86,15 @@ void entity_add_child(entity_t *self, entity_t *child);
 /*! Removes the entity from its parent entity. */
 void entity_remove_from_parent(entity_t *self);
 
-/*! Set the entity's name to a copy of the name string provided, if any. */
+/*! Set the entity's name to the atom for the name string provided, if any. */
 void entity_set_name(entity_t *self, const char *name);
+void entity_set_name_atom(entity_t *self, atom_t name);
 /*! Get the entity's name.  This is not a copy of the name string, so you
-    must not free it.
+    must not free it.  Returns an empty string if the entity has no name.
 */
 const char *entity_get_name(const entity_t *self);
+/*! Get the entity's name as an atom, or NULL if it has no name. */
+atom_t entity_get_name_atom(const entity_t *self);
 
 /*! \brief Sets the position of the entity relative to its parent. */
 void entity_position(entity_t *self, s_float_t x, s_float_t y, s_float_t z);
@@ -10,13 +10,16 @@ extern "C" {
 #endif // __cplusplus
 
 typedef struct s_event_handler {
-  listnode_t node; // .pointer = context
+  listnode_t node;
+  void *context;
   int priority;
   event_handler_fn_t handler;
 } event_handler_t;
 
+DEFINE_ARRAY(event_t, event_array)
+
 static allocator_t *g_event_alloc = NULL;
-static array_t g_event_array;
+static event_array_t g_event_array;
 static list_t g_handler_list;
 static mutex_t g_events_lock;
 static mutex_t g_handler_lock;
@@ -24,12 +27,9 @@ static mutex_t g_handler_lock;
 static void com_dispatch_event(event_t *event)
 {
   event_handler_t *node;
-  node = (event_handler_t *)list_first_node(&g_handler_list);
-  while (node) {
-    if (node->handler(event, node->node.pointer))
+  list_foreach_entry(node, &g_handler_list, event_handler_t, node) {
+    if (node->handler(event, node->context))
       break;
-
-    node = (event_handler_t *)listnode_next((listnode_t *)node);
   }
 }
 
@@ -39,8 +39,8 @@ void sys_events_init(allocator_t *alloc)
     alloc = g_default_allocator;
 
   g_event_alloc = alloc;
-  array_init(&g_event_array, sizeof(event_t), 128, alloc);
-  list_init(&g_handler_list, alloc);
+  event_array_init(&g_event_array, 128, alloc);
+  list_init_intrusive(&g_handler_list);
 
   mutex_init(&g_events_lock, false);
   mutex_init(&g_handler_lock, false);
@@ -48,10 +48,12 @@ void sys_events_init(allocator_t *alloc)
 
 void sys_events_shutdown(void)
 {
+  com_clear_event_handlers();
+
   mutex_lock(&g_events_lock);
   mutex_lock(&g_handler_lock);
 
-  array_destroy(&g_event_array);
+  event_array_destroy(&g_event_array);
   list_destroy(&g_handler_list);
 
   mutex_unlock(&g_events_lock);
@@ -64,7 +66,7 @@ void sys_events_shutdown(void)
 void com_queue_event(event_t event)
 {
   mutex_lock(&g_events_lock);
-  array_push(&g_event_array, &event);
+  event_array_push(&g_event_array, event);
   mutex_unlock(&g_events_lock);
 }
 
@@ -72,14 +74,14 @@ void com_process_event_queue(void)
 {
   mutex_lock(&g_events_lock);
 
-  if (!array_empty(&g_event_array)) {
+  if (!event_array_empty(&g_event_array)) {
     size_t length;
     event_t *events;
 
     mutex_lock(&g_handler_lock);
 
-    length = array_size(&g_event_array);
-    events = array_buffer(&g_event_array, NULL);
+    length = event_array_size(&g_event_array);
+    events = event_array_buffer(&g_event_array);
 
     while (length) {
       com_dispatch_event(events);
@@ -87,7 +89,7 @@ void com_process_event_queue(void)
       --length;
     }
 
-    array_clear(&g_event_array);
+    event_array_clear(&g_event_array);
 
     mutex_unlock(&g_handler_lock);
   }
@@ -117,20 +119,16 @@ void com_add_event_handler(event_handler_fn_t handler, void *context, int priori
   node = com_malloc(g_event_alloc, sizeof(*node));
   node->node.list = NULL;
   node->node.next = node->node.prev = NULL;
-  node->node.pointer = context;
+  node->context = context;
   node->handler = handler;
   node->priority = priority;
 
-  search = (event_handler_t *)list_first_node(&g_handler_list);
-  while (search) {
+  list_foreach_entry(search, &g_handler_list, event_handler_t, node) {
     if (priority < search->priority) break;
-    search = (event_handler_t *)listnode_next((listnode_t *)search);
   }
 
-  if (search)
-    list_insert_node_before((listnode_t *)search, (listnode_t *)node);
-  else
-    list_insert_node_before(&g_handler_list.head, (listnode_t *)node);
+  // inserting before the list head appends if no handler has a lower priority
+  list_insert_node_before(&search->node, &node->node);
 
   mutex_unlock(&g_handler_lock);
 }
@@ -141,25 +139,12 @@ void com_remove_event_handler(event_handler_fn_t handler, void *context)
 
   mutex_lock(&g_handler_lock);
 
-  node = (event_handler_t *)list_first_node(&g_handler_list);
-
-  if (context == IGNORE_HANDLER_CONTEXT) {
-    while (node) {
-      if (node->handler == handler) {
-        list_remove((listnode_t *)node);
-        break;
-      }
-
-      node = (event_handler_t *)listnode_next((listnode_t *)node);
-    }
-  } else {
-    while (node) {
-      if (node->handler == handler && node->node.pointer == context) {
-        list_remove((listnode_t *)node);
-        break;
-      }
-
-      node = (event_handler_t *)listnode_next((listnode_t *)node);
+  list_foreach_entry(node, &g_handler_list, event_handler_t, node) {
+    if (node->handler == handler &&
+        (context == IGNORE_HANDLER_CONTEXT || node->context == context)) {
+      list_unlink(&node->node);
+      com_free(g_event_alloc, node);
+      break;
     }
   }
 
@@ -189,10 +174,10 @@ void com_clear_event_handlers(void)
 
   mutex_unlock(&g_handler_lock);
 
-  // free nodes at my leisure
+  // free handlers at my leisure
   while (node) {
     listnode_t *next = node->next;
-    com_free(g_event_alloc, node);
+    com_free(g_event_alloc, list_container(node, event_handler_t, node));
     node = next;
   }
 }
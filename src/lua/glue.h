@@ -59,6 +59,11 @@
 // STRING RETURN
 #define sn__lua_glue_return_string_t(COUNT, NAME)\
   lua_pushstring(L, (const char *)(sn__lua_glue_call(COUNT, NAME))); return 1;
+#define sn__lua_glue_return_atom_t(COUNT, NAME)\
+  atom_t sn__lua_ret_atom = sn__lua_glue_call(COUNT, NAME);\
+  if (sn__lua_ret_atom) lua_pushlstring(L, atom_str(sn__lua_ret_atom), atom_length(sn__lua_ret_atom));\
+  else lua_pushnil(L);\
+  return 1;
 
 // OBJECT RETURN
 #define sn__lua_glue_return_object_t(COUNT, NAME)\
@@ -191,6 +196,7 @@
 
 // STRING TYPES
 #define sn__lua_glue_type_string_t string_t
+#define sn__lua_glue_type_atom_t atom_t
 
 // GENERIC OBJECT
 #define sn__lua_glue_type_object_t object_t *
@@ -237,6 +243,8 @@
 // STRING ARGUMENTS
 #define sn__lua_glue_handle_arg_string_t(POS)\
   sn__lua_glue_handle_arg_generic(POS, string_t)
+#define sn__lua_glue_handle_arg_atom_t(POS)\
+  sn__lua_glue_handle_arg_generic(POS, atom_t)
 
 // GENERIC OBJECT
 #define sn__lua_glue_handle_arg_object_t(POS)\
@@ -295,6 +303,9 @@
 // STRING TYPES
 #define sn__lua_glue_arg_value_string_t(POS)\
   sn__lua_glue_optarg(POS, lua_isstring, NULL, (string_t)lua_tolstring(L, (POS), NULL))
+// interned on the way in, so the glued function can compare atoms by pointer
+#define sn__lua_glue_arg_value_atom_t(POS)\
+  sn__lua_glue_optarg(POS, lua_isstring, NULL, atom_intern(lua_tolstring(L, (POS), NULL)))
 
 // GENERIC OBJECT TYPE
 #define sn__lua_glue_arg_value_object_t(POS)\
@@ -0,0 +1,267 @@
+/*
+  Lua states backed by snow allocators
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__LUA_ALLOC_C__
+
+#include "lua_alloc.h"
+#include <log/log.h>
+#include <time/time.h>
+#include <string.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+typedef struct s_lua_heap lua_heap_t;
+
+/*!
+ * Heap for a single Lua state. Lua states are not shared between threads, so
+ * the statistics are updated without locking.
+ */
+struct s_lua_heap
+{
+  /*! Backing allocator for the heap and its large allocations. */
+  allocator_t *alloc;
+  /*! Slabs for allocations of LUA_SMALL_OBJECT_SIZE bytes or less. */
+  slab_allocator_t slab;
+  /*! Running statistics. Only the counters are kept up to date. */
+  pool_stats_t stats;
+  /*! Time and allocation count at the previous call to ::sn_lua_stats. */
+  double stats_time;
+  uint64_t stats_allocations;
+};
+
+/*! Indices of the small and large totals in pool_stats_t::tags. */
+#define LUA_HEAP_SMALL_INDEX (0)
+#define LUA_HEAP_LARGE_INDEX (1)
+
+static void *lua_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+static int lua_heap_panic(lua_State *L);
+
+
+static pool_tag_stats_t *lua_heap_tag_stats(lua_heap_t *heap, size_t size)
+{
+  return &heap->stats.tags[size <= LUA_SMALL_OBJECT_SIZE ? LUA_HEAP_SMALL_INDEX : LUA_HEAP_LARGE_INDEX];
+}
+
+
+static void lua_heap_stats_add(lua_heap_t *heap, size_t size)
+{
+  pool_tag_stats_t *tag = lua_heap_tag_stats(heap, size);
+
+  heap->stats.used_bytes += size;
+  heap->stats.used_blocks += 1;
+  heap->stats.allocations += 1;
+  if (heap->stats.used_bytes > heap->stats.peak_used_bytes)
+    heap->stats.peak_used_bytes = heap->stats.used_bytes;
+
+  tag->blocks += 1;
+  tag->bytes += size;
+}
+
+
+static void lua_heap_stats_remove(lua_heap_t *heap, size_t size)
+{
+  pool_tag_stats_t *tag = lua_heap_tag_stats(heap, size);
+
+  heap->stats.used_bytes -= size;
+  heap->stats.used_blocks -= 1;
+
+  tag->blocks -= 1;
+  tag->bytes -= size;
+}
+
+
+static void lua_heap_stats_resize(lua_heap_t *heap, size_t old_size, size_t new_size)
+{
+  pool_tag_stats_t *old_tag = lua_heap_tag_stats(heap, old_size);
+  pool_tag_stats_t *new_tag = lua_heap_tag_stats(heap, new_size);
+
+  heap->stats.used_bytes = heap->stats.used_bytes - old_size + new_size;
+  if (heap->stats.used_bytes > heap->stats.peak_used_bytes)
+    heap->stats.peak_used_bytes = heap->stats.used_bytes;
+
+  old_tag->blocks -= 1;
+  old_tag->bytes -= old_size;
+  new_tag->blocks += 1;
+  new_tag->bytes += new_size;
+}
+
+
+lua_State *sn_lua_newstate(allocator_t *alloc)
+{
+  lua_heap_t *heap;
+  lua_State *L;
+
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  // engine allocators don't zero memory, and the stats start from zero
+  heap = (lua_heap_t *)com_calloc(alloc, 1, sizeof(*heap));
+  if (heap == NULL) {
+    s_log_error("Unable to allocate Lua heap.");
+    return NULL;
+  }
+
+  if (slab_init(&heap->slab, alloc)) {
+    s_log_error("Unable to initialize Lua heap slabs.");
+    com_free(alloc, heap);
+    return NULL;
+  }
+
+  heap->alloc = alloc;
+  heap->stats.tags[LUA_HEAP_SMALL_INDEX].tag = LUA_HEAP_TAG_SMALL;
+  heap->stats.tags[LUA_HEAP_LARGE_INDEX].tag = LUA_HEAP_TAG_LARGE;
+  heap->stats_time = current_time();
+
+  L = lua_newstate(lua_heap_alloc, heap);
+  if (L == NULL) {
+    s_log_error("Unable to create Lua state.");
+    slab_destroy(&heap->slab);
+    com_free(alloc, heap);
+    return NULL;
+  }
+
+  lua_atpanic(L, lua_heap_panic);
+
+  return L;
+}
+
+
+void sn_lua_close(lua_State *L)
+{
+  lua_heap_t *heap = NULL;
+  allocator_t *alloc;
+
+  if (L == NULL)
+    return;
+
+  if (lua_getallocf(L, (void **)&heap) != lua_heap_alloc) {
+    s_log_error("Attempt to close Lua state (%p) not created by sn_lua_newstate.", (void *)L);
+    return;
+  }
+
+  lua_close(L);
+
+#if !NDEBUG
+  if (heap->stats.used_blocks)
+    s_log_error("Lua heap (%p) has %zu blocks live after closing its state.",
+      (void *)heap, heap->stats.used_blocks);
+#endif
+
+  alloc = heap->alloc;
+  slab_destroy(&heap->slab);
+  com_free(alloc, heap);
+}
+
+
+void sn_lua_stats(lua_State *L, pool_stats_t *stats)
+{
+  lua_heap_t *heap = NULL;
+  size_t class_index;
+  buffersize_t slab_bytes = 0;
+  buffersize_t largest = 0;
+  s_time_t now;
+
+  if (lua_getallocf(L, (void **)&heap) != lua_heap_alloc) {
+    s_log_error("Attempt to get heap statistics for Lua state (%p) not created by sn_lua_newstate.", (void *)L);
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+
+  *stats = heap->stats;
+
+  mutex_lock(&heap->slab.lock);
+  for (class_index = 0; class_index < SLAB_CLASS_COUNT; ++class_index) {
+    const slab_class_t *class = &heap->slab.classes[class_index];
+    slab_bytes += class->slabs * SLAB_PAGE_SIZE;
+    if (class->free && class->object_size > largest)
+      largest = class->object_size;
+  }
+  mutex_unlock(&heap->slab.lock);
+
+  /* Large allocations are sized exactly, so all free memory is in slabs. */
+  stats->size = slab_bytes + heap->stats.tags[LUA_HEAP_LARGE_INDEX].bytes;
+  stats->free_bytes = stats->size - stats->used_bytes;
+  stats->largest_free_block = largest;
+  stats->fragmentation = stats->free_bytes
+                         ? 1.0f - (float)((double)largest / (double)stats->free_bytes)
+                         : 0.0f;
+
+  now = current_time();
+  if (now > heap->stats_time)
+    stats->allocation_rate = (double)(heap->stats.allocations - heap->stats_allocations) / (now - heap->stats_time);
+  else
+    stats->allocation_rate = 0;
+
+  heap->stats_time = now;
+  heap->stats_allocations = heap->stats.allocations;
+}
+
+
+/*
+  lua_Alloc implementation. Lua always passes the block's current size as
+  osize, so whether a block lives in a slab or came from the backing
+  allocator follows from its size alone and no header is needed.
+*/
+static void *lua_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  lua_heap_t *heap = (lua_heap_t *)ud;
+  allocator_t *small = slab_allocator(&heap->slab);
+  const bool was_small = osize <= LUA_SMALL_OBJECT_SIZE;
+  const bool is_small = nsize <= LUA_SMALL_OBJECT_SIZE;
+  void *result;
+
+  /* For new blocks, osize is the type of object being allocated. */
+  if (ptr == NULL)
+    osize = 0;
+
+  if (nsize == 0) {
+    if (ptr) {
+      com_free(was_small ? small : heap->alloc, ptr);
+      lua_heap_stats_remove(heap, osize);
+    }
+    return NULL;
+  }
+
+  if (ptr == NULL) {
+    result = com_malloc_uninit(is_small ? small : heap->alloc, nsize);
+    if (result)
+      lua_heap_stats_add(heap, nsize);
+    return result;
+  }
+
+  if (was_small == is_small) {
+    result = com_realloc(is_small ? small : heap->alloc, ptr, nsize);
+    /* Lua expects shrinking to succeed. Slab objects can stay where they
+       are, since the slab is found from the object's address. */
+    if (result == NULL && is_small && nsize <= osize)
+      result = ptr;
+  } else {
+    result = com_malloc_uninit(is_small ? small : heap->alloc, nsize);
+    if (result) {
+      memcpy(result, ptr, osize < nsize ? osize : nsize);
+      com_free(was_small ? small : heap->alloc, ptr);
+    }
+  }
+
+  if (result)
+    lua_heap_stats_resize(heap, osize, nsize);
+
+  return result;
+}
+
+
+static int lua_heap_panic(lua_State *L)
+{
+  s_log_error("Unprotected error in call to Lua API (%s)", lua_tostring(L, -1));
+  return 0;  /* return to Lua to abort */
+}
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+  Lua states backed by snow allocators
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__LUA_ALLOC_H__
+#define __SNOW__LUA_ALLOC_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include <memory/memory_pool.h>
+#include <memory/slab.h>
+#include "lua.h"
+
+/*!
+  \file
+
+  Lua states whose memory comes from an engine allocator instead of the C
+  library. Most of a Lua heap is small strings, tables, closures and upvalues,
+  so allocations of LUA_SMALL_OBJECT_SIZE bytes or less are served from a slab
+  allocator private to the state. Larger allocations, such as table arrays and
+  long strings, go to the backing allocator.
+
+  Each state keeps running totals of its heap that ::sn_lua_stats reports in
+  the same form as ::pool_stats.
+*/
+
+#ifdef __SNOW__LUA_ALLOC_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/*! Largest allocation served from a Lua state's slabs. */
+#define LUA_SMALL_OBJECT_SIZE (256)
+
+/*! Statistics tag for allocations served from slabs. */
+#define LUA_HEAP_TAG_SMALL (1)
+/*! Statistics tag for allocations served from the backing allocator. */
+#define LUA_HEAP_TAG_LARGE (2)
+
+/*!
+ * Creates a new Lua state that allocates from alloc. If alloc is NULL, the
+ * default allocator is used. Returns NULL on failure. A state created this
+ * way must be closed with ::sn_lua_close.
+ */
+lua_State *sn_lua_newstate(allocator_t *alloc);
+
+/*!
+ * Closes a Lua state created by ::sn_lua_newstate and releases its heap.
+ */
+void sn_lua_close(lua_State *L);
+
+/*!
+ * Gets statistics for a Lua state's heap. Sizes are the sizes Lua requested,
+ * so slab rounding is counted as free memory. For slabs, largest_free_block
+ * is the largest size class with a free object.
+ *
+ * \param[in] L      A state created by ::sn_lua_newstate.
+ * \param[out] stats The statistics.
+ */
+void sn_lua_stats(lua_State *L, pool_stats_t *stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__LUA_ALLOC_H__ */
@@ -12,11 +12,14 @@
 #include <threads/threadstorage.h>
 #include <events/events.h>
 #include <time/time.h>
+#include <structs/atom.h>
 
 static void main_shutdown(void)
 {
   sys_events_shutdown();
+  sys_atoms_shutdown();
   sys_tls_shutdown();
+  sys_frame_arena_shutdown();
   sys_pool_shutdown();
 
   if ( ! PHYSFS_deinit()) {
@@ -30,7 +33,9 @@ int main(int argc, const char *argv[])
   PHYSFS_init(argv[0]);
   sys_time_init();
   sys_pool_init(g_default_allocator);
+  sys_frame_arena_init(g_default_allocator);
   sys_tls_init(g_default_allocator);
+  sys_atoms_init(g_default_allocator);
   sys_events_init(g_default_allocator);
 
   atexit(main_shutdown);
@@ -2,6 +2,14 @@
 
 #include "allocator.h"
 
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define sn_usable_size(P) malloc_size(P)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define sn_usable_size(P) malloc_usable_size(P)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -13,6 +21,29 @@ static void *sn_malloc(size_t min_size, void *ctx) {
   return p;
 }
 
+static void *sn_malloc_uninit(size_t min_size, void *ctx) {
+  (void)ctx;
+  return malloc(min_size);
+}
+
+static void *sn_calloc(size_t count, size_t size, void *ctx) {
+  (void)ctx;
+  return calloc(count, size);
+}
+
+static void *sn_malloc_usable(size_t min_size, size_t *usable_size, void *ctx) {
+  (void)ctx;
+  void *p = malloc(min_size);
+  if (p && usable_size) {
+#ifdef sn_usable_size
+    *usable_size = sn_usable_size(p);
+#else
+    *usable_size = min_size;
+#endif
+  }
+  return p;
+}
+
 static void sn_free(void *p, void *ctx) {
   (void)ctx;
   free(p);
@@ -27,7 +58,10 @@ static allocator_t default_allocator = {
   .malloc = sn_malloc,
   .realloc = sn_realloc,
   .free = sn_free,
-  .context = NULL
+  .context = NULL,
+  .malloc_uninit = sn_malloc_uninit,
+  .calloc = sn_calloc,
+  .malloc_usable = sn_malloc_usable
 };
 
 allocator_t *g_default_allocator = &default_allocator;
@@ -56,6 +90,47 @@ void com_free(allocator_t *alloc, void *p) {
   return alloc->free(p, alloc->context);
 }
 
+void *com_malloc_uninit(allocator_t *alloc, size_t min_size) {
+  if (alloc == NULL) {
+    s_log_warning("NULL allocator provided, using default allocator.");
+    alloc = g_default_allocator;
+  }
+  if (alloc->malloc_uninit)
+    return alloc->malloc_uninit(min_size, alloc->context);
+  return alloc->malloc(min_size, alloc->context);
+}
+
+void *com_calloc(allocator_t *alloc, size_t count, size_t size) {
+  if (alloc == NULL) {
+    s_log_warning("NULL allocator provided, using default allocator.");
+    alloc = g_default_allocator;
+  }
+  if (alloc->calloc)
+    return alloc->calloc(count, size, alloc->context);
+
+  if (size && count > SIZE_MAX / size) {
+    s_log_error("Allocation of %zu objects of %zu bytes overflows.", count, size);
+    return NULL;
+  }
+
+  void *p = alloc->malloc(count * size, alloc->context);
+  if (p) memset(p, 0, count * size);
+  return p;
+}
+
+void *com_malloc_usable(allocator_t *alloc, size_t min_size, size_t *usable_size) {
+  if (alloc == NULL) {
+    s_log_warning("NULL allocator provided, using default allocator.");
+    alloc = g_default_allocator;
+  }
+  if (alloc->malloc_usable)
+    return alloc->malloc_usable(min_size, usable_size, alloc->context);
+
+  void *p = com_malloc_uninit(alloc, min_size);
+  if (p && usable_size) *usable_size = min_size;
+  return p;
+}
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -16,12 +16,23 @@ extern "C" {
 typedef void (*free_fn_t)(void *p, void *context);
 typedef void *(*malloc_fn_t)(size_t min_size, void *context);
 typedef void *(*realloc_fn_t)(void *p, size_t min_size, void *context);
+typedef void *(*calloc_fn_t)(size_t count, size_t size, void *context);
+typedef void *(*usable_malloc_fn_t)(size_t min_size, size_t *usable_size, void *context);
 
 typedef struct s_allocator {
   malloc_fn_t malloc;
   realloc_fn_t realloc;
   free_fn_t free;
   void *context;
+  // Optional entry points -- may be NULL, in which case the com_ functions
+  // below fall back on malloc.
+  // Allocates memory without initializing it.
+  malloc_fn_t malloc_uninit;
+  // Allocates zeroed memory for count objects of the given size.
+  calloc_fn_t calloc;
+  // Allocates uninitialized memory and stores the number of bytes actually
+  // usable (at least min_size) in usable_size.
+  usable_malloc_fn_t malloc_usable;
 } allocator_t;
 
 extern allocator_t *g_default_allocator;
@@ -30,6 +41,17 @@ void *com_malloc(allocator_t *alloc, size_t min_size);
 void *com_realloc(allocator_t *alloc, void *p, size_t min_size);
 void com_free(allocator_t *alloc, void *p);
 
+// Allocates memory whose contents are unspecified. Use this when the memory
+// is overwritten right away.
+void *com_malloc_uninit(allocator_t *alloc, size_t min_size);
+// Allocates zeroed memory for count objects of size bytes each. Returns NULL
+// if count * size overflows.
+void *com_calloc(allocator_t *alloc, size_t count, size_t size);
+// Allocates uninitialized memory of at least min_size bytes. If usable_size
+// is non-NULL, it receives the number of bytes that may actually be used,
+// which can be more than min_size.
+void *com_malloc_usable(allocator_t *alloc, size_t min_size, size_t *usable_size);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
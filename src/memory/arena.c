@@ -0,0 +1,310 @@
+/*
+  Per-frame arena allocator
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__ARENA_C__
+
+#include "arena.h"
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/*! Alignment of arena allocations. Must be a power of two. */
+#define ARENA_ALIGNMENT (16)
+#define ARENA_ALIGN(SZ) (((SZ) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
+/*! Space taken by the header of each allocation. */
+#define ARENA_HEADER_SIZE ARENA_ALIGN(sizeof(arena_block_t))
+#define ARENA_BLOCK_POINTER(BLOCK) ((void *)((char *)(BLOCK) + ARENA_HEADER_SIZE))
+#define ARENA_POINTER_BLOCK(P) ((arena_block_t *)((char *)(P) - ARENA_HEADER_SIZE))
+
+/*! Default size of each of the global frame arena's buffers. */
+#if !defined(FRAME_ARENA_SIZE)
+#define FRAME_ARENA_SIZE (1/*mb*/ * 1024/*kb*/ * 1024/*b*/)
+#endif
+
+static arena_t g_frame_arena;
+allocator_t *g_frame_allocator = NULL;
+
+static void *al_arena_malloc(size_t min_size, void *ctx);
+static void *al_arena_malloc_usable(size_t min_size, size_t *usable_size, void *ctx);
+static void *al_arena_realloc(void *p, size_t min_size, void *ctx);
+static void al_arena_free(void *p, void *ctx);
+
+
+void sys_frame_arena_init(allocator_t *alloc)
+{
+  if (g_frame_allocator) return;
+
+  if (arena_init(&g_frame_arena, FRAME_ARENA_SIZE, alloc) == 0)
+    g_frame_allocator = arena_allocator(&g_frame_arena);
+}
+
+
+void sys_frame_arena_shutdown(void)
+{
+  if ( ! g_frame_allocator) return;
+
+  g_frame_allocator = NULL;
+  arena_destroy(&g_frame_arena);
+}
+
+
+void sys_frame_arena_reset(void)
+{
+  if (g_frame_allocator)
+    arena_reset(&g_frame_arena);
+}
+
+
+int arena_init(arena_t *arena, size_t capacity, allocator_t *alloc)
+{
+  int frame_index;
+
+  if (arena == NULL) {
+    s_log_error("Attempt to initialize NULL arena.");
+    return -1;
+  }
+
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  memset(arena, 0, sizeof(*arena));
+
+  arena->alloc = alloc;
+  arena->capacity = ARENA_ALIGN(capacity);
+
+  for (frame_index = 0; frame_index < 2; ++frame_index) {
+    if (arena->capacity == 0)
+      break;
+
+    arena->frames[frame_index].buffer = (char *)com_malloc_uninit(alloc, arena->capacity);
+
+    if (arena->frames[frame_index].buffer == NULL) {
+      s_log_error("Failed to allocate arena buffer of %zu bytes.", arena->capacity);
+      if (frame_index)
+        com_free(alloc, arena->frames[0].buffer);
+      return -1;
+    }
+  }
+
+  if (mutex_init(&arena->lock, false)) {
+    s_log_error("Failed to initialize arena mutex.");
+    for (frame_index = 0; frame_index < 2; ++frame_index)
+      if (arena->frames[frame_index].buffer)
+        com_free(alloc, arena->frames[frame_index].buffer);
+    return -1;
+  }
+
+  arena->allocator.malloc = al_arena_malloc;
+  arena->allocator.realloc = al_arena_realloc;
+  arena->allocator.free = al_arena_free;
+  arena->allocator.context = arena;
+  arena->allocator.malloc_uninit = al_arena_malloc;
+  arena->allocator.malloc_usable = al_arena_malloc_usable;
+
+  return 0;
+}
+
+
+static void arena_release_overflow(arena_t *arena, arena_frame_t *frame)
+{
+  arena_block_t *block = frame->overflow;
+
+  while (block) {
+    arena_block_t *next = block->next;
+    com_free(arena->alloc, block);
+    block = next;
+  }
+
+  frame->overflow = NULL;
+  frame->overflow_size = 0;
+}
+
+
+void arena_destroy(arena_t *arena)
+{
+  int frame_index;
+
+  mutex_lock(&arena->lock);
+
+  for (frame_index = 0; frame_index < 2; ++frame_index) {
+    arena_frame_t *frame = &arena->frames[frame_index];
+
+    arena_release_overflow(arena, frame);
+    if (frame->buffer)
+      com_free(arena->alloc, frame->buffer);
+  }
+
+  mutex_unlock(&arena->lock);
+  mutex_destroy(&arena->lock);
+
+  memset(arena, 0, sizeof(*arena));
+}
+
+
+void arena_reset(arena_t *arena)
+{
+  arena_frame_t *frame;
+
+  mutex_lock(&arena->lock);
+
+  arena->current ^= 1;
+  frame = &arena->frames[arena->current];
+
+  arena_release_overflow(arena, frame);
+  frame->offset = 0;
+
+  mutex_unlock(&arena->lock);
+}
+
+
+allocator_t *arena_allocator(arena_t *arena)
+{
+  return &arena->allocator;
+}
+
+
+size_t arena_used(const arena_t *arena)
+{
+  const arena_frame_t *frame = &arena->frames[arena->current];
+  return frame->offset + frame->overflow_size;
+}
+
+
+size_t arena_overflow(const arena_t *arena)
+{
+  return arena->frames[arena->current].overflow_size;
+}
+
+
+size_t arena_high_water(const arena_t *arena)
+{
+  return arena->high_water;
+}
+
+
+/* must be called with the arena locked */
+static void *arena_alloc_locked(arena_t *arena, size_t min_size)
+{
+  arena_frame_t *frame = &arena->frames[arena->current];
+  const size_t block_size = ARENA_HEADER_SIZE + ARENA_ALIGN(min_size);
+  arena_block_t *block;
+  size_t used;
+
+  if (frame->buffer && block_size <= arena->capacity - frame->offset) {
+    block = (arena_block_t *)(frame->buffer + frame->offset);
+    block->next = NULL;
+    frame->offset += block_size;
+  } else {
+    /* out of frame memory, fall back to the backing allocator */
+    block = (arena_block_t *)com_malloc_uninit(arena->alloc, block_size);
+    if (block == NULL) {
+      s_log_error("Failed to allocate %zu bytes of arena overflow.", min_size);
+      return NULL;
+    }
+
+    block->next = frame->overflow;
+    frame->overflow = block;
+    frame->overflow_size += block_size;
+  }
+
+  block->size = min_size;
+
+  used = frame->offset + frame->overflow_size;
+  if (used > arena->high_water)
+    arena->high_water = used;
+
+  return ARENA_BLOCK_POINTER(block);
+}
+
+
+static void *al_arena_malloc(size_t min_size, void *ctx)
+{
+  arena_t *arena = (arena_t *)ctx;
+  void *p;
+
+  mutex_lock(&arena->lock);
+  p = arena_alloc_locked(arena, min_size);
+  mutex_unlock(&arena->lock);
+
+  return p;
+}
+
+
+static void *al_arena_malloc_usable(size_t min_size, size_t *usable_size, void *ctx)
+{
+  arena_t *arena = (arena_t *)ctx;
+  void *p;
+
+  /* the alignment padding is usable too */
+  min_size = ARENA_ALIGN(min_size);
+
+  mutex_lock(&arena->lock);
+  p = arena_alloc_locked(arena, min_size);
+  mutex_unlock(&arena->lock);
+
+  if (p && usable_size)
+    *usable_size = min_size;
+
+  return p;
+}
+
+
+static void *al_arena_realloc(void *p, size_t min_size, void *ctx)
+{
+  arena_t *arena = (arena_t *)ctx;
+  arena_frame_t *frame;
+  arena_block_t *block;
+  char *block_end;
+  void *new_p;
+
+  if (p == NULL)
+    return al_arena_malloc(min_size, ctx);
+
+  block = ARENA_POINTER_BLOCK(p);
+
+  if (min_size <= block->size)
+    return p;
+
+  mutex_lock(&arena->lock);
+
+  frame = &arena->frames[arena->current];
+  block_end = (char *)p + ARENA_ALIGN(block->size);
+
+  if (frame->buffer && block_end == frame->buffer + frame->offset &&
+      ARENA_ALIGN(min_size) - ARENA_ALIGN(block->size) <= arena->capacity - frame->offset) {
+    /* most recent allocation in the buffer, so just bump the offset */
+    frame->offset += ARENA_ALIGN(min_size) - ARENA_ALIGN(block->size);
+    block->size = min_size;
+
+    if (frame->offset + frame->overflow_size > arena->high_water)
+      arena->high_water = frame->offset + frame->overflow_size;
+
+    new_p = p;
+  } else {
+    new_p = arena_alloc_locked(arena, min_size);
+    if (new_p)
+      memcpy(new_p, p, block->size);
+  }
+
+  mutex_unlock(&arena->lock);
+
+  return new_p;
+}
+
+
+static void al_arena_free(void *p, void *ctx)
+{
+  /* released in bulk by arena_reset */
+  (void)p;
+  (void)ctx;
+}
+
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,155 @@
+/*
+  Per-frame arena allocator
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__ARENA_H__
+#define __SNOW__ARENA_H__
+
+#include <snow-config.h>
+#include <threads/mutex.h>
+#include "allocator.h"
+
+/*!
+  \file
+
+  A double-buffered bump allocator for short-lived memory. Allocations are
+  carved out of the current frame's buffer by bumping an offset, and freeing
+  them does nothing. When ::arena_reset is called, the arena switches to its
+  other buffer and rewinds it, so memory allocated during one frame stays
+  valid through the following frame and is reclaimed after that.
+
+  If a frame needs more memory than its buffer holds, the remainder is
+  allocated from the arena's backing allocator and released when the frame's
+  buffer is next rewound.
+
+  Memory returned by an arena is not zeroed.
+
+  The global frame arena is reset at the start of every ::sys_frame and is
+  available through ::g_frame_allocator.
+*/
+
+#ifdef __SNOW__ARENA_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+typedef struct s_arena_block arena_block_t;
+typedef struct s_arena_frame arena_frame_t;
+typedef struct s_arena arena_t;
+
+/*!
+ * Header preceding every arena allocation.
+ */
+struct s_arena_block
+{
+  /*! Next overflow block. Unused for blocks in the frame buffer. */
+  arena_block_t *next;
+  /*! Requested size of the allocation. */
+  size_t size;
+};
+
+/*!
+ * One of the arena's two frame buffers.
+ */
+struct s_arena_frame
+{
+  char *buffer;
+  /*! Bytes of the buffer in use. */
+  size_t offset;
+  /*! Blocks allocated from the backing allocator when the buffer ran out. */
+  arena_block_t *overflow;
+  /*! Total size of overflow blocks. */
+  size_t overflow_size;
+};
+
+/*!
+ * Arena structure. Members are read-only outside of the arena routines.
+ */
+struct s_arena
+{
+  /*! Backing allocator for frame buffers and overflow blocks. */
+  allocator_t *alloc;
+  /*! Size of each frame buffer. */
+  size_t capacity;
+  arena_frame_t frames[2];
+  /*! Index of the frame currently allocated from. */
+  int current;
+  /*! Most memory used by any single frame, including overflow. */
+  size_t high_water;
+  /*! Allocator interface for the arena. */
+  allocator_t allocator;
+  mutex_t lock;
+};
+
+/*! Allocator for per-frame temporaries. NULL until ::sys_frame_arena_init. */
+extern allocator_t *g_frame_allocator;
+
+/*!
+ * Initializes the global frame arena.
+ */
+void sys_frame_arena_init(allocator_t *alloc);
+
+/*!
+ * Destroys the global frame arena.
+ */
+void sys_frame_arena_shutdown(void);
+
+/*!
+ * Resets the global frame arena. Called at the start of every frame.
+ */
+void sys_frame_arena_reset(void);
+
+/*!
+ * Initializes an arena with two frame buffers of the given capacity taken
+ * from alloc. Returns 0 on success, -1 on failure.
+ */
+int arena_init(arena_t *arena, size_t capacity, allocator_t *alloc);
+
+/*!
+ * Destroys an arena and releases all memory allocated from it.
+ */
+void arena_destroy(arena_t *arena);
+
+/*!
+ * Switches the arena to its other frame buffer and rewinds it. Anything
+ * allocated before the previous reset is released.
+ */
+void arena_reset(arena_t *arena);
+
+/*!
+ * Gets an allocator for the arena. Its free function does nothing.
+ */
+allocator_t *arena_allocator(arena_t *arena);
+
+/*!
+ * Returns the number of bytes allocated during the current frame, including
+ * overflow.
+ */
+size_t arena_used(const arena_t *arena);
+
+/*!
+ * Returns the number of bytes allocated from the backing allocator during the
+ * current frame because the frame buffer was full.
+ */
+size_t arena_overflow(const arena_t *arena);
+
+/*!
+ * Returns the most memory any single frame has used, including overflow.
+ */
+size_t arena_high_water(const arena_t *arena);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__ARENA_H__ */
@@ -3,5 +3,7 @@
 
 #include "memory_pool.h"
 #include "allocator.h"
+#include "arena.h"
+#include "slab.h"
 
 #endif /* end of include guard: MEMORY_H_OKKLV5FX */
@@ -8,19 +8,54 @@
 #define __SNOW__MEMORY_POOL_C__
 
 #include "memory_pool.h"
+#include <time/time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define USE_MMAP 0
+#endif
+
+#if !NDEBUG && (defined(__APPLE__) || defined(__GLIBC__))
+#define USE_BACKTRACE 1
+#include <execinfo.h>
+#else
+#define USE_BACKTRACE 0
+#endif
+
 #if defined(__cplusplus)
 extern "C"
 {
 #endif
 
 #define USE_MEMORY_GUARD 1
+/*! Whether to find unused blocks through the segregated free lists (constant
+  time) rather than by walking the block list (linear time). */
+#define USE_SEGREGATED_FIT 1
 
 typedef uint32_t guard_t;
 
+#if USE_SEGREGATED_FIT
+typedef struct s_free_links free_links_t;
+
+/*!
+ * Free list links. These are stored in the buffer of an unused block, so
+ * they cost nothing for blocks in use.
+ */
+struct s_free_links
+{
+  block_head_t *prev;
+  block_head_t *next;
+};
+
+#define FREE_LINKS(BLOCK) ((free_links_t *)((BLOCK) + 1))
+#endif /* USE_SEGREGATED_FIT */
+
 /*!
  * The minimum size of a memory pool.  This number is kind of arbitrary, but by
  * default the minimum is the size of four minimum-size blocks.
@@ -28,7 +63,7 @@ typedef uint32_t guard_t;
 #define MIN_POOL_SIZE (MIN_BLOCK_SIZE * 4)
 /*! Default memory pool size for main pools. */
 #define DEFAULT_POOL_SIZE (8/*mb*/ * 1024/*kb*/ * 1024/*b*/)
-/*! Alignment for memory blocks.  Must be a power of two minus one. */
+/*! Alignment for memory blocks.  Must be a power of two. */
 #define BLOCK_ALIGNMENT (16)
 #if USE_MEMORY_GUARD
 #define MEMORY_GUARD_SIZE (sizeof(guard_t))
@@ -36,9 +71,14 @@ typedef uint32_t guard_t;
 #define MEMORY_GUARD_SIZE (0)
 #endif /* USE_MEMORY_GUARD */
 /*! Macro for quickly getting the actual size of a block given a requested size. */
-#define BLOCK_SIZE(SZ) ((buffersize_t)((SZ) + sizeof(block_head_t) + (BLOCK_ALIGNMENT) & ~(BLOCK_ALIGNMENT - 1) + MEMORY_GUARD_SIZE))
+#define BLOCK_SIZE(SZ) ((buffersize_t)(((SZ) + sizeof(block_head_t) + MEMORY_GUARD_SIZE + (BLOCK_ALIGNMENT - 1)) & ~(BLOCK_ALIGNMENT - 1)))
+#if USE_SEGREGATED_FIT
+/*! Minimum allocation size - large enough to hold free list links. */
+#define MIN_ALLOC_SIZE (sizeof(free_links_t))
+#else
 /*! Minimum allocation size - defaults to larger of a pointer or size_t. */
 #define MIN_ALLOC_SIZE (sizeof(void *) >= sizeof(size_t) ? sizeof(void *) : sizeof(size_t))
+#endif /* USE_SEGREGATED_FIT */
 /*! Size of a block for a minimum-size allocation. */
 #define MIN_BLOCK_SIZE BLOCK_SIZE(MIN_ALLOC_SIZE)
 /*! Memory guard value - used to determine if something has written outside the
@@ -49,9 +89,57 @@ typedef uint32_t guard_t;
 #define MAIN_POOL_SIZE DEFAULT_POOL_SIZE
 #endif
 
+/*! Blocks smaller than this all map to the first first-level free list. */
+#define SMALL_BLOCK_SIZE ((buffersize_t)1 << POOL_FL_INDEX_SHIFT)
+/*! Largest pool size the segregated free lists can index. */
+#define MAX_POOL_SIZE ((uint64_t)1 << POOL_FL_INDEX_MAX)
+/*! Huge page size used for commits when POOL_MAP_HUGE_PAGES is set. */
+#define HUGE_PAGE_SIZE (2/*mb*/ * 1024/*kb*/ * 1024/*b*/)
+
 /*! The main memory pool. */
 static pool_t g_main_pool;
 
+#if !NDEBUG
+
+/*!
+ * A profiler sample for a live block.
+ */
+struct s_pool_sample
+{
+  pool_sample_t *prev;
+  pool_sample_t *next;
+  /*! Allocation site of the sampled block. */
+  uint32_t site;
+  /*! Requested size of the sampled block. */
+  buffersize_t size;
+  /*! Call stack at the time of the allocation. */
+  int depth;
+  void *frames[POOL_SAMPLE_DEPTH];
+};
+
+/*! Interned allocation sites, shared by all pools. Site ids are indices into
+    this plus one. Entries are published by setting their file last and never
+    change afterward, so lookups don't take the lock. */
+static pool_site_t g_pool_sites[POOL_SITE_COUNT];
+/*! Spinlock for adding sites. */
+static volatile int g_pool_sites_lock = 0;
+
+/*!
+ * Gets the id of an allocation site, interning it if it's new. Returns zero if
+ * the site table is full.
+ */
+static uint32_t pool_intern_site(const char *file, const char *function, int32_t line);
+/*!
+ * Decides whether to sample a new block, recording a sample for it if so.
+ */
+static void pool_sample_block(pool_t *pool, block_head_t *block, buffersize_t size);
+/*!
+ * Unlinks and releases a block's sample.
+ */
+static void pool_release_sample(pool_t *pool, pool_sample_t *sample);
+
+#endif /* !NDEBUG */
+
 
 /*!
  * Prints a block's properties to stderr.
@@ -84,6 +172,66 @@ static int pool_split_block(block_head_t *block, buffersize_t pred_size);
  * the function will return -1 (failure). Returns 0 on success.
  */
 static int pool_merge_blocks(block_head_t *blka, block_head_t *blkb);
+/*!
+ * Adds an unused block to the region's free lists.
+ */
+static inline void pool_insert_free_block(pool_region_t *region, block_head_t *block);
+/*!
+ * Removes an unused block from the region's free lists.
+ */
+static inline void pool_remove_free_block(pool_region_t *region, block_head_t *block);
+/*!
+ * Finds an unused block of at least block_size bytes in the region, or NULL
+ * if there is none. The block is not removed from the free lists.
+ */
+static block_head_t *pool_find_free_block(pool_region_t *region, buffersize_t block_size);
+/*!
+ * Gets the region of the pool a block belongs to, or NULL if it isn't in any
+ * of the pool's regions.
+ */
+static pool_region_t *pool_region_for_block(pool_t *pool, const block_head_t *block);
+/*!
+ * Grows the pool so it can hold a block of block_size bytes, if it's allowed
+ * to grow. Returns the region that grew, whose last block is then an unused
+ * block large enough, or NULL.
+ */
+static pool_region_t *pool_grow(pool_t *pool, buffersize_t block_size);
+#if USE_MMAP
+/*!
+ * Commits more of a mapped pool's reservation to its first region.
+ */
+static pool_region_t *pool_grow_mapped(pool_t *pool, buffersize_t block_size);
+/*!
+ * Decommits the free tail of a mapped pool's first region, given the
+ * region's last block, which must be unused.
+ */
+static void pool_decommit_tail(pool_t *pool, block_head_t *block);
+#endif /* USE_MMAP */
+/*!
+ * Returns an empty region to the pool's backing allocator.
+ */
+static void pool_release_region(pool_t *pool, pool_region_t *region);
+/*!
+ * Counts a newly allocated block in the pool's statistics.
+ */
+static inline void pool_stats_add(pool_t *pool, int32_t tag, buffersize_t size);
+/*!
+ * Removes a freed block from the pool's statistics.
+ */
+static inline void pool_stats_remove(pool_t *pool, int32_t tag, buffersize_t size);
+/*!
+ * Updates the pool's statistics for a block resized in place.
+ */
+static inline void pool_stats_resize(pool_t *pool, int32_t tag, buffersize_t old_size, buffersize_t new_size);
+/*!
+ * Gets the size of the largest unused block in a region.
+ */
+static buffersize_t pool_region_largest_free(const pool_region_t *region);
+/*!
+ * Releases every thread's cache for the pool and stops caching blocks for
+ * pool allocators.
+ */
+static void pool_destroy_thread_caches(pool_t *pool);
 
 
 
@@ -103,11 +251,45 @@ void sys_pool_shutdown(void)
 }
 
 
+/* sets up a region with a single unused block covering the buffer */
+static void pool_region_set_up(pool_t *pool, pool_region_t *region, char *buffer, buffersize_t size)
+{
+  block_head_t *block = (block_head_t *)(((uintptr_t)buffer + (BLOCK_ALIGNMENT - 1)) & ~(uintptr_t)(BLOCK_ALIGNMENT - 1));
+
+  region->next = NULL;
+  region->buffer = (char *)block;
+  /* the first block can't run past the end of the buffer */
+  region->size = (size - ((char *)block - buffer)) & ~(BLOCK_ALIGNMENT - 1);
+
+  block->size = region->size;
+  block->used = 0;
+  block->tag = 0;
+  block->next = &region->head;
+  block->prev = &region->head;
+  block->pool = pool;
+
+  region->head.used = 1;
+  region->head.tag = 0;
+  region->head.size = 0;
+  region->head.next = block;
+  region->head.prev = block;
+  region->head.pool = pool;
+
+  region->fl_bitmap = 0;
+  memset(region->sl_bitmap, 0, sizeof(region->sl_bitmap));
+  memset(region->free_blocks, 0, sizeof(region->free_blocks));
+  pool_insert_free_block(region, block);
+}
+
+
 static int pool_set_up(pool_t *pool, char *buffer, buffersize_t pool_size, bool managed, allocator_t *alloc)
 {
   if (pool_size < MIN_POOL_SIZE) {
     s_log_error("Attempt to allocate pool smaller than the minimum pool size.");
     return -1;
+  } else if ((uint64_t)pool_size >= MAX_POOL_SIZE) {
+    s_log_error("Attempt to allocate pool larger than the maximum pool size.");
+    return -1;
   }
 
   if (mutex_init(&pool->lock, true)) {
@@ -117,27 +299,41 @@ static int pool_set_up(pool_t *pool, char *buffer, buffersize_t pool_size, bool
 
   mutex_lock(&pool->lock);
 
-  pool->alloc = alloc;
-  pool->size = pool_size;
+  pool->alloc = alloc ? alloc : g_default_allocator;
   pool->buffer = buffer;
 
-  block_head_t *block = (block_head_t *)(((unsigned long)pool->buffer + (BLOCK_ALIGNMENT)) & ~(BLOCK_ALIGNMENT - 1));
-  block->size = pool_size;
-  block->used = 0;
-  block->next = &pool->head;
-  block->prev = &pool->head;
-  block->pool = pool;
+  pool_region_set_up(pool, &pool->root, buffer, pool_size);
+  pool->regions = &pool->root;
+  pool->size = pool->root.size;
 
   pool->head.used = 1;
   pool->head.size = 0;
-  pool->head.next = block;
-  pool->head.prev = block;
+  pool->head.next = NULL;
+  pool->head.prev = NULL;
   pool->head.pool = pool;
 
-  pool->next_unused = block;
   pool->sequence = 1;
 
+  memset(&pool->stats, 0, sizeof(pool->stats));
+  pool->stats_time = current_time();
+  pool->stats_allocations = 0;
+
+#if !NDEBUG
+  pool->sample_rate = 0;
+  pool->sample_countdown = 0;
+  pool->samples = NULL;
+#endif /* !NDEBUG */
+
   pool->managed = managed;
+  pool->mapped = false;
+  pool->reserved = 0;
+  pool->min_committed = 0;
+  pool->commit_granularity = 0;
+  /* pools made from an outside buffer stay inside it unless told otherwise */
+  pool->growth_factor = managed ? POOL_DEFAULT_GROWTH_FACTOR : 0.0f;
+
+  pool->cached = false;
+  pool->caches = NULL;
 
   mutex_unlock(&pool->lock);
 
@@ -164,7 +360,7 @@ int pool_init(pool_t *pool, buffersize_t size, allocator_t *alloc)
     alloc = g_default_allocator;
 
   if ( ! pool->buffer) {
-    buffer = com_malloc(alloc, buffer_size);
+    buffer = com_malloc_uninit(alloc, buffer_size);
 
     if (buffer == NULL) {
       s_log_error("Failed to allocate buffer for memory pool.");
@@ -212,20 +408,138 @@ int pool_init_with_pointer(pool_t *pool, void *p, buffersize_t size, allocator_t
 }
 
 
+int pool_init_mapped(pool_t *pool, buffersize_t reserve_size, buffersize_t commit_size, int flags, allocator_t *alloc)
+{
+#if USE_MMAP
+  buffersize_t granularity = (buffersize_t)sysconf(_SC_PAGESIZE);
+  size_t map_size;
+  char *mapping;
+  char *base;
+  int map_flags = MAP_PRIVATE | MAP_ANON;
+
+  if (pool == NULL) {
+    s_log_error("Attempt to initialize NULL memory pool.");
+    return -1;
+  } else if (pool->buffer) {
+    s_log_error("Attempt to initialize already-initialized memory pool (%p) with new", (const void *)pool);
+    return -1;
+  }
+
+  if (flags & POOL_MAP_HUGE_PAGES)
+    granularity = HUGE_PAGE_SIZE;
+
+  if (commit_size < MIN_POOL_SIZE)
+    commit_size = MIN_POOL_SIZE;
+  commit_size = (commit_size + granularity - 1) & ~(granularity - 1);
+  reserve_size = (reserve_size + granularity - 1) & ~(granularity - 1);
+  if (reserve_size < commit_size)
+    reserve_size = commit_size;
+
+  if ((uint64_t)reserve_size >= MAX_POOL_SIZE) {
+    s_log_error("Attempt to reserve pool larger than the maximum pool size.");
+    return -1;
+  }
+
+#ifdef MAP_NORESERVE
+  map_flags |= MAP_NORESERVE;
+#endif
+
+  /* over-reserve by a huge page so the base can be aligned for them */
+  map_size = reserve_size + ((flags & POOL_MAP_HUGE_PAGES) ? HUGE_PAGE_SIZE : 0);
+  mapping = (char *)mmap(NULL, map_size, PROT_NONE, map_flags, -1, 0);
+  if (mapping == MAP_FAILED) {
+    s_log_error("Failed to reserve %zu bytes of address space for memory pool.", reserve_size);
+    return -1;
+  }
+
+  base = mapping;
+  if (flags & POOL_MAP_HUGE_PAGES) {
+    base = (char *)(((uintptr_t)mapping + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (base != mapping)
+      munmap(mapping, base - mapping);
+    if (base + reserve_size != mapping + map_size)
+      munmap(base + reserve_size, (mapping + map_size) - (base + reserve_size));
+#ifdef MADV_HUGEPAGE
+    madvise(base, reserve_size, MADV_HUGEPAGE);
+#endif
+  }
+
+  if (mprotect(base, commit_size, PROT_READ | PROT_WRITE)) {
+    s_log_error("Failed to commit %zu bytes for memory pool.", commit_size);
+    munmap(base, reserve_size);
+    return -1;
+  }
+
+  if (pool_set_up(pool, base, commit_size, false, alloc)) {
+    s_log_error("Failed to set up memory pool.");
+    munmap(base, reserve_size);
+    return -1;
+  }
+
+  pool->mapped = true;
+  pool->reserved = reserve_size;
+  pool->min_committed = commit_size;
+  pool->commit_granularity = granularity;
+  pool->growth_factor = POOL_DEFAULT_GROWTH_FACTOR;
+
+  return 0;
+#else /* USE_MMAP */
+  (void)reserve_size;
+  (void)flags;
+  s_log_warning("Mapped pools are not supported, allocating pool instead.");
+  return pool_init(pool, commit_size, alloc);
+#endif /* !USE_MMAP */
+}
+
+
+void pool_set_growth_factor(pool_t *pool, float factor)
+{
+  if (pool == NULL)
+    pool = &g_main_pool;
+
+  mutex_lock(&pool->lock);
+  pool->growth_factor = factor;
+  mutex_unlock(&pool->lock);
+}
+
+
 void pool_destroy(pool_t *pool)
 {
   if (pool->head.used) {
+    pool_region_t *region;
+
+    pool_flush_thread_cache(pool);
+
     mutex_lock(&pool->lock);
 
+    pool_destroy_thread_caches(pool);
     pool_check_for_errors(pool);
 
+#if !NDEBUG
+    while (pool->samples)
+      pool_release_sample(pool, pool->samples);
+    pool->sample_rate = 0;
+#endif /* !NDEBUG */
+
+    region = pool->regions;
+    while (region) {
+      pool_region_t *next = region->next;
+      if (region != &pool->root)
+        com_free(pool->alloc, region);
+      region = next;
+    }
+
     if (pool->managed)
       com_free(pool->alloc, pool->buffer);
+#if USE_MMAP
+    else if (pool->mapped)
+      munmap(pool->buffer, pool->reserved);
+#endif
 
     pool->buffer = NULL;
-    pool->head.next = NULL;
-    pool->head.prev = NULL;
-    pool->next_unused = NULL;
+    pool->mapped = false;
+    pool->regions = NULL;
+    pool->size = 0;
     pool->alloc = NULL;
     pool->head.used = 0;
     pool->sequence = 0;
@@ -309,450 +623,1495 @@ static int pool_merge_blocks(block_head_t *blka, block_head_t *blkb)
 }
 
 
-#if NDEBUG
-void *pool_malloc(pool_t *pool, buffersize_t size, int32_t tag)
-#else
-void *pool_malloc_debug(pool_t *pool, buffersize_t size, int32_t tag, const char *file, const char *function, int32_t line)
-#endif
+#if USE_SEGREGATED_FIT
+
+/* index of the lowest set bit -- word must not be zero */
+static inline int pool_ffs(uint32_t word)
 {
-  block_head_t *block = NULL;
-  block_head_t *terminator = NULL;
-  buffersize_t block_size;
+  return __builtin_ctz(word);
+}
 
-  if (pool == NULL)
-    pool = &g_main_pool;
 
-  mutex_lock(&pool->lock);
+/* index of the highest set bit -- size must not be zero */
+static inline int pool_fls(buffersize_t size)
+{
+  return (int)(sizeof(unsigned long long) * 8) - 1 - __builtin_clzll((unsigned long long)size);
+}
 
-  if (tag == 0) {
-    s_log_error("Allocation failed - invalid tag %X", tag);
-    goto alloc_unlock_and_exit;
-  }
 
-  if ( ! pool->head.used) {
-    s_log_error("Allocation failed - pool is not initialized or corrupt");
-    goto alloc_unlock_and_exit;
+/* maps a block size to the free list that holds blocks of that size */
+static inline void pool_mapping_insert(buffersize_t size, int *fl_out, int *sl_out)
+{
+  int fl, sl;
+
+  if (size < SMALL_BLOCK_SIZE) {
+    fl = 0;
+    sl = (int)(size / (SMALL_BLOCK_SIZE / POOL_SL_INDEX_COUNT));
+  } else {
+    fl = pool_fls(size);
+    sl = (int)(size >> (fl - POOL_SL_INDEX_COUNT_LOG2)) ^ POOL_SL_INDEX_COUNT;
+    fl -= (POOL_FL_INDEX_SHIFT - 1);
   }
 
-  block_size = BLOCK_SIZE(size);
+  *fl_out = fl;
+  *sl_out = sl;
+}
 
-  if (block_size < MIN_BLOCK_SIZE) {
-    block_size = MIN_BLOCK_SIZE;
-    s_log_warning("Allocation of %zu is too small, allocating minimum size of %zu instead", size, MIN_ALLOC_SIZE);
-  }
 
-  if (block_size > pool->size) {
-    s_log_error("Allocation failed - requested size %zu exceeds pool capacity (%zu)", size, pool->size);
-    goto alloc_unlock_and_exit;
-  }
+/* maps a requested size to the first free list whose blocks are all large
+   enough to hold it */
+static inline void pool_mapping_search(buffersize_t size, int *fl_out, int *sl_out)
+{
+  if (size >= SMALL_BLOCK_SIZE)
+    size += ((buffersize_t)1 << (pool_fls(size) - POOL_SL_INDEX_COUNT_LOG2)) - 1;
 
+  pool_mapping_insert(size, fl_out, sl_out);
+}
 
-  block = pool->next_unused;
 
-  if ( ! block) {
-    s_log_error("Allocation failed - pool corrupted.");
-    return NULL;
-  }
+static inline void pool_insert_free_block(pool_region_t *region, block_head_t *block)
+{
+  int fl, sl;
+  block_head_t *current;
+  free_links_t *links = FREE_LINKS(block);
 
-  terminator = pool->next_unused->prev;
+  pool_mapping_insert(block->size, &fl, &sl);
+  current = region->free_blocks[fl][sl];
 
-  if ( ! terminator) {
-    s_log_error("Allocation failed - pool corrupted.");
-    return NULL;
-  }
+  links->prev = NULL;
+  links->next = current;
+  if (current)
+    FREE_LINKS(current)->prev = block;
 
-  for (; block != terminator; block = block->next) {
-    /* skip used blocks and blocks that're too small */
-    if (block->used)
-      continue;
-    else if (block->size < block_size)
-      continue;
+  region->free_blocks[fl][sl] = block;
+  region->fl_bitmap |= 1U << fl;
+  region->sl_bitmap[fl] |= 1U << sl;
+}
 
-    /* if the free block is large enough to be split into two blocks, do that */
-    if (pool_can_split_block(block, block_size))
-      if (pool_split_block(block, block_size))
-        s_log_error("Failed to split block, using unsplit block.");
 
-    if (pool->sequence == 0)
-      pool->sequence = 1; /* in case of overflow */
+static inline void pool_remove_free_block(pool_region_t *region, block_head_t *block)
+{
+  int fl, sl;
+  free_links_t *links = FREE_LINKS(block);
 
-    block->used = ++pool->sequence;
-    block->tag = tag;
+  pool_mapping_insert(block->size, &fl, &sl);
 
+  if (links->next)
+    FREE_LINKS(links->next)->prev = links->prev;
 
-#if USE_MEMORY_GUARD
-    ((guard_t *)((char *)block + block_size))[-1] = MEMORY_GUARD;
-#endif
+  if (links->prev) {
+    FREE_LINKS(links->prev)->next = links->next;
+  } else {
+    region->free_blocks[fl][sl] = links->next;
 
+    if (links->next == NULL) {
+      region->sl_bitmap[fl] &= ~(1U << sl);
+      if (region->sl_bitmap[fl] == 0)
+        region->fl_bitmap &= ~(1U << fl);
+    }
+  }
 
-#if !NDEBUG
-    /* store source file, function, line, and requested size in debugging struct */
+  links->prev = links->next = NULL;
+}
 
-    size_t file_length = strlen(file) + 1;
-    size_t fn_length = strlen(function) + 1; /* account for \0 in both cases */
-    /* to avoid pointless fragmentation, we'll allocate this using malloc normally */
-    char *file_copy = (char *)com_malloc(pool->alloc, (file_length + fn_length) * sizeof(char));
-    strncpy(file_copy, file, file_length + 1);
-    block->debug_info.source_file = file_copy;
 
-    /* copy function as well */
-    char *fn_copy = file_copy + file_length;
-    strncpy(fn_copy, function, fn_length);
-    block->debug_info.function = fn_copy;
+static block_head_t *pool_find_free_block(pool_region_t *region, buffersize_t block_size)
+{
+  int fl, sl;
+  uint32_t fl_map, sl_map;
 
-    block->debug_info.line = line;
-    block->debug_info.requested_size = size;
-#endif /* !NDEBUG */
+  pool_mapping_search(block_size, &fl, &sl);
 
-    pool->next_unused = block->next;
+  if (fl >= POOL_FL_INDEX_COUNT)
+    return NULL;
 
-    mutex_unlock(&pool->lock);
+  sl_map = region->sl_bitmap[fl] & (~0U << sl);
+  if (sl_map == 0) {
+    /* nothing left in this first-level list, go to the next non-empty one */
+    fl_map = region->fl_bitmap & (~0U << (fl + 1));
+    if (fl_map == 0)
+      return NULL;
 
-    return block + 1;
+    fl = pool_ffs(fl_map);
+    sl_map = region->sl_bitmap[fl];
   }
 
-  /* out of memory */
-  s_log_error("Failed to allocate %zu bytes - pool is out of memory", size);
-
-alloc_unlock_and_exit:
-  mutex_unlock(&pool->lock);
+  sl = pool_ffs(sl_map);
 
-  return NULL;
+  return region->free_blocks[fl][sl];
 }
 
+static buffersize_t pool_region_largest_free(const pool_region_t *region)
+{
+  int fl, sl;
+  const block_head_t *block;
+  buffersize_t largest = 0;
 
-/*
-  pool_realloc tries to make reallocation as cheap as possible by expanding its
-  block to fit the new size. This is done by splitting previous/next blocks in
-  the pool and merging those blocks.
+  if (region->fl_bitmap == 0)
+    return 0;
 
-  The best case scenario is that the new block is smaller. In that case, the
-  block may not be resized at all.  It will be split if it can, but it's not
-  an error if the block isn't resized at all.
+  /* the largest block is somewhere in the highest non-empty list */
+  fl = pool_fls(region->fl_bitmap);
+  sl = pool_fls(region->sl_bitmap[fl]);
 
-  Second best case is that the next block in the pool can be split and merged
-  with the original block. If it can't be split, it's not used, period.
+  for (block = region->free_blocks[fl][sl]; block; block = FREE_LINKS(block)->next) {
+    if (block->size > largest)
+      largest = block->size;
+  }
 
-  Third best case is that the previous block can be split and merged, with the
-  original block memmove'd into place.
+  return largest;
+}
 
-  Worst case is a new block is allocated, the contents memcpy'd to the new
-  block, and then the old block is released.
+#else /* USE_SEGREGATED_FIT */
 
-  In the event of an error, NULL is returned and a log message is written
-  describing what went wrong.
-*/
-void *pool_realloc(void *p, buffersize_t size)
+static inline void pool_insert_free_block(pool_region_t *region, block_head_t *block)
 {
-  block_head_t *block;
-  pool_t *pool;
-  size_t new_size;
-  off_t size_diff;
+  (void)region;
+  (void)block;
+}
 
-  if ( ! p) {
-    s_log_error("Realloc on NULL");
-    return NULL;
-  }
 
-  block = (block_head_t *)p - 1;
-  pool = block->pool;
+static inline void pool_remove_free_block(pool_region_t *region, block_head_t *block)
+{
+  (void)region;
+  (void)block;
+}
 
-  if ( ! pool) {
-    s_log_error("Attempt to reallocate block without an associated pool");
-    return NULL;
-  }
 
-  mutex_lock(&pool->lock);
+static block_head_t *pool_find_free_block(pool_region_t *region, buffersize_t block_size)
+{
+  block_head_t *block = region->head.next;
 
-  if (block == &block->pool->head) {
-    s_log_error("Realloc on header block of pool");
-    p = NULL;
-    goto pool_realloc_exit;
+  for (; block != &region->head; block = block->next) {
+    /* skip used blocks and blocks that're too small */
+    if ( ! block->used && block->size >= block_size)
+      return block;
   }
 
-  new_size = BLOCK_SIZE(size);
+  return NULL;
+}
 
-  if (new_size < MIN_BLOCK_SIZE)
-    new_size = MIN_BLOCK_SIZE; /* new size cannot go below the minimum
-                                    block size */
 
-  size_diff = (off_t)new_size - (off_t)block->size;
+static buffersize_t pool_region_largest_free(const pool_region_t *region)
+{
+  const block_head_t *block = region->head.next;
+  buffersize_t largest = 0;
 
-  if (size_diff == 0)
-    return p; /* not resized at all */
-  if (size_diff < 0 && abs(size_diff) < MIN_BLOCK_SIZE)
-    return p; /* the size difference is small enough that resizing is
-                 pointless, so we won't bother doing it */
+  for (; block != &region->head; block = block->next) {
+    if ( ! block->used && block->size > largest)
+      largest = block->size;
+  }
 
-  if (size_diff < 0) {
-    /* new block is smaller, see if we can split it */
-    if (pool_can_split_block(block, new_size)) {
-      /* if we can split it, do so */
-      if (pool_split_block(block, new_size) == 0) {
-        p = block + 1;
+  return largest;
+}
 
-        if ( ! block->next->next->used) {
-          pool_merge_blocks(block->next, block->next->next);
-        }
+#endif /* !USE_SEGREGATED_FIT */
 
-        pool->next_unused = block->next;
-      } else {
-        s_log_warning("Failed to split block, using unsplit block.");
+
+/* gets the statistics entry for a tag, claiming an unused one if needed */
+static pool_tag_stats_t *pool_tag_stats(pool_t *pool, int32_t tag)
+{
+  pool_tag_stats_t *entries = pool->stats.tags;
+  size_t index = (((uint32_t)tag * 2654435761U) >> 16) % POOL_STATS_TAG_COUNT;
+  size_t probe;
+
+  for (probe = 0; probe < POOL_STATS_TAG_COUNT; ++probe) {
+    pool_tag_stats_t *entry = &entries[index];
+
+    if (entry->tag == tag)
+      return entry;
+
+    if (entry->tag == 0) {
+      entry->tag = tag;
+      return entry;
+    }
+
+    index = (index + 1) % POOL_STATS_TAG_COUNT;
+  }
+
+  /* entries are never released, so a tag that lands here always will */
+  return &pool->stats.untracked;
+}
+
+
+static inline void pool_stats_add(pool_t *pool, int32_t tag, buffersize_t size)
+{
+  pool_tag_stats_t *entry = pool_tag_stats(pool, tag);
+
+  entry->blocks += 1;
+  entry->bytes += size;
+
+  pool->stats.used_blocks += 1;
+  pool->stats.used_bytes += size;
+  pool->stats.allocations += 1;
+
+  if (pool->stats.used_bytes > pool->stats.peak_used_bytes)
+    pool->stats.peak_used_bytes = pool->stats.used_bytes;
+}
+
+
+static inline void pool_stats_remove(pool_t *pool, int32_t tag, buffersize_t size)
+{
+  pool_tag_stats_t *entry = pool_tag_stats(pool, tag);
+
+  entry->blocks -= 1;
+  entry->bytes -= size;
+
+  pool->stats.used_blocks -= 1;
+  pool->stats.used_bytes -= size;
+}
+
+
+static inline void pool_stats_resize(pool_t *pool, int32_t tag, buffersize_t old_size, buffersize_t new_size)
+{
+  pool_tag_stats_t *entry = pool_tag_stats(pool, tag);
+
+  /* unsigned wraparound cancels out when shrinking */
+  entry->bytes += new_size - old_size;
+  pool->stats.used_bytes += new_size - old_size;
+
+  if (pool->stats.used_bytes > pool->stats.peak_used_bytes)
+    pool->stats.peak_used_bytes = pool->stats.used_bytes;
+}
+
+
+void pool_stats(pool_t *pool, pool_stats_t *stats)
+{
+  const pool_region_t *region;
+  buffersize_t largest = 0;
+  s_time_t now;
+
+  if (pool == NULL)
+    pool = &g_main_pool;
+
+  mutex_lock(&pool->lock);
+
+  if ( ! pool->head.used) {
+    s_log_error("Attempt to get statistics for uninitialized pool (%p)", (const void *)pool);
+    memset(stats, 0, sizeof(*stats));
+    mutex_unlock(&pool->lock);
+    return;
+  }
+
+  *stats = pool->stats;
+  stats->size = pool->size;
+  stats->free_bytes = pool->size - pool->stats.used_bytes;
+
+  for (region = pool->regions; region; region = region->next) {
+    buffersize_t region_largest = pool_region_largest_free(region);
+    if (region_largest > largest)
+      largest = region_largest;
+  }
+
+  stats->largest_free_block = largest;
+  stats->fragmentation = stats->free_bytes
+                         ? 1.0f - (float)((double)largest / (double)stats->free_bytes)
+                         : 0.0f;
+
+  now = current_time();
+  if (now > pool->stats_time)
+    stats->allocation_rate = (double)(pool->stats.allocations - pool->stats_allocations) / (now - pool->stats_time);
+  else
+    stats->allocation_rate = 0;
+
+  pool->stats_time = now;
+  pool->stats_allocations = pool->stats.allocations;
+
+  mutex_unlock(&pool->lock);
+}
+
+
+static pool_region_t *pool_region_for_block(pool_t *pool, const block_head_t *block)
+{
+  pool_region_t *region = pool->regions;
+
+  for (; region; region = region->next) {
+    if ((const char *)block >= region->buffer && (const char *)block < region->buffer + region->size)
+      return region;
+  }
+
+  return NULL;
+}
+
+
+static pool_region_t *pool_grow(pool_t *pool, buffersize_t block_size)
+{
+  uint64_t region_size;
+  const uint64_t min_region_size = (uint64_t)block_size + sizeof(pool_region_t) + BLOCK_ALIGNMENT;
+  pool_region_t *region;
+  pool_region_t **slot;
+
+  if ( ! (pool->growth_factor > 1.0f))
+    return NULL;
+
+#if USE_MMAP
+  if (pool->mapped)
+    return pool_grow_mapped(pool, block_size);
+#endif
+
+  /* grow the pool's total size by the growth factor */
+  region_size = (uint64_t)((double)pool->size * (pool->growth_factor - 1.0f));
+  if (region_size < min_region_size)
+    region_size = min_region_size;
+  if (region_size >= MAX_POOL_SIZE)
+    region_size = MAX_POOL_SIZE - BLOCK_ALIGNMENT;
+  if (region_size < min_region_size || region_size > SIZE_MAX) {
+    s_log_error("Cannot grow pool to fit block of %zu bytes", block_size);
+    return NULL;
+  }
+
+  /* the region's header sits at the start of its memory */
+  region = (pool_region_t *)com_malloc_uninit(pool->alloc, (size_t)region_size);
+  if (region == NULL) {
+    s_log_error("Failed to allocate %zu bytes to grow pool", (size_t)region_size);
+    return NULL;
+  }
+
+  pool_region_set_up(pool, region, (char *)(region + 1), (buffersize_t)region_size - sizeof(*region));
+
+  /* keep regions in address order */
+  slot = &pool->regions;
+  while (*slot && (*slot)->buffer < region->buffer)
+    slot = &(*slot)->next;
+  region->next = *slot;
+  *slot = region;
+
+  pool->size += region->size;
+
+  return region;
+}
+
+
+#if USE_MMAP
+
+static pool_region_t *pool_grow_mapped(pool_t *pool, buffersize_t block_size)
+{
+  pool_region_t *region = &pool->root;
+  block_head_t *last = region->head.prev;
+  char *end = region->buffer + region->size;
+  const uint64_t granularity = pool->commit_granularity;
+  const uint64_t committed = (uint64_t)(end - pool->buffer);
+  const uint64_t needed = committed + block_size + MIN_BLOCK_SIZE;
+  uint64_t wanted;
+  buffersize_t delta;
+
+  wanted = (uint64_t)((double)committed * pool->growth_factor);
+  if (wanted < needed)
+    wanted = needed;
+  wanted = (wanted + granularity - 1) & ~(granularity - 1);
+  if (wanted > pool->reserved)
+    wanted = pool->reserved;
+
+  if (wanted < needed) {
+    s_log_error("Cannot grow mapped pool to fit block of %zu bytes - reservation exhausted", block_size);
+    return NULL;
+  }
+
+  delta = (buffersize_t)(wanted - committed);
+  if (mprotect(end, delta, PROT_READ | PROT_WRITE)) {
+    s_log_error("Failed to commit %zu bytes for mapped pool", delta);
+    return NULL;
+  }
+
+  if ( ! last->used) {
+    /* extend the free block at the end of the region */
+    pool_remove_free_block(region, last);
+    last->size += delta;
+  } else {
+    block_head_t *block = (block_head_t *)end;
+
+    block->size = delta;
+    block->used = 0;
+    block->tag = 0;
+    block->pool = pool;
+    block->prev = last;
+    block->next = &region->head;
+    last->next = block;
+    region->head.prev = block;
+
+    last = block;
+  }
+
+  pool_insert_free_block(region, last);
+  region->size += delta;
+  pool->size += delta;
+
+  return region;
+}
+
+
+static void pool_decommit_tail(pool_t *pool, block_head_t *block)
+{
+  pool_region_t *region = &pool->root;
+  const uintptr_t granularity = pool->commit_granularity;
+  char *end = region->buffer + region->size;
+  char *keep = (char *)block + MIN_BLOCK_SIZE + POOL_DECOMMIT_SLACK;
+  buffersize_t delta;
+
+  if (keep < pool->buffer + pool->min_committed)
+    keep = pool->buffer + pool->min_committed;
+  keep = (char *)(((uintptr_t)keep + granularity - 1) & ~(granularity - 1));
+
+  if (keep >= end)
+    return;
+
+  delta = (buffersize_t)(end - keep);
+
+#ifdef MADV_DONTNEED
+  madvise(keep, delta, MADV_DONTNEED);
+#endif
+  if (mprotect(keep, delta, PROT_NONE)) {
+    s_log_error("Failed to decommit %zu bytes of mapped pool", delta);
+    return;
+  }
+
+  block->size -= delta;
+  region->size -= delta;
+  pool->size -= delta;
+}
+
+#endif /* USE_MMAP */
+
+
+static void pool_release_region(pool_t *pool, pool_region_t *region)
+{
+  pool_region_t **slot = &pool->regions;
+
+  while (*slot && *slot != region)
+    slot = &(*slot)->next;
+
+  if (*slot == NULL) {
+    s_log_error("Attempt to release region not in pool");
+    return;
+  }
+
+  *slot = region->next;
+  pool->size -= region->size;
+
+  com_free(pool->alloc, region);
+}
+
+
+#if NDEBUG
+void *pool_malloc(pool_t *pool, buffersize_t size, int32_t tag)
+#else
+void *pool_malloc_debug(pool_t *pool, buffersize_t size, int32_t tag, const char *file, const char *function, int32_t line)
+#endif
+{
+  block_head_t *block = NULL;
+  pool_region_t *region;
+  buffersize_t block_size;
+
+  if (pool == NULL)
+    pool = &g_main_pool;
+
+  mutex_lock(&pool->lock);
+
+  if (tag == 0) {
+    s_log_error("Allocation failed - invalid tag %X", tag);
+    goto alloc_unlock_and_exit;
+  }
+
+  if ( ! pool->head.used) {
+    s_log_error("Allocation failed - pool is not initialized or corrupt");
+    goto alloc_unlock_and_exit;
+  }
+
+  block_size = BLOCK_SIZE(size);
+
+  if (block_size < MIN_BLOCK_SIZE) {
+    block_size = MIN_BLOCK_SIZE;
+    s_log_warning("Allocation of %zu is too small, allocating minimum size of %zu instead", size, MIN_ALLOC_SIZE);
+  }
+
+  if ( ! (pool->growth_factor > 1.0f) && block_size > pool->size) {
+    s_log_error("Allocation failed - requested size %zu exceeds pool capacity (%zu)", size, pool->size);
+    goto alloc_unlock_and_exit;
+  }
+
+
+  /* prefer lower regions so higher ones can drain and be released */
+  for (region = pool->regions; region; region = region->next) {
+    block = pool_find_free_block(region, block_size);
+    if (block)
+      break;
+  }
+
+  /* a grown region ends in an unused block large enough for the allocation --
+     taken directly, since the free lists only promise a fit for sizes
+     rounded up to their size class */
+  if (block == NULL && (region = pool_grow(pool, block_size)))
+    block = region->head.prev;
+
+  if (block) {
+    pool_remove_free_block(region, block);
+
+    /* if the free block is large enough to be split into two blocks, do that */
+    if (pool_can_split_block(block, block_size)) {
+      if (pool_split_block(block, block_size))
+        s_log_error("Failed to split block, using unsplit block.");
+      else
+        pool_insert_free_block(region, block->next);
+    }
+
+    if (pool->sequence == 0)
+      pool->sequence = 1; /* in case of overflow */
+
+    block->used = ++pool->sequence;
+    block->tag = tag;
+
+    pool_stats_add(pool, tag, block->size);
+
+
+#if USE_MEMORY_GUARD
+    ((guard_t *)((char *)block + block->size))[-1] = MEMORY_GUARD;
+#endif
+
+
+#if !NDEBUG
+    /* store allocation site and requested size in debugging struct */
+    block->debug_info.site = pool_intern_site(file, function, line);
+    block->debug_info.requested_size = size;
+    block->debug_info.sample = NULL;
+
+    if (pool->sample_rate)
+      pool_sample_block(pool, block, size);
+#endif /* !NDEBUG */
+
+    mutex_unlock(&pool->lock);
+
+    return block + 1;
+  }
+
+  /* out of memory */
+  s_log_error("Failed to allocate %zu bytes - pool is out of memory", size);
+
+alloc_unlock_and_exit:
+  mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+/*
+  pool_realloc tries to make reallocation as cheap as possible by expanding its
+  block to fit the new size. This is done by splitting previous/next blocks in
+  the pool and merging those blocks.
+
+  The best case scenario is that the new block is smaller. In that case, the
+  block may not be resized at all.  It will be split if it can, but it's not
+  an error if the block isn't resized at all.
+
+  Second best case is that the next block in the pool can be split and merged
+  with the original block. If it can't be split, it's not used, period.
+
+  Third best case is that the previous block can be split and merged, with the
+  original block memmove'd into place.
+
+  Worst case is a new block is allocated, the contents memcpy'd to the new
+  block, and then the old block is released.
+
+  In the event of an error, NULL is returned and a log message is written
+  describing what went wrong.
+*/
+void *pool_realloc(void *p, buffersize_t size)
+{
+  block_head_t *block;
+  pool_t *pool;
+  pool_region_t *region;
+  buffersize_t old_size;
+  size_t new_size;
+  off_t size_diff;
+
+  if ( ! p) {
+    s_log_error("Realloc on NULL");
+    return NULL;
+  }
+
+  block = (block_head_t *)p - 1;
+  pool = block->pool;
+
+  if ( ! pool) {
+    s_log_error("Attempt to reallocate block without an associated pool");
+    return NULL;
+  }
+
+  mutex_lock(&pool->lock);
+
+  if (block == &block->pool->head) {
+    s_log_error("Realloc on header block of pool");
+    p = NULL;
+    goto pool_realloc_exit;
+  }
+
+  region = pool_region_for_block(pool, block);
+  if (region == NULL) {
+    s_log_error("Attempt to reallocate block outside of its pool's regions");
+    p = NULL;
+    goto pool_realloc_exit;
+  }
+
+  old_size = block->size;
+  new_size = BLOCK_SIZE(size);
+
+  if (new_size < MIN_BLOCK_SIZE)
+    new_size = MIN_BLOCK_SIZE; /* new size cannot go below the minimum
+                                    block size */
+
+  size_diff = (off_t)new_size - (off_t)block->size;
+
+  if (size_diff == 0)
+    goto pool_realloc_exit; /* not resized at all */
+  if (size_diff < 0 && -size_diff < (off_t)MIN_BLOCK_SIZE)
+    goto pool_realloc_exit; /* the size difference is small enough that
+                               resizing is pointless, so we won't bother
+                               doing it */
+
+  if (size_diff < 0) {
+    /* new block is smaller, see if we can split it */
+    if (pool_can_split_block(block, new_size)) {
+      /* if we can split it, do so */
+      if (pool_split_block(block, new_size) == 0) {
+        block_head_t *unused = block->next;
+        p = block + 1;
+
+        pool_stats_resize(pool, block->tag, old_size, block->size);
+
+        if ( ! unused->next->used) {
+          pool_remove_free_block(region, unused->next);
+          pool_merge_blocks(unused, unused->next);
+        }
+
+        pool_insert_free_block(region, unused);
+
+#if USE_MEMORY_GUARD
+        ((guard_t *)((char *)block + block->size))[-1] = MEMORY_GUARD;
+#endif /* USE_MEMORY_GUARD */
+      } else {
+        s_log_warning("Failed to split block, using unsplit block.");
+      }
+    } else {
+      s_log_warning("New block size is too small to resize, leaving as-is.");
+    }
+
+    /* if the block can't be split, leave it as is -- the size difference is
+       small enough that resizing is probably pointless. */
+
+  } else if ( ! block->next->used && block->next->size >= (buffersize_t)size_diff + MIN_BLOCK_SIZE) {
+    /* if the next block is unused, try to join it with that.
+       not using pool_split_block because the new block is the only one that
+       has to be valid -- in a sense, it's more like moving a block. */
+    block_head_t copy = *block->next;
+    block_head_t *split = (block_head_t *)((char *)block->next + size_diff);
+
+    pool_remove_free_block(region, block->next);
+
+    /* copy old to new */
+    *split = copy;
+    split->size -= (buffersize_t)size_diff;
+
+    /* reset pointers */
+    split->next->prev = split;
+    split->prev->next = split;
+
+    pool_insert_free_block(region, split);
+
+#if USE_MEMORY_GUARD
+    /* put memory guard in place (if in use) */
+    ((guard_t *)((char *)block + new_size))[-1] = MEMORY_GUARD;
+#endif /* USE_MEMORY_GUARD */
+
+    /* done */
+    block->size = new_size;
+    pool_stats_resize(pool, block->tag, old_size, new_size);
+  } else if ( ! block->prev->used && block->prev->size >= (buffersize_t)size_diff + MIN_BLOCK_SIZE) {
+    /* if the last block is unused, try to join it with that */
+    block_head_t *prev = block->prev;
+    block_head_t *split;
+
+    pool_remove_free_block(region, prev);
+
+    prev->size -= (buffersize_t)size_diff;
+    split = (block_head_t *)((char *)prev + prev->size);
+
+    /* copy old to new */
+    memmove(split, block, block->size);
+
+    /* reset pointers */
+    split->next->prev = split;
+    split->prev->next = split;
+    split->size = new_size;
+    pool_stats_resize(pool, split->tag, old_size, new_size);
+
+    pool_insert_free_block(region, prev);
+
+#if USE_MEMORY_GUARD
+    ((guard_t *)((char *)split + new_size))[-1] = MEMORY_GUARD;
+#endif /* USE_MEMORY_GUARD */
+
+    p = split + 1;
+  } else {
+    /* last resort: allocate a new block, copy, free the old block */
+    void *new_p = pool_malloc(block->pool, size, block->tag);
+
+    if (new_p) {
+#if !NDEBUG
+      /* keep the original allocation site rather than pool_realloc's */
+      block_head_t *moved = (block_head_t *)new_p - 1;
+      moved->debug_info.site = block->debug_info.site;
+      if (moved->debug_info.sample)
+        moved->debug_info.sample->site = block->debug_info.site;
+#endif /* !NDEBUG */
+      memcpy(new_p, p, block->size - sizeof(block_head_t) - MEMORY_GUARD_SIZE);
+      pool_free(p);
+    } else {
+      s_log_error("Failed to allocate new memory block for realloc");
+    }
+
+    p = new_p;
+  }
+
+  pool_realloc_exit:
+#if !NDEBUG
+  if (p) {
+    block_head_t *resized = (block_head_t *)p - 1;
+    resized->debug_info.requested_size = size;
+    if (resized->debug_info.sample)
+      resized->debug_info.sample->size = size;
+  }
+#endif /* !NDEBUG */
+  mutex_unlock(&pool->lock);
+  return p;
+}
+
+
+void pool_free(void *buffer)
+{
+  if ( ! buffer) {
+    s_log_error("Free on NULL");
+    return;
+  }
+
+  block_head_t *block = (block_head_t *)buffer - 1;
+  pool_t *pool = block->pool;
+  pool_region_t *region;
+
+  /*s_log_note("freeing block:");*/
+  /*dbg_print_block(block);*/
+
+  if ( ! pool) {
+    s_log_error("Attempt to free block without an associated pool");
+    return;
+  }
+
+  mutex_lock(&pool->lock);
+
+  if (block == &block->pool->head) {
+    s_log_error("Free on header block of pool");
+    goto free_unlock_and_exit;
+  }
+
+  if (block->size < MIN_BLOCK_SIZE) {
+    s_log_error("Invalid block, too small (%zu) - may be corrupted", block->size);
+    goto free_unlock_and_exit;
+  }
+
+#if USE_MEMORY_GUARD
+  guard_t guard = ((guard_t *)((char *)block + block->size))[-1];
+  if (guard != MEMORY_GUARD) {
+    s_log_error("Block memory guard corrupted - reads %X", guard);
+  }
+#endif
+
+  if ( ! block->used) {
+    s_log_error("Double-free on block");
+    goto free_unlock_and_exit;
+  }
+
+  region = pool_region_for_block(pool, block);
+  if (region == NULL) {
+    s_log_error("Attempt to free block outside of its pool's regions");
+    goto free_unlock_and_exit;
+  }
+
+#if !NDEBUG
+
+  /* clear debug info */
+  if (block->debug_info.sample)
+    pool_release_sample(pool, block->debug_info.sample);
+  block->debug_info.site = 0;
+  block->debug_info.requested_size = 0;
+  block->debug_info.sample = NULL;
+
+#endif /* !NDEBUG */
+
+  pool_stats_remove(pool, block->tag, block->size);
+
+  /*block->tag = DEFAULT_BLOCK_TAG_UNUSED;*/
+  block->used = 0;
+  block->tag = 0;
+
+  /* coalesce with unused neighbors right away */
+  if ( ! block->next->used) {
+    pool_remove_free_block(region, block->next);
+    pool_merge_blocks(block, block->next);
+  }
+
+  if ( ! block->prev->used) {
+    block = block->prev;
+    pool_remove_free_block(region, block);
+    pool_merge_blocks(block, block->next);
+  }
+
+#if USE_MMAP
+  if (pool->mapped && block->next == &region->head)
+    pool_decommit_tail(pool, block);
+#endif
+
+  if (region != &pool->root && block->size == region->size)
+    pool_release_region(pool, region); /* region is empty */
+  else
+    pool_insert_free_block(region, block);
+
+free_unlock_and_exit:
+  mutex_unlock(&pool->lock);
+}
+
+
+static inline void dbg_print_block(const block_head_t *block)
+{
+  /* the odd exception where s_log_* is not used... */
+  fprintf(stderr, "BLOCK [header: %p | buffer: %p] {\n", (void *)block, (void *)(block+1));
+#if USE_MEMORY_GUARD
+  fprintf(stderr, "  guard: %X\n", ((const guard_t *)((const char *)block+block->size))[-1]);
+#endif /* USE_MEMORY_GUARD */
+  fprintf(stderr, "  block size: %zu bytes\n", block->size);
+  fprintf(stderr, "  prev: %p\n", block->prev);
+  fprintf(stderr, "  next: %p\n", block->next);
+  fprintf(stderr, "  used: %d\n", block->used);
+  fprintf(stderr, "  tag: %X\n", block->tag);
+#if !NDEBUG
+  const pool_site_t *site = pool_site_for_id(block->debug_info.site);
+  if (site) {
+    fprintf(stderr, "  source file: %s [%d]\n", site->file, site->line);
+    fprintf(stderr, "  source function: %s\n", site->function);
+  }
+  fprintf(stderr, "  buffer size: %zu bytes\n", block->debug_info.requested_size);
+#endif /* !NDEBUG */
+  fprintf(stderr, "  pool: %p\n}\n", block->pool);
+}
+
+
+static void pool_check_for_errors(const pool_t *pool)
+{
+  if (pool == NULL) {
+    s_fatal_error(1, "Attempt to check NULL pool.");
+    return;
+  }
+
+  if (pool->alloc == NULL) {
+    s_fatal_error(1, "Pool allocator is NULL.");
+    return;
+  }
+
+  const pool_region_t *region = pool->regions;
+  for (; region; region = region->next) {
+    const block_head_t *block = region->head.next;
+    for (; block != &region->head; block = block->next) {
+      if (block) {
+        pool_check_block_for_errors(block, block->used);
+      } else {
+        s_fatal_error(1, "Memory pool links are corrupted.");
+        return;
+      }
+    }
+  }
+}
+
+
+static void pool_check_block_for_errors(const block_head_t *block, int debug_block)
+{
+  if (block->pool && block == &block->pool->head) {
+    s_log_error("Cannot check pool header block");
+    return;
+  }
+
+  int spew_block = debug_block;
+
+  if (block->size < MIN_BLOCK_SIZE) {
+    s_log_error("Block smaller than minimum required size (%zu) - may be corrupt", MIN_BLOCK_SIZE);
+  }
+
+  if (block->next == NULL || block->prev == NULL) {
+    s_log_error("Block detached from block list");
+  }
+
+#if USE_MEMORY_GUARD
+  if (block->used) {
+    guard_t guard = ((const guard_t *)((const char *)block + block->size))[-1];
+    if (guard != MEMORY_GUARD) {
+      s_log_error("Memory guard corrupted");
+    }
+  }
+#endif
+
+  if ( ! block->pool) {
+    s_log_error("Block detached from memory pool");
+  }
+
+  if (spew_block) {
+    dbg_print_block(block);
+  }
+}
+
+
+const block_head_t *pool_block_for_pointer(const void *buffer)
+{
+  const block_head_t *block = (const block_head_t *)buffer - 1;
+
+#if USE_MEMORY_GUARD
+  guard_t guard = ((guard_t *)((const char *)buffer + block->size))[-1];
+  if (guard != MEMORY_GUARD) {
+    s_log_error("Memory guard corrupted");
+    dbg_print_block(block);
+    return NULL;
+  }
+#endif
+
+  return block;
+}
+
+#if !NDEBUG
+
+///////////////////////////////////////////////////////////////////////////////
+////                          Allocation Profiling                         ////
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct s_pool_site_totals pool_site_totals_t;
+
+/*!
+ * Live allocation totals for a site, used by pool_dump_profile.
+ */
+struct s_pool_site_totals
+{
+  uint32_t site;
+  size_t blocks;
+  buffersize_t bytes;
+  size_t samples;
+  buffersize_t sampled_bytes;
+  const pool_sample_t *sample;
+};
+
+
+/* looks for a site, or the empty slot it would go in -- returns its index,
+   or POOL_SITE_COUNT if the table is full */
+static uint32_t pool_probe_site(const char *file, const char *function, int32_t line)
+{
+  const uint32_t mask = POOL_SITE_COUNT - 1;
+  uint32_t index = ((uint32_t)((uintptr_t)file >> 3) * 2654435761U) ^ ((uint32_t)line * 40503U);
+  uint32_t probe;
+
+  index &= mask;
+  for (probe = 0; probe < POOL_SITE_COUNT; ++probe) {
+    const pool_site_t *site = &g_pool_sites[index];
+    /* pairs with the release store in pool_intern_site */
+    const char *site_file = __atomic_load_n(&site->file, __ATOMIC_ACQUIRE);
+
+    if (site_file == NULL)
+      return index;
+
+    if (site_file == file && site->line == line && site->function == function)
+      return index;
+
+    index = (index + 1) & mask;
+  }
+
+  return POOL_SITE_COUNT;
+}
+
+
+static uint32_t pool_intern_site(const char *file, const char *function, int32_t line)
+{
+  uint32_t index = pool_probe_site(file, function, line);
+
+  if (index < POOL_SITE_COUNT && __atomic_load_n(&g_pool_sites[index].file, __ATOMIC_ACQUIRE) == NULL) {
+    while (__sync_lock_test_and_set(&g_pool_sites_lock, 1))
+      ;
+
+    /* look again in case another thread added it first */
+    index = pool_probe_site(file, function, line);
+    if (index < POOL_SITE_COUNT && g_pool_sites[index].file == NULL) {
+      g_pool_sites[index].function = function;
+      g_pool_sites[index].line = line;
+      /* publishes the slot -- function and line must be visible first */
+      __atomic_store_n(&g_pool_sites[index].file, file, __ATOMIC_RELEASE);
+    }
+
+    __sync_lock_release(&g_pool_sites_lock);
+  }
+
+  return index < POOL_SITE_COUNT ? index + 1 : 0;
+}
+
+
+const pool_site_t *pool_site_for_id(uint32_t site)
+{
+  if (site == 0 || site > POOL_SITE_COUNT ||
+      __atomic_load_n(&g_pool_sites[site - 1].file, __ATOMIC_ACQUIRE) == NULL)
+    return NULL;
+
+  return &g_pool_sites[site - 1];
+}
+
+
+void pool_set_sample_rate(pool_t *pool, size_t bytes)
+{
+  if (pool == NULL)
+    pool = &g_main_pool;
+
+  mutex_lock(&pool->lock);
+  pool->sample_rate = bytes;
+  pool->sample_countdown = bytes;
+  mutex_unlock(&pool->lock);
+}
+
+
+static void pool_sample_block(pool_t *pool, block_head_t *block, buffersize_t size)
+{
+  pool_sample_t *sample;
+
+  if (size < pool->sample_countdown) {
+    pool->sample_countdown -= size;
+    return;
+  }
+
+  /* the sampled byte falls inside this block -- count from the end of it to
+     the next one */
+  pool->sample_countdown = pool->sample_rate - (size - pool->sample_countdown) % pool->sample_rate;
+
+  sample = (pool_sample_t *)com_malloc(pool->alloc, sizeof(*sample));
+  if (sample == NULL)
+    return;
+
+  sample->site = block->debug_info.site;
+  sample->size = size;
+#if USE_BACKTRACE
+  sample->depth = backtrace(sample->frames, POOL_SAMPLE_DEPTH);
+#else
+  sample->depth = 0;
+#endif
+
+  sample->prev = NULL;
+  sample->next = pool->samples;
+  if (pool->samples)
+    pool->samples->prev = sample;
+  pool->samples = sample;
+
+  block->debug_info.sample = sample;
+}
+
+
+static void pool_release_sample(pool_t *pool, pool_sample_t *sample)
+{
+  if (sample->next)
+    sample->next->prev = sample->prev;
+
+  if (sample->prev)
+    sample->prev->next = sample->next;
+  else
+    pool->samples = sample->next;
+
+  com_free(pool->alloc, sample);
+}
+
+
+static int pool_compare_site_totals(const void *left, const void *right)
+{
+  const pool_site_totals_t *lhs = (const pool_site_totals_t *)left;
+  const pool_site_totals_t *rhs = (const pool_site_totals_t *)right;
+
+  if (lhs->bytes != rhs->bytes)
+    return lhs->bytes < rhs->bytes ? 1 : -1;
+
+  return (lhs->site > rhs->site) - (lhs->site < rhs->site);
+}
+
+
+void pool_dump_profile(pool_t *pool, FILE *out)
+{
+  pool_site_totals_t *totals;
+  const pool_region_t *region;
+  const pool_sample_t *sample;
+  uint32_t site_index;
+  size_t live_sites = 0;
+  size_t index;
+
+  if (pool == NULL)
+    pool = &g_main_pool;
+
+  if (out == NULL)
+    out = stderr;
+
+  /* slot 0 collects blocks from unknown sites -- allocated before taking the
+     lock since pool->alloc may itself be backed by this pool */
+  totals = (pool_site_totals_t *)com_malloc(pool->alloc, (POOL_SITE_COUNT + 1) * sizeof(*totals));
+  if (totals == NULL) {
+    s_log_error("Failed to allocate site totals for profile");
+    return;
+  }
+
+  mutex_lock(&pool->lock);
+
+  if ( ! pool->head.used) {
+    s_log_error("Attempt to dump profile for uninitialized pool (%p)", (const void *)pool);
+    goto dump_unlock_and_exit;
+  }
+
+  memset(totals, 0, (POOL_SITE_COUNT + 1) * sizeof(*totals));
+  for (site_index = 0; site_index <= POOL_SITE_COUNT; ++site_index)
+    totals[site_index].site = site_index;
+
+  for (region = pool->regions; region; region = region->next) {
+    const block_head_t *block = region->head.next;
+    for (; block != &region->head; block = block->next) {
+      if (block->used) {
+        totals[block->debug_info.site].blocks += 1;
+        totals[block->debug_info.site].bytes += block->debug_info.requested_size;
       }
-    } else {
-      s_log_warning("New block size is too small to resize, leaving as-is.");
     }
+  }
 
-    /* if the block can't be split, leave it as is -- the size difference is
-       small enough that resizing is probably pointless. */
+  /* samples are newest first, so the first one seen for a site is kept */
+  for (sample = pool->samples; sample; sample = sample->next) {
+    pool_site_totals_t *site_totals = &totals[sample->site];
+    site_totals->samples += 1;
+    site_totals->sampled_bytes += sample->size > pool->sample_rate ? sample->size : pool->sample_rate;
+    if (site_totals->sample == NULL)
+      site_totals->sample = sample;
+  }
 
-  } else if ( ! block->next->used && (block->next->size - size_diff) >= MIN_BLOCK_SIZE) {
-    /* if the next block is unused, try to join it with that.
-       not using pool_split_block because the new block is the only one that
-       has to be valid -- in a sense, it's more like moving a block. */
-    block_head_t copy = *block->next;
-    block_head_t *split = (block_head_t *)((char *)block->next + size_diff);
+  /* gather live sites at the front, then sort them largest first */
+  for (site_index = 0; site_index <= POOL_SITE_COUNT; ++site_index) {
+    if (totals[site_index].blocks)
+      totals[live_sites++] = totals[site_index];
+  }
 
-    /* copy old to new */
-    *split = copy;
+  qsort(totals, live_sites, sizeof(*totals), pool_compare_site_totals);
 
-    /* reset pointers */
-    split->next->prev = split;
-    split->prev->next = split;
+  fprintf(out, "Live allocations in pool %p (%zu sites):\n", (const void *)pool, live_sites);
+  for (index = 0; index < live_sites; ++index) {
+    const pool_site_totals_t *site_totals = &totals[index];
+    const pool_site_t *site = pool_site_for_id(site_totals->site);
 
-#if USE_MEMORY_GUARD
-    /* put memory guard in place (if in use) */
-    ((guard_t *)((char *)block + new_size))[-1] = MEMORY_GUARD;
-#endif /* USE_MEMORY_GUARD */
+    if (site)
+      fprintf(out, "  %s:%d (%s)", site->file, site->line, site->function);
+    else
+      fprintf(out, "  <unknown site>");
 
-    /* reset next unused pointer */
-    pool->next_unused = split;
+    fprintf(out, ": %zu bytes in %zu blocks\n", site_totals->bytes, site_totals->blocks);
 
-    /* done */
-    block->size = new_size;
-  } else if ( ! block->prev->used) {
-    /* if the last block is unused, try to join it with that */
-    block_head_t *split = (block_head_t *)((char *)block->prev + (block->size - size_diff));
-    block->prev->size -= size_diff;
+    if (site_totals->samples) {
+      fprintf(out, "    %zu samples, ~%zu bytes estimated\n", site_totals->samples, site_totals->sampled_bytes);
+#if USE_BACKTRACE
+      fflush(out);
+      backtrace_symbols_fd(site_totals->sample->frames, site_totals->sample->depth, fileno(out));
+#endif
+    }
+  }
 
-    /* copy old to new */
-    memmove(split, block, block->size);
+dump_unlock_and_exit:
+  mutex_unlock(&pool->lock);
+  com_free(pool->alloc, totals);
+}
 
-    /* reset pointers */
-    split->next->prev = split;
-    split->prev->next = split;
+#endif /* !NDEBUG */
 
-#if USE_MEMORY_GUARD
-    ((guard_t *)((char *)block + new_size))[-1] = MEMORY_GUARD;
-#endif /* USE_MEMORY_GUARD */
+///////////////////////////////////////////////////////////////////////////////
+////                             Pool Allocator                            ////
+///////////////////////////////////////////////////////////////////////////////
 
-    /* again, reset next unused pointer */
-    pool->next_unused = block->prev;
+#define POOL_ALLOCATOR_TAG (-1)
 
-    block->size = new_size;
-    p = block+1;
-  } else {
-    /* last resort: allocate a new block, copy, free the old block */
-    void *new_p = pool_malloc(block->pool, size, block->tag);
+typedef struct s_pool_magazine pool_magazine_t;
+typedef struct s_pool_cache pool_cache_t;
 
-    if (new_p) {
-      memcpy(new_p, p, block->size - sizeof(block_head_t));
-      pool_free(p);
-    } else {
-      s_log_error("Failed to allocate new memory block for realloc");
-    }
+/*!
+ * A stack of cached blocks for one size class.
+ */
+struct s_pool_magazine
+{
+  size_t count;
+  void *blocks[POOL_CACHE_DEPTH];
+};
 
-    p = new_p;
-  }
+/*!
+ * A thread's cache of blocks for a single pool.
+ */
+struct s_pool_cache
+{
+  pool_t *pool;
+  /*! Neighbours in the pool's list of caches. */
+  pool_cache_t *prev;
+  pool_cache_t *next;
+  pool_magazine_t magazines[POOL_CACHE_CLASS_COUNT];
+};
 
-  pool_realloc_exit:
+static void *al_pool_malloc(size_t min_size, void *ctx);
+static void *al_pool_malloc_usable(size_t min_size, size_t *usable_size, void *ctx);
+static void *al_pool_realloc(void *p, size_t min_size, void *ctx);
+static void al_pool_free(void *p, void *ctx);
+
+
+#if S_USE_PTHREADS
+
+/* returns the first `count` blocks of the magazine to the pool */
+static void pool_magazine_flush(pool_t *pool, pool_magazine_t *magazine, size_t count)
+{
+  size_t index;
+
+  if (count > magazine->count)
+    count = magazine->count;
+
+  mutex_lock(&pool->lock);
+  for (index = 0; index < count; ++index)
+    pool_free(magazine->blocks[index]);
   mutex_unlock(&pool->lock);
-  return p;
+
+  magazine->count -= count;
+  memmove(magazine->blocks, magazine->blocks + count, magazine->count * sizeof(void *));
 }
 
 
-void pool_free(void *buffer)
+static void pool_cache_flush(pool_cache_t *cache)
 {
-  if ( ! buffer) {
-    s_log_error("Free on NULL");
-    return;
+  size_t class_index;
+
+  for (class_index = 0; class_index < POOL_CACHE_CLASS_COUNT; ++class_index) {
+    pool_magazine_t *magazine = &cache->magazines[class_index];
+    if (magazine->count)
+      pool_magazine_flush(cache->pool, magazine, magazine->count);
   }
+}
 
-  block_head_t *block = (block_head_t *)buffer - 1;
-  pool_t *pool = block->pool;
 
-  /*s_log_note("freeing block:");*/
-  /*dbg_print_block(block);*/
+/* thread exit destructor for pool caches */
+static void pool_cache_dtor(void *value)
+{
+  pool_cache_t *cache = (pool_cache_t *)value;
+  pool_t *pool;
+  allocator_t *alloc;
 
-  if ( ! pool) {
-    s_log_error("Attempt to free block without an associated pool");
-    return;
-  }
+  if ( ! cache) return;
+
+  pool = cache->pool;
+  alloc = pool->alloc;
+  pool_cache_flush(cache);
 
   mutex_lock(&pool->lock);
+  if (cache->prev)
+    cache->prev->next = cache->next;
+  else
+    pool->caches = cache->next;
+  if (cache->next)
+    cache->next->prev = cache->prev;
+  mutex_unlock(&pool->lock);
 
-  if (block == &block->pool->head) {
-    s_log_error("Free on header block of pool");
-    goto free_unlock_and_exit;
-  }
+  com_free(alloc, cache);
+}
 
-  if (block->size < MIN_BLOCK_SIZE) {
-    s_log_error("Invalid block, too small (%zu) - may be corrupted", block->size);
-    goto free_unlock_and_exit;
-  }
 
-#if USE_MEMORY_GUARD
-  guard_t guard = ((guard_t *)((char *)block + block->size))[-1];
-  if (guard != MEMORY_GUARD) {
-    s_log_error("Block memory guard corrupted - reads %X", guard);
-  }
-#endif
+static pool_cache_t *pool_thread_cache(pool_t *pool)
+{
+  pool_cache_t *cache;
 
-  if ( ! block->used) {
-    s_log_error("Double-free on block");
-    goto free_unlock_and_exit;
-  }
+  if ( ! __atomic_load_n(&pool->cached, __ATOMIC_ACQUIRE))
+    return NULL;
 
-  /*block->tag = DEFAULT_BLOCK_TAG_UNUSED;*/
-  block->used = 0;
+  cache = (pool_cache_t *)pthread_getspecific(pool->cache_key);
 
-  if ( ! block->next->used) {
-    block->size += block->next->size;
-    block->next = block->next->next;
-    block->next->prev = block;
-  }
+  if (cache == NULL) {
+    cache = (pool_cache_t *)com_malloc(pool->alloc, sizeof(*cache));
+    if (cache == NULL)
+      return NULL;
 
-  if ( ! block->prev->used) {
-    block = block->prev;
-    block->size += block->next->size;
-    block->next = block->next->next;
-    block->next->prev = block;
+    memset(cache, 0, sizeof(*cache));
+    cache->pool = pool;
+    pthread_setspecific(pool->cache_key, cache);
+
+    mutex_lock(&pool->lock);
+    cache->next = pool->caches;
+    if (cache->next)
+      cache->next->prev = cache;
+    pool->caches = cache;
+    mutex_unlock(&pool->lock);
   }
 
-#if !NDEBUG
+  return cache;
+}
 
-  /* clear debug info */
-  com_free(pool->alloc, block->debug_info.source_file);
-  block->debug_info.source_file = NULL;
-  block->debug_info.function = NULL;
-  block->debug_info.line = -1;
-  block->debug_info.requested_size = 0;
 
-#endif /* !NDEBUG */
+void pool_flush_thread_cache(pool_t *pool)
+{
+  pool_cache_t *cache;
+
+  if (pool == NULL)
+    pool = &g_main_pool;
 
-  pool->next_unused = block;
+  if ( ! __atomic_load_n(&pool->cached, __ATOMIC_ACQUIRE))
+    return;
 
-free_unlock_and_exit:
-  mutex_unlock(&pool->lock);
+  cache = (pool_cache_t *)pthread_getspecific(pool->cache_key);
+  if (cache)
+    pool_cache_flush(cache);
 }
 
 
-static inline void dbg_print_block(const block_head_t *block)
+static void pool_destroy_thread_caches(pool_t *pool)
 {
-  /* the odd exception where s_log_* is not used... */
-  fprintf(stderr, "BLOCK [header: %p | buffer: %p] {\n", (void *)block, (void *)(block+1));
-#if USE_MEMORY_GUARD
-  fprintf(stderr, "  guard: %X\n", ((const guard_t *)((const char *)block+block->size))[-1]);
-#endif /* USE_MEMORY_GUARD */
-  fprintf(stderr, "  block size: %zu bytes\n", block->size);
-  fprintf(stderr, "  prev: %p\n", block->prev);
-  fprintf(stderr, "  next: %p\n", block->next);
-  fprintf(stderr, "  used: %d\n", block->used);
-  fprintf(stderr, "  tag: %X\n", block->tag);
-#if !NDEBUG
-  fprintf(stderr, "  source file: %s [%d]\n", block->debug_info.source_file, block->debug_info.line);
-  fprintf(stderr, "  source function: %s\n", block->debug_info.function);
-  fprintf(stderr, "  buffer size: %zu bytes\n", block->debug_info.requested_size);
-#endif /* !NDEBUG */
-  fprintf(stderr, "  pool: %p\n}\n", block->pool);
+  pool_cache_t *cache;
+  pool_cache_t *next;
+
+  if ( ! __atomic_load_n(&pool->cached, __ATOMIC_ACQUIRE))
+    return;
+
+  /* once the key is deleted, the other threads' destructors never run, so
+     their caches are released here too. The blocks they hold go away with
+     the pool's buffer. */
+  mutex_lock(&pool->lock);
+  for (cache = pool->caches; cache; cache = next) {
+    next = cache->next;
+    com_free(pool->alloc, cache);
+  }
+  pool->caches = NULL;
+  mutex_unlock(&pool->lock);
+
+  pthread_setspecific(pool->cache_key, NULL);
+  pthread_key_delete(pool->cache_key);
+  __atomic_store_n(&pool->cached, false, __ATOMIC_RELEASE);
 }
 
 
-static void pool_check_for_errors(const pool_t *pool)
+allocator_t pool_allocator(pool_t *pool)
 {
-  if (pool == NULL) {
-    s_fatal_error(1, "Attempt to check NULL pool.");
-    return;
-  }
+  if (pool == NULL)
+    pool = &g_main_pool;
 
-  if (pool->alloc == NULL) {
-    s_fatal_error(1, "Pool allocator is NULL.");
-    return;
+  mutex_lock(&pool->lock);
+  if ( ! pool->cached) {
+    if (pthread_key_create(&pool->cache_key, pool_cache_dtor) == 0)
+      __atomic_store_n(&pool->cached, true, __ATOMIC_RELEASE);
+    else
+      s_log_error("Failed to create thread cache key for pool (%p)", (const void *)pool);
   }
+  mutex_unlock(&pool->lock);
 
-  const block_head_t *block = pool->head.next;
-  for (; block != &pool->head; block = block->next) {
-    if (block) {
-      pool_check_block_for_errors(block, block->used);
-    } else {
-      s_fatal_error(1, "Memory pool links are corrupted.");
-      return;
-    }
+  allocator_t alloc = {
+    .malloc = al_pool_malloc,
+    .realloc = al_pool_realloc,
+    .free = al_pool_free,
+    .context = pool,
+    /* pool memory is never zeroed anyway */
+    .malloc_uninit = al_pool_malloc,
+    .malloc_usable = al_pool_malloc_usable
   };
+  return alloc;
 }
 
 
-static void pool_check_block_for_errors(const block_head_t *block, int debug_block)
+static void *al_pool_malloc(size_t min_size, void *ctx)
 {
-  if (block->pool && block == &block->pool->head) {
-    s_log_error("Cannot check pool header block");
-    return;
-  }
+  pool_t *pool = (pool_t *)ctx;
+  pool_cache_t *cache;
+  pool_magazine_t *magazine;
+  size_t class_index;
 
-  int spew_block = debug_block;
+  class_index = min_size ? (min_size - 1) / POOL_CACHE_CLASS_SIZE : 0;
+  if (class_index >= POOL_CACHE_CLASS_COUNT || (cache = pool_thread_cache(pool)) == NULL)
+    return pool_malloc(pool, min_size, POOL_ALLOCATOR_TAG);
 
-  if (block->size < MIN_BLOCK_SIZE) {
-    s_log_error("Block smaller than minimum required size (%zu) - may be corrupt", MIN_BLOCK_SIZE);
-  }
+  magazine = &cache->magazines[class_index];
 
-  if (block->next == NULL || block->prev == NULL) {
-    s_log_error("Block detached from block list");
-  }
+  if (magazine->count == 0) {
+    /* refill the magazine in one go */
+    const size_t class_size = (class_index + 1) * POOL_CACHE_CLASS_SIZE;
 
-#if USE_MEMORY_GUARD
-  if (block->used) {
-    guard_t guard = ((const guard_t *)((const char *)block + block->size))[-1];
-    if (guard != MEMORY_GUARD) {
-      s_log_error("Memory guard corrupted");
+    mutex_lock(&pool->lock);
+    while (magazine->count < POOL_CACHE_BATCH) {
+      void *p = pool_malloc(pool, class_size, POOL_ALLOCATOR_TAG);
+      if (p == NULL)
+        break;
+      magazine->blocks[magazine->count++] = p;
     }
-  }
-#endif
+    mutex_unlock(&pool->lock);
 
-  if ( ! block->pool) {
-    s_log_error("Block detached from memory pool");
+    if (magazine->count == 0)
+      return NULL;
   }
 
-  if (spew_block) {
-    dbg_print_block(block);
-  }
+  return magazine->blocks[--magazine->count];
 }
 
 
-const block_head_t *pool_block_for_pointer(const void *buffer)
+static void al_pool_free(void *p, void *ctx)
 {
-  const block_head_t *block = (const block_head_t *)buffer - 1;
+  pool_t *pool = (pool_t *)ctx;
+  const block_head_t *block;
+  pool_cache_t *cache;
+  pool_magazine_t *magazine;
+  buffersize_t usable;
+  size_t class_index;
+
+  if (p == NULL) {
+    s_log_error("Free on NULL");
+    return;
+  }
+
+  /* only blocks the allocator handed out are cached: they're given out
+     again under POOL_ALLOCATOR_TAG, so a block with any other tag would be
+     counted against the wrong tag from then on */
+  block = (const block_head_t *)p - 1;
+  if (block->pool != pool || block->tag != POOL_ALLOCATOR_TAG || block->size < MIN_BLOCK_SIZE)
+    goto al_pool_free_uncached;
 
 #if USE_MEMORY_GUARD
-  guard_t guard = ((guard_t *)((const char *)buffer + block->size))[-1];
-  if (guard != MEMORY_GUARD) {
-    s_log_error("Memory guard corrupted");
-    dbg_print_block(block);
-    return NULL;
-  }
+  if (((const guard_t *)((const char *)block + block->size))[-1] != MEMORY_GUARD)
+    goto al_pool_free_uncached; /* let pool_free report it */
 #endif
 
-  return block;
+  /* any block at least as large as the class size can serve that class */
+  usable = block->size - sizeof(block_head_t) - MEMORY_GUARD_SIZE;
+  class_index = usable / POOL_CACHE_CLASS_SIZE;
+  if (class_index == 0)
+    goto al_pool_free_uncached;
+
+  class_index -= 1;
+  if (class_index >= POOL_CACHE_CLASS_COUNT || (cache = pool_thread_cache(pool)) == NULL)
+    goto al_pool_free_uncached;
+
+  magazine = &cache->magazines[class_index];
+
+  if (magazine->count == POOL_CACHE_DEPTH)
+    pool_magazine_flush(pool, magazine, POOL_CACHE_BATCH);
+
+  magazine->blocks[magazine->count++] = p;
+  return;
+
+al_pool_free_uncached:
+  pool_free(p);
 }
 
-///////////////////////////////////////////////////////////////////////////////
-////                             Pool Allocator                            ////
-///////////////////////////////////////////////////////////////////////////////
+#else /* S_USE_PTHREADS */
 
-#define POOL_ALLOCATOR_TAG (-1)
+void pool_flush_thread_cache(pool_t *pool)
+{
+  (void)pool;
+}
 
-static void *al_pool_malloc(size_t min_size, void *ctx);
-static void *al_pool_realloc(void *p, size_t min_size, void *ctx);
-static void al_pool_free(void *p, void *ctx);
+
+static void pool_destroy_thread_caches(pool_t *pool)
+{
+  (void)pool;
+}
 
 
 allocator_t pool_allocator(pool_t *pool)
@@ -761,7 +2120,10 @@ allocator_t pool_allocator(pool_t *pool)
     .malloc = al_pool_malloc,
     .realloc = al_pool_realloc,
     .free = al_pool_free,
-    .context = pool
+    .context = pool,
+    /* pool memory is never zeroed anyway */
+    .malloc_uninit = al_pool_malloc,
+    .malloc_usable = al_pool_malloc_usable
   };
   return alloc;
 }
@@ -773,19 +2135,34 @@ static void *al_pool_malloc(size_t min_size, void *ctx)
 }
 
 
-static void *al_pool_realloc(void *p, size_t min_size, void *ctx)
+static void al_pool_free(void *p, void *ctx)
 {
-  if (p)
-    return pool_realloc(p, min_size);
-  else
-    return pool_malloc((pool_t *)ctx, min_size, POOL_ALLOCATOR_TAG);
+  (void)ctx;
+  pool_free(p);
 }
 
+#endif /* !S_USE_PTHREADS */
 
-static void al_pool_free(void *p, void *ctx)
+
+static void *al_pool_malloc_usable(size_t min_size, size_t *usable_size, void *ctx)
 {
-  (void)ctx;
-  pool_free(p);
+  void *p = al_pool_malloc(min_size, ctx);
+
+  if (p && usable_size) {
+    const block_head_t *block = (const block_head_t *)p - 1;
+    *usable_size = block->size - sizeof(block_head_t) - MEMORY_GUARD_SIZE;
+  }
+
+  return p;
+}
+
+
+static void *al_pool_realloc(void *p, size_t min_size, void *ctx)
+{
+  if (p)
+    return pool_realloc(p, min_size);
+  else
+    return al_pool_malloc(min_size, ctx);
 }
 
 
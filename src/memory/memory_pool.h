@@ -9,6 +9,7 @@
 #define __SNOW__MEMORY_POOL_H__
 
 #include <snow-config.h>
+#include <stdio.h>
 #include <threads/mutex.h>
 #include "allocator.h"
 
@@ -18,9 +19,39 @@
   The API for creating, destroying, and allocating from memory pools. Memory
   pools are essentially linked lists that represent chunks of memory in a
   larger chunk of memory. The purpose of this is to ensure that, when
-  necessary, memory that ought to be close together is. There is no solid way
-  to reduce fragmentation, but ::pool_malloc will always attempt to use the next
-  free or most recently freed block of memory for any new allocations.
+  necessary, memory that ought to be close together is.
+
+  Unused blocks are indexed by size in two-level segregated free lists (as in
+  TLSF), so ::pool_malloc finds a block in constant time regardless of how
+  many blocks are live, and ::pool_free coalesces freed blocks with their
+  unused neighbors immediately.
+
+  \par Growth
+  A pool starts out with a single region of memory. When no region has a
+  block large enough for an allocation, a pool with a growth factor greater
+  than one allocates another region from its backing allocator, sized so the
+  pool's total capacity grows by that factor. Regions are searched in address
+  order, so allocations settle into the lowest regions, and a region other
+  than the first is returned to the backing allocator as soon as all of its
+  blocks are freed.
+
+  Pools created by ::pool_init_mapped instead reserve address space up front
+  and grow by committing more of it to their first region. When the end of
+  that region is free, the unused pages past it are decommitted again.
+
+  \par Statistics
+  Every pool keeps running totals of its live blocks, overall and per tag,
+  updated as blocks are allocated, resized, and freed. ::pool_stats reads
+  them along with the pool's largest free block, its fragmentation, and its
+  recent allocation rate without walking the pool's blocks.
+
+  \par Profiling
+  In debug builds, every block records the site (source file, function, and
+  line) it was allocated from as a 32-bit id into a table of interned sites.
+  A pool can also sample one allocation every so many bytes with
+  ::pool_set_sample_rate, capturing its call stack where backtrace() is
+  available. ::pool_dump_profile writes the pool's live allocations grouped
+  by site, along with the sampled stacks.
 
   \par Thread Safety
   The only operations wrapped in a lock are ::mem_destroy_pool,
@@ -28,6 +59,12 @@
   do not get that treatment. If you need to lock the pool for another reason,
   the pool_t::lock member is there, but it's advised that you don't try
   to ever fiddle with pool internals.
+
+  \par Thread Caches
+  Allocators returned by ::pool_allocator keep a per-thread cache of recently
+  freed small blocks for each size class, so most allocations and frees made
+  through them never take the pool lock. Caches are refilled from and
+  returned to the pool in batches, under a single lock each time.
 */
 
 #ifdef __SNOW__MEMORY_POOL_C__
@@ -47,7 +84,58 @@ extern "C"
 typedef size_t buffersize_t;
 typedef ptrdiff_t bufferdiff_t;
 
+/*! Flags for ::pool_init_mapped. */
+enum
+{
+  /*! Ask for transparent huge pages where supported. Commits are made in
+      huge page sized steps. */
+  POOL_MAP_HUGE_PAGES = 0x1 << 0,
+};
+
+/*! Log2 of the number of second-level free lists per first-level list. */
+#define POOL_SL_INDEX_COUNT_LOG2 (4)
+/*! Number of second-level free lists per first-level list. */
+#define POOL_SL_INDEX_COUNT (1 << POOL_SL_INDEX_COUNT_LOG2)
+/*! Log2 of the largest block size the free lists can index. */
+#define POOL_FL_INDEX_MAX (32)
+/*! Log2 of the size below which blocks share the first first-level list. */
+#define POOL_FL_INDEX_SHIFT (POOL_SL_INDEX_COUNT_LOG2 + 4)
+/*! Number of first-level free lists. */
+#define POOL_FL_INDEX_COUNT (POOL_FL_INDEX_MAX - POOL_FL_INDEX_SHIFT + 1)
+
+/*! Default growth factor for pools created by ::pool_init. */
+#define POOL_DEFAULT_GROWTH_FACTOR (2.0f)
+
+/*! Free bytes a mapped pool keeps committed past its last block when
+    decommitting its tail. */
+#define POOL_DECOMMIT_SLACK (256 * 1024)
+
+/*! Number of distinct tags a pool keeps statistics for. Blocks with tags
+    beyond this are counted together. */
+#define POOL_STATS_TAG_COUNT (32)
+
+/*! Number of allocation sites that can be interned in debug builds. Must
+    be a power of two. Sites beyond this are recorded as unknown. */
+#define POOL_SITE_COUNT (4096)
+/*! Number of stack frames captured for each sampled allocation. */
+#define POOL_SAMPLE_DEPTH (16)
+
+/*! Size step between the size classes of the thread caches. */
+#define POOL_CACHE_CLASS_SIZE (16)
+/*! Number of size classes in a thread cache. Allocations larger than
+    POOL_CACHE_CLASS_SIZE * POOL_CACHE_CLASS_COUNT bypass the cache. */
+#define POOL_CACHE_CLASS_COUNT (16)
+/*! Maximum number of blocks a thread cache holds per size class. */
+#define POOL_CACHE_DEPTH (32)
+/*! Number of blocks moved between a thread cache and its pool at once. */
+#define POOL_CACHE_BATCH (POOL_CACHE_DEPTH / 2)
+
 typedef struct s_block_head block_head_t;
+typedef struct s_pool_region pool_region_t;
+typedef struct s_pool_tag_stats pool_tag_stats_t;
+typedef struct s_pool_stats pool_stats_t;
+typedef struct s_pool_site pool_site_t;
+typedef struct s_pool_sample pool_sample_t;
 typedef struct s_pool pool_t;
 
 /*!
@@ -75,40 +163,155 @@ struct s_block_head
   /* debugging info for tracking allocations */
   struct
   {
-    /* the source file this block was allocated from */
-    char *source_file;
-    /* the function this block was allocated from */
-    char *function;
-    /* the line in the source file that this block was allocated from */
-    int32_t line;
+    /* id of the site this block was allocated from, 0 if unknown -- see
+       pool_site_for_id */
+    uint32_t site;
     /* the size requested (this always differs from the above size) */
     buffersize_t requested_size;
+    /* the profiler sample taken for this block, if any */
+    pool_sample_t *sample;
   } debug_info;
 
 #endif
 };
 
+/*!
+ * An interned allocation site.
+ */
+struct s_pool_site
+{
+  const char *file;
+  const char *function;
+  int32_t line;
+};
+
+/*!
+ * A contiguous region of memory in a pool. Each region keeps its own block
+ * list and free lists, so blocks never span or merge across regions. This is
+ * mainly for internal use.
+ */
+struct s_pool_region
+{
+  /*! Next region of the pool in address order. */
+  pool_region_t *next;
+  /*! Start of the region's blocks. */
+  char *buffer;
+  /*! Size of the region's blocks combined. */
+  buffersize_t size;
+  /*! Bitmap of first-level free lists that hold at least one block. */
+  uint32_t fl_bitmap;
+  /*! Bitmaps of second-level free lists that hold at least one block. */
+  uint32_t sl_bitmap[POOL_FL_INDEX_COUNT];
+  /*! Segregated free lists of unused blocks, indexed by size class. */
+  block_head_t *free_blocks[POOL_FL_INDEX_COUNT][POOL_SL_INDEX_COUNT];
+  /*! Header block of the region's block list - size is always 0, used is
+      always 1. */
+  block_head_t head;
+};
+
+/*!
+ * Live block totals for a single tag.
+ */
+struct s_pool_tag_stats
+{
+  /*! The tag. Zero if the entry is unused. */
+  int32_t tag;
+  /*! Number of live blocks with the tag. */
+  size_t blocks;
+  /*! Size of the live blocks with the tag combined. Includes headers,
+      memory guards, and alignment adjustment. */
+  buffersize_t bytes;
+};
+
+/*!
+ * Memory pool statistics, as returned by ::pool_stats.
+ */
+struct s_pool_stats
+{
+  /*! Size of the pool's regions combined. */
+  buffersize_t size;
+  /*! Size of all live blocks combined. Blocks held in thread caches are
+      counted as live. */
+  buffersize_t used_bytes;
+  /*! Highest used_bytes has been since the pool was initialized. */
+  buffersize_t peak_used_bytes;
+  /*! Number of live blocks. */
+  size_t used_blocks;
+  /*! Size of all unused blocks combined. */
+  buffersize_t free_bytes;
+  /*! Size of the largest unused block. */
+  buffersize_t largest_free_block;
+  /*! External fragmentation: the fraction of free memory not in the
+      largest unused block. Zero if the pool has no free memory. */
+  float fragmentation;
+  /*! Number of allocations made since the pool was initialized. */
+  uint64_t allocations;
+  /*! Allocations per second since the previous call to ::pool_stats. */
+  double allocation_rate;
+  /*! Per-tag totals. Unused entries have a tag of zero. */
+  pool_tag_stats_t tags[POOL_STATS_TAG_COUNT];
+  /*! Totals for blocks whose tags didn't fit in tags. */
+  pool_tag_stats_t untracked;
+};
+
 /*!
  * Memory pool structure. Do not touch its members unless you want to break stuff.
  */
 struct s_pool
 {
   allocator_t *alloc;
-  /*! Size of the memory pool. Includes adjustment for alignment. */
+  /*! Size of the memory pool's regions combined. */
   buffersize_t size;
+  /*! Factor the pool's size grows by when it runs out of memory. The pool
+      does not grow if this is 1 or less. */
+  float growth_factor;
   /*! Counter for block allocation - can overflow. */
   int32_t sequence;
-  /*! The memory used by the memory pool. */
+  /*! The memory used by the pool's first region. */
   char *buffer;
   /*! Whether the buffer should be freed on destruction. If managed, free the
       memory. If not, do nothing to it. */
   bool managed;
-  /*! The next free block of memory. */
-  block_head_t *next_unused;
-  /*! Header block - size is always 0, used is always 1, etc. */
+  /*! Whether the buffer is an address space reservation made by
+      ::pool_init_mapped, unmapped on destruction. */
+  bool mapped;
+  /*! For mapped pools, the size of the reservation, the smallest size the
+      first region is decommitted to, and the step commits are made in. */
+  buffersize_t reserved;
+  buffersize_t min_committed;
+  buffersize_t commit_granularity;
+  /*! The pool's first region, which is never released. */
+  pool_region_t root;
+  /*! All of the pool's regions in address order. */
+  pool_region_t *regions;
+  /*! Header block - size is always 0, used is 1 while the pool is
+      initialized. */
   block_head_t head;
+  /*! Running statistics. Only the counters are kept up to date. */
+  pool_stats_t stats;
+  /*! Time and allocation count at the previous call to ::pool_stats. */
+  double stats_time;
+  uint64_t stats_allocations;
+#if !NDEBUG
+  /*! Bytes allocated between profiler samples. Zero if sampling is off. */
+  size_t sample_rate;
+  /*! Bytes left to allocate before the next sample. */
+  size_t sample_countdown;
+  /*! Samples for live blocks. */
+  pool_sample_t *samples;
+#endif
   /*! Pool lock */
   mutex_t lock;
+#if S_USE_PTHREADS
+  /*! Key for the per-thread caches used by pool allocators. */
+  pthread_key_t cache_key;
+#endif
+  /*! Whether cache_key has been created. Pool allocators check it without
+      taking lock, so it's read and written with __atomic builtins. */
+  bool cached;
+  /*! Every thread's cache for the pool, so they can be released when the
+      pool is destroyed. Guarded by lock. */
+  struct s_pool_cache *caches;
 };
 
 /*!
@@ -125,15 +328,43 @@ void sys_pool_shutdown(void);
  * Initializes a new memory pool. Newly-initialized pools have a retain-count of 1.
  *
  * \param[inout]  pool The address of an uninitialized pool to be initialized.
- * \param[in]   size The size of the memory pool to initialize.
+ * \param[in]   size The initial size of the memory pool. The pool grows by
+ *  POOL_DEFAULT_GROWTH_FACTOR when it runs out of memory.
  */
 int pool_init(pool_t *pool, buffersize_t size, allocator_t *alloc);
 
 /*!
- * Initializes a new memory pool with an existing block of memory.
+ * Initializes a new memory pool with an existing block of memory. Pools
+ * created this way do not grow unless given a growth factor with
+ * ::pool_set_growth_factor, in which case additional regions are allocated
+ * from alloc.
  */
 int pool_init_with_pointer(pool_t *pool, void *p, buffersize_t size, allocator_t *alloc);
 
+/*!
+ * Initializes a new memory pool in a reserved range of address space. Only
+ * commit_size bytes of it are committed to start with; the rest is
+ * committed as the pool grows, up to reserve_size bytes in total, and
+ * decommitted when the end of the pool is free again. The memory is not
+ * zeroed by the pool, though fresh pages from the system are.
+ *
+ * On platforms without mmap, this is the same as ::pool_init with
+ * commit_size.
+ *
+ * \param[inout] pool         The address of an uninitialized pool.
+ * \param[in]    reserve_size The largest size the pool may grow to.
+ * \param[in]    commit_size  The initial and smallest committed size.
+ * \param[in]    flags        Zero or more POOL_MAP_ flags.
+ * \param[in]    alloc        Allocator for the pool's bookkeeping.
+ */
+int pool_init_mapped(pool_t *pool, buffersize_t reserve_size, buffersize_t commit_size, int flags, allocator_t *alloc);
+
+/*!
+ * Sets the factor the pool's size grows by when it runs out of memory. A
+ * factor of 1 or less keeps the pool at its current size.
+ */
+void pool_set_growth_factor(pool_t *pool, float factor);
+
 /*!
  * Destroys a memory pool.
  * @param pool The address of a previously-initialized pool to be destroyed.
@@ -193,9 +424,52 @@ void pool_free(void *buffer);
 const block_head_t *pool_block_for_pointer(const void *buffer);
 
 
-//! Gets an allocator for the given memory pool.
+#if !NDEBUG
+
+/*!
+ * Gets the allocation site for a block's site id, or NULL if the id is
+ * unknown. Sites are never removed, so the result remains valid.
+ */
+const pool_site_t *pool_site_for_id(uint32_t site);
+
+/*!
+ * Samples one allocation for every `bytes` bytes allocated from the pool.
+ * Passing zero turns sampling off. Samples already taken are kept until
+ * their blocks are freed.
+ */
+void pool_set_sample_rate(pool_t *pool, size_t bytes);
+
+/*!
+ * Writes the pool's live allocations, grouped by site and sorted by size,
+ * to out (or stderr if out is NULL). Sites with sampled allocations also
+ * get an estimate of their live bytes from the samples and the call stack
+ * of the most recent sample.
+ */
+void pool_dump_profile(pool_t *pool, FILE *out);
+
+#endif /* !NDEBUG */
+
+/*!
+ * Gets the pool's current statistics. This takes the pool lock but does not
+ * walk the pool's blocks, so it's cheap enough to call every frame.
+ *
+ * \param[in]  pool  The pool to get statistics for. If NULL, the global
+ *  memory pool is used.
+ * \param[out] stats The statistics.
+ */
+void pool_stats(pool_t *pool, pool_stats_t *stats);
+
+
+//! Gets an allocator for the given memory pool. Small allocations made
+//! through it are served from a per-thread cache of blocks when possible.
 allocator_t pool_allocator(pool_t *pool);
 
+/*!
+ * Returns all blocks held in the calling thread's cache back to the pool.
+ * Thread caches are flushed automatically when their thread exits.
+ */
+void pool_flush_thread_cache(pool_t *pool);
+
 
 #if defined(__cplusplus)
 }
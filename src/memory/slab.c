@@ -0,0 +1,295 @@
+/*
+  Slab allocator for small fixed-size objects
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__SLAB_C__
+
+#include "slab.h"
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+typedef struct s_slab_head slab_head_t;
+
+/*!
+ * Header at the start of every slab. Objects follow it, so the slab for any
+ * object is found by rounding the object's address down to SLAB_PAGE_SIZE.
+ */
+struct s_slab_head
+{
+  /*! Size class of the slab's objects, or NULL for a large object. */
+  slab_class_t *owner;
+  /*! Pointer to free and usable size for a large object. */
+  void *origin;
+  size_t size;
+};
+
+/*!
+ * Record of a chunk of slabs allocated from the backing allocator.
+ */
+struct s_slab_chunk
+{
+  slab_chunk_t *next;
+  void *origin;
+};
+
+#define SLAB_ALIGN(SZ, ALIGNMENT) (((SZ) + ((ALIGNMENT) - 1)) & ~(uintptr_t)((ALIGNMENT) - 1))
+/*! Space taken by the slab header -- keeps objects 16-byte aligned. */
+#define SLAB_HEADER_SIZE SLAB_ALIGN(sizeof(slab_head_t), SLAB_CLASS_SIZE)
+#define SLAB_FOR_POINTER(P) ((slab_head_t *)((uintptr_t)(P) & ~(uintptr_t)(SLAB_PAGE_SIZE - 1)))
+
+static void *al_slab_malloc(size_t min_size, void *ctx);
+static void *al_slab_malloc_usable(size_t min_size, size_t *usable_size, void *ctx);
+static void *al_slab_realloc(void *p, size_t min_size, void *ctx);
+static void al_slab_free(void *p, void *ctx);
+
+
+int slab_init(slab_allocator_t *slab, allocator_t *alloc)
+{
+  size_t class_index;
+
+  if (slab == NULL) {
+    s_log_error("Attempt to initialize NULL slab allocator.");
+    return -1;
+  }
+
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  memset(slab, 0, sizeof(*slab));
+
+  if (mutex_init(&slab->lock, false)) {
+    s_log_error("Failed to initialize slab allocator mutex.");
+    return -1;
+  }
+
+  slab->alloc = alloc;
+
+  for (class_index = 0; class_index < SLAB_CLASS_COUNT; ++class_index)
+    slab->classes[class_index].object_size = (class_index + 1) * SLAB_CLASS_SIZE;
+
+  slab->allocator.malloc = al_slab_malloc;
+  slab->allocator.realloc = al_slab_realloc;
+  slab->allocator.free = al_slab_free;
+  slab->allocator.context = slab;
+  slab->allocator.malloc_uninit = al_slab_malloc;
+  slab->allocator.malloc_usable = al_slab_malloc_usable;
+
+  return 0;
+}
+
+
+void slab_destroy(slab_allocator_t *slab)
+{
+  slab_chunk_t *chunk;
+
+  mutex_lock(&slab->lock);
+
+  chunk = slab->chunks;
+  while (chunk) {
+    slab_chunk_t *next = chunk->next;
+    com_free(slab->alloc, chunk->origin);
+    com_free(slab->alloc, chunk);
+    chunk = next;
+  }
+
+  mutex_unlock(&slab->lock);
+  mutex_destroy(&slab->lock);
+
+  memset(slab, 0, sizeof(*slab));
+}
+
+
+allocator_t *slab_allocator(slab_allocator_t *slab)
+{
+  return &slab->allocator;
+}
+
+
+/* gets an unused slab, allocating a new chunk of them if needed -- must be
+   called with the slab allocator locked */
+static slab_head_t *slab_new_page(slab_allocator_t *slab)
+{
+  slab_head_t *page;
+
+  if (slab->pages_left == 0) {
+    slab_chunk_t *chunk = (slab_chunk_t *)com_malloc(slab->alloc, sizeof(*chunk));
+    void *origin;
+
+    if (chunk == NULL) {
+      s_log_error("Failed to allocate slab chunk record.");
+      return NULL;
+    }
+
+    /* one extra page so the slabs can be page-aligned */
+    origin = com_malloc_uninit(slab->alloc, (SLAB_CHUNK_PAGES + 1) * SLAB_PAGE_SIZE);
+    if (origin == NULL) {
+      s_log_error("Failed to allocate slab chunk.");
+      com_free(slab->alloc, chunk);
+      return NULL;
+    }
+
+    chunk->origin = origin;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    slab->next_page = (char *)SLAB_ALIGN((uintptr_t)origin, SLAB_PAGE_SIZE);
+    slab->pages_left = SLAB_CHUNK_PAGES;
+  }
+
+  page = (slab_head_t *)slab->next_page;
+  slab->next_page += SLAB_PAGE_SIZE;
+  slab->pages_left -= 1;
+
+  return page;
+}
+
+
+/* carves a new slab into free objects for the class -- must be called with
+   the slab allocator locked */
+static int slab_grow_class(slab_allocator_t *slab, slab_class_t *class)
+{
+  slab_head_t *page = slab_new_page(slab);
+  const size_t object_size = class->object_size;
+  char *object;
+  char *end;
+
+  if (page == NULL)
+    return -1;
+
+  page->owner = class;
+  page->origin = NULL;
+  page->size = 0;
+
+  object = (char *)page + SLAB_HEADER_SIZE;
+  end = (char *)page + SLAB_PAGE_SIZE;
+
+  /* link objects in address order so they're handed out contiguously */
+  for (; object + 2 * object_size <= end; object += object_size)
+    *(void **)object = object + object_size;
+
+  *(void **)object = class->free;
+  class->free = (char *)page + SLAB_HEADER_SIZE;
+  class->slabs += 1;
+
+  return 0;
+}
+
+
+static void *slab_malloc_large(slab_allocator_t *slab, size_t min_size)
+{
+  void *origin = com_malloc_uninit(slab->alloc, min_size + SLAB_HEADER_SIZE + SLAB_PAGE_SIZE);
+  slab_head_t *head;
+
+  if (origin == NULL) {
+    s_log_error("Failed to allocate %zu bytes for large slab object.", min_size);
+    return NULL;
+  }
+
+  head = (slab_head_t *)SLAB_ALIGN((uintptr_t)origin, SLAB_PAGE_SIZE);
+  head->owner = NULL;
+  head->origin = origin;
+  head->size = min_size;
+
+  return (char *)head + SLAB_HEADER_SIZE;
+}
+
+
+static void *al_slab_malloc(size_t min_size, void *ctx)
+{
+  slab_allocator_t *slab = (slab_allocator_t *)ctx;
+  slab_class_t *class;
+  void *p;
+
+  if (min_size > SLAB_MAX_OBJECT_SIZE)
+    return slab_malloc_large(slab, min_size);
+
+  class = &slab->classes[min_size ? (min_size - 1) / SLAB_CLASS_SIZE : 0];
+
+  mutex_lock(&slab->lock);
+
+  if (class->free == NULL && slab_grow_class(slab, class)) {
+    mutex_unlock(&slab->lock);
+    return NULL;
+  }
+
+  p = class->free;
+  class->free = *(void **)p;
+  class->used += 1;
+
+  mutex_unlock(&slab->lock);
+
+  return p;
+}
+
+
+static void *al_slab_malloc_usable(size_t min_size, size_t *usable_size, void *ctx)
+{
+  void *p = al_slab_malloc(min_size, ctx);
+
+  if (p && usable_size) {
+    const slab_head_t *head = SLAB_FOR_POINTER(p);
+    *usable_size = head->owner ? head->owner->object_size : head->size;
+  }
+
+  return p;
+}
+
+
+static void *al_slab_realloc(void *p, size_t min_size, void *ctx)
+{
+  slab_head_t *head;
+  size_t old_size;
+  void *new_p;
+
+  if (p == NULL)
+    return al_slab_malloc(min_size, ctx);
+
+  head = SLAB_FOR_POINTER(p);
+
+  old_size = head->owner ? head->owner->object_size : head->size;
+  if (min_size <= old_size)
+    return p;
+
+  new_p = al_slab_malloc(min_size, ctx);
+  if (new_p) {
+    memcpy(new_p, p, old_size);
+    al_slab_free(p, ctx);
+  }
+
+  return new_p;
+}
+
+
+static void al_slab_free(void *p, void *ctx)
+{
+  slab_allocator_t *slab = (slab_allocator_t *)ctx;
+  slab_head_t *head;
+  slab_class_t *class;
+
+  if (p == NULL)
+    return;
+
+  head = SLAB_FOR_POINTER(p);
+  class = head->owner;
+
+  if (class == NULL) {
+    com_free(slab->alloc, head->origin);
+    return;
+  }
+
+  mutex_lock(&slab->lock);
+  *(void **)p = class->free;
+  class->free = p;
+  class->used -= 1;
+  mutex_unlock(&slab->lock);
+}
+
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,117 @@
+/*
+  Slab allocator for small fixed-size objects
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__SLAB_H__
+#define __SNOW__SLAB_H__
+
+#include <snow-config.h>
+#include <threads/mutex.h>
+#include "allocator.h"
+
+/*!
+  \file
+
+  An allocator for many small objects of the same few sizes, such as list
+  nodes, map nodes, and entities. Requests are rounded up to a size class and
+  served from page-sized slabs that only hold objects of that class, so
+  objects allocated together sit next to each other in memory. Freed objects
+  go onto a free list for their size class and are reused before any new
+  slab is carved out.
+
+  Slabs are only returned to the backing allocator when the slab allocator is
+  destroyed. Requests larger than SLAB_MAX_OBJECT_SIZE get a page-aligned
+  block of their own from the backing allocator and are released on free.
+
+  Memory returned by a slab allocator is not zeroed.
+*/
+
+#ifdef __SNOW__SLAB_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/*! Size of a slab. Must be a power of two. */
+#define SLAB_PAGE_SIZE (4096)
+/*! Number of slabs allocated from the backing allocator at once. */
+#define SLAB_CHUNK_PAGES (16)
+/*! Size step between slab size classes. */
+#define SLAB_CLASS_SIZE (16)
+/*! Largest object size served from slabs. */
+#define SLAB_MAX_OBJECT_SIZE (512)
+/*! Number of slab size classes. */
+#define SLAB_CLASS_COUNT (SLAB_MAX_OBJECT_SIZE / SLAB_CLASS_SIZE)
+
+typedef struct s_slab_chunk slab_chunk_t;
+typedef struct s_slab_class slab_class_t;
+typedef struct s_slab_allocator slab_allocator_t;
+
+/*!
+ * Free list and slab count for a single object size.
+ */
+struct s_slab_class
+{
+  /*! Size of each object in the class. */
+  size_t object_size;
+  /*! Next free object, if any. Free objects are linked through their first
+      pointer-sized word. */
+  void *free;
+  /*! Number of slabs holding objects of this class. */
+  size_t slabs;
+  /*! Number of objects currently allocated. */
+  size_t used;
+};
+
+/*!
+ * Slab allocator structure. Members are read-only outside of the slab
+ * routines.
+ */
+struct s_slab_allocator
+{
+  /*! Backing allocator for slabs and large objects. */
+  allocator_t *alloc;
+  slab_class_t classes[SLAB_CLASS_COUNT];
+  /*! Chunks of slabs allocated from the backing allocator. */
+  slab_chunk_t *chunks;
+  /*! Next slab not yet handed to a size class, and how many remain in the
+      current chunk. */
+  char *next_page;
+  size_t pages_left;
+  /*! Allocator interface for the slab allocator. */
+  allocator_t allocator;
+  mutex_t lock;
+};
+
+/*!
+ * Initializes a slab allocator that takes its slabs from alloc. Returns 0 on
+ * success, -1 on failure.
+ */
+int slab_init(slab_allocator_t *slab, allocator_t *alloc);
+
+/*!
+ * Destroys a slab allocator. All objects allocated from it are released,
+ * except for large objects that were never freed.
+ */
+void slab_destroy(slab_allocator_t *slab);
+
+/*!
+ * Gets an allocator for the slab allocator. The pointer remains valid until
+ * the slab allocator is destroyed.
+ */
+allocator_t *slab_allocator(slab_allocator_t *slab);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__SLAB_H__ */
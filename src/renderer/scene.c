@@ -8,7 +8,101 @@
 extern "C" {
 #endif // __cplusplus
 
-extern entity_t *entity_new(scene_t *scene, const char *name, entity_t *parent);
+scene_t *scene_new(allocator_t *alloc)
+{
+  scene_t *scene;
+
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  scene = (scene_t *)com_malloc(alloc, sizeof(*scene));
+  if (scene == NULL) {
+    s_log_error("Failed to allocate scene.");
+    return NULL;
+  }
+
+  if (slab_init(&scene->entity_slab, alloc)) {
+    s_log_error("Failed to initialize scene entity slab.");
+    com_free(alloc, scene);
+    return NULL;
+  }
+
+  if (!slotmap_init(&scene->entity_handles, sizeof(entity_t *), 64, alloc)) {
+    s_log_error("Failed to initialize scene entity handles.");
+    slab_destroy(&scene->entity_slab);
+    com_free(alloc, scene);
+    return NULL;
+  }
+
+  scene->alloc = alloc;
+  list_init_intrusive(&scene->entities);
+  mutex_init(&scene->lock, true);
+
+  return scene;
+}
+
+void scene_destroy(scene_t *scene)
+{
+  allocator_t *alloc = scene->alloc;
+
+  scene_clear(scene);
+  list_destroy(&scene->entities);
+  slotmap_destroy(&scene->entity_handles);
+  slab_destroy(&scene->entity_slab);
+  mutex_destroy(&scene->lock);
+
+  com_free(alloc, scene);
+}
+
+void scene_clear(scene_t *scene)
+{
+  listnode_t *node;
+
+  mutex_lock(&scene->lock);
+  // destroying a root entity moves its children to the root list, so keep
+  // going until nothing's left
+  while ((node = list_first_node(&scene->entities)))
+    entity_destroy(list_container(node, entity_t, parentnode));
+  mutex_unlock(&scene->lock);
+}
+
+entity_t *scene_new_entity(scene_t *scene, const char *name, entity_t *parent)
+{
+  return entity_new(scene, name, parent, slab_allocator(&scene->entity_slab));
+}
+
+entity_t *scene_get_entity(scene_t *scene, handle_t handle)
+{
+  entity_t **entity = (entity_t **)slotmap_get(&scene->entity_handles, handle);
+  return entity ? *entity : NULL;
+}
+
+entity_t **scene_entities(scene_t *scene, size_t *count)
+{
+  if (count)
+    *count = slotmap_size(&scene->entity_handles);
+  return (entity_t **)slotmap_values(&scene->entity_handles);
+}
+
+entity_t *scene_find_entity(scene_t *scene, const char *name)
+{
+  // names are atoms, so no entity can have a name that was never interned
+  atom_t atom = atom_find(name);
+  entity_t **entities;
+  size_t count;
+  size_t index;
+
+  if (atom == NULL)
+    return NULL;
+
+  entities = scene_entities(scene, &count);
+  for (index = 0; index < count; ++index) {
+    if (entities[index]->name == atom)
+      return entities[index];
+  }
+
+  return NULL;
+}
 
 #ifdef __cplusplus
 }
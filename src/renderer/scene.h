@@ -4,7 +4,9 @@
 
 #include <snow-config.h>
 #include <memory/allocator.h>
+#include <memory/slab.h>
 #include <structs/list.h>
+#include <structs/slotmap.h>
 #include <threads/mutex.h>
 
 #ifdef __SNOW__SCENE_C__
@@ -23,8 +25,13 @@ typedef struct s_scene {
   // the active camera object
   // struct s_camera *camera;
   // a list of all entities to be updated (searched recursively) -- includes
-  // cameras
+  // cameras. intrusive, linked through entity_t::parentnode
   list_t entities;
+  // entities for the scene are allocated from this
+  slab_allocator_t entity_slab;
+  // handles for every entity in the scene, hierarchy and all -- the values
+  // are entity_t pointers, packed for iteration
+  slotmap_t entity_handles;
 
   mutex_t lock;
 } scene_t;
@@ -55,6 +62,13 @@ void scene_update(scene_t *scene);
 void scene_draw(scene_t *scene);
 
 struct s_entity *scene_new_entity(scene_t *scene, const char *name, struct s_entity *parent);
+// Returns the entity with the given handle, or NULL if it's been destroyed
+struct s_entity *scene_get_entity(scene_t *scene, handle_t handle);
+// Returns the number of entities in the scene and a pointer to a packed array
+// of them. The array is invalidated by creating or destroying an entity.
+struct s_entity **scene_entities(scene_t *scene, size_t *count);
+// Returns the first entity with the given name, or NULL if there is none
+struct s_entity *scene_find_entity(scene_t *scene, const char *name);
 /*
 // FIXME: Camera not implemented, uncomment when it is.
 struct s_camera *scene_new_camera(scene_t *scene, const char *name, struct s_entity *parent);
@@ -3,6 +3,9 @@
 #include "serialize.h"
 
 #include <buffer/buffer_stream.h>
+#include <stream/lz.h>
+#include <structs/array_sort.h>
+#include <threads/thread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,20 +18,87 @@ extern "C" {
 #define SZ_HEADER_SIZE (9)
 // The size of an array chunk
 #define SZ_ARRAY_SIZE (SZ_HEADER_SIZE + 5)
+// Bytes of a compound's buffer kept in the same block as the buffer itself
+#define SZ_COMPOUND_INLINE_SIZE (128)
+// Rounds an offset up to SZ_ALIGNMENT
+#define SZ_ALIGN_UP(OFF) (((OFF) + (SZ_ALIGNMENT - 1)) & ~(uint32_t)(SZ_ALIGNMENT - 1))
+// Arrays are stored little-endian, so multibyte elements can only be used in
+// place on little-endian hosts
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SZ_ARRAYS_IN_PLACE (0)
+#else
+#define SZ_ARRAYS_IN_PLACE (1)
+#endif
+// Set in the refs other threads hand back for compounds they wrote
+// themselves, which don't have their final indices until they're merged
+#define SZ_LOCAL_REF (0x80000000U)
+// Shorter lists of compounds are always written on the calling thread
+#define SZ_PARALLEL_MIN_COMPOUNDS (64)
+// Compounds written on other threads are held in memory until their whole
+// batch is done, so lists are handed out this many at a time
+#define SZ_PARALLEL_BATCH_SIZE (4096)
 
 
 typedef struct {
-  // the position of the item in the file
-  off_t position;
+  // where the compound's chunks are in the file
+  sz_scope_t scope;
   // NULL if not yet unpacked
   void *value;
 } sz_unpacked_compound_t;
 
 typedef struct {
+  // NULL once the compound has been written to the output stream
   buffer_t *buffer;
   stream_t *stream;
+  // offset of the compound from the root, set when it's written
+  uint32_t offset;
+  // the pointer the compound was written for
+  void *ptr;
+  // on other threads: the compound's index in the parent context, or 0 if
+  // it hasn't been merged yet
+  uint32_t final_index;
+  // on other threads: the first and last of the compound's fixups, plus one
+  uint32_t first_fixup;
+  uint32_t last_fixup;
 } sz_buffer_stream_t;
 
+// A ref written on another thread to a compound that thread wrote, filled in
+// with the compound's final index when the ref's owner is merged
+typedef struct {
+  // where the index is in the owner's buffer
+  uint32_t offset;
+  // the index of the compound referred to on the thread that wrote it
+  uint32_t target;
+  // the owner's next fixup, plus one, or 0
+  uint32_t next;
+} sz_fixup_t;
+
+// A run of a list of compounds written on several threads
+typedef struct {
+  void **items;
+  size_t count;
+  // the next item to be taken by a thread
+  size_t next;
+  sz_compound_writer_t *writer;
+  void *writer_ctx;
+  // for each item, the ref written for it and the thread that wrote it
+  uint32_t *refs;
+  uint8_t *owners;
+} sz_batch_t;
+
+typedef struct {
+  sz_context_t ctx;
+  sz_batch_t *batch;
+  uint8_t id;
+} sz_worker_t;
+
+// A compound's buffer and the inline storage it writes into until the
+// compound outgrows it. Allocated as one block, freed through the buffer.
+typedef struct {
+  buffer_t buffer;
+  char storage[SZ_COMPOUND_INLINE_SIZE];
+} sz_compound_buffer_t;
+
 
 static const char *sz_errstr_null_context = "Null serializer context.";
 static const char *sz_errstr_invalid_root = "Invalid magic number for root.";
@@ -45,6 +115,10 @@ static const char *sz_errstr_already_open = "Cannot set stream for open serializ
 static const char *sz_errstr_null_stream = "Stream is NULL.";
 static const char *sz_errstr_empty_array = "Array is empty.";
 static const char *sz_errstr_nomem = "Allocation failed.";
+static const char *sz_errstr_bad_padding = "Invalid padding chunk.";
+static const char *sz_errstr_bad_compressed = "Invalid compressed chunk.";
+
+static const char sz_zeros[SZ_ALIGNMENT] = { 0 };
 
 
 // static prototypes
@@ -52,8 +126,22 @@ static const char *sz_errstr_nomem = "Allocation failed.";
 static sz_response_t sz_file_error(sz_context_t *ctx);
 // writes the file root
 static sz_response_t sz_write_root(sz_context_t *ctx, sz_root_t root);
+// writes bytes to the output stream, advancing write_offset
+static sz_response_t sz_emit(sz_context_t *ctx, const void *data, size_t size);
+// writes a buffer to the output stream at the next aligned offset
+static sz_response_t sz_emit_buffer(sz_context_t *ctx, buffer_t *buffer, uint32_t *offset);
+// writes a finished compound to the output stream and releases its buffer
+static void sz_finish_compound(sz_context_t *ctx, uint32_t idx);
 // reads the file root
 static sz_response_t sz_read_root(sz_context_t *ctx, sz_root_t *root);
+// reads the header at the current position, skipping padding
+static sz_response_t sz_read_next_header(sz_context_t *ctx, sz_header_t *header);
+// returns the position of the named chunk in the current scope, or -1
+static off_t sz_find_chunk(sz_context_t *ctx, uint32_t name);
+// indexes the chunks in a scope by name
+static void sz_index_scope(sz_context_t *ctx, sz_scope_t *scope);
+// finds where each compound and the top-level data end
+static sz_response_t sz_set_scope_ends(sz_context_t *ctx, const sz_root_t *root, off_t root_pos);
 // reads a simple chunk header
 static sz_response_t sz_read_header(sz_context_t *ctx, sz_header_t *header, uint32_t name, uint8_t kind, bool null_allowed);
 // reads an array header
@@ -64,11 +152,36 @@ static sz_response_t sz_read_array_body(sz_context_t *ctx, const sz_array_t *chu
 static uint32_t sz_new_compound(sz_context_t *ctx, void *p);
 // stores a compound for writing later
 static uint32_t sz_store_compound(sz_context_t *ctx, void *p, sz_compound_writer_t writer, void *writer_ctx);
+// writes a ref to a compound, noting it down to fix up later if needed
+static sz_response_t sz_write_compound_index(sz_context_t *ctx, uint32_t idx);
+// releases the buffers of compounds not written to the output stream
+static void sz_free_compound_buffers(sz_context_t *ctx);
+// sets up a context to write compounds on another thread
+static void sz_worker_begin(sz_context_t *worker, sz_context_t *parent);
+// drops everything a worker has written, ready for the next batch
+static void sz_worker_reset(sz_context_t *worker);
+// writes items from a batch until there are none left
+static void *sz_write_batch(void *context);
+// gives a compound written on another thread its final index and writes it
+static uint32_t sz_merge_compound(sz_context_t *ctx, sz_context_t *worker, uint32_t ref);
+// writes the refs of a list of compounds, writing the compounds on threads
+static sz_response_t sz_write_compounds_parallel(sz_context_t *ctx, void **p, size_t length, sz_compound_writer_t writer, void *writer_ctx);
 // push/pop stack for reader/writer
 static void sz_push_stack(sz_context_t *ctx);
 static void sz_pop_stack(sz_context_t *ctx);
 // writes a null pointer chunk
 static sz_response_t sz_write_null_pointer(sz_context_t *ctx, uint32_t name);
+// writes a padding chunk if needed to align a payload following a header
+static sz_response_t sz_write_padding(sz_context_t *ctx, size_t header_size, size_t alignment);
+// returns a pointer to size bytes at the current position in memory, or NULL
+static const void *sz_memory_ref(sz_context_t *ctx, size_t size, size_t element_size);
+// converts array elements between little-endian and the host's byte order
+static void sz_swap_elements(void *data, size_t count, size_t element_size);
+// writes a little-endian payload as a compressed chunk if that's enabled and
+// saves space
+static sz_response_t sz_write_compressed(sz_context_t *ctx, const sz_array_t *array, uint32_t name, const void *payload, size_t size, bool *written);
+// reads and decompresses a compressed payload of block_size bytes
+static sz_response_t sz_read_compressed(sz_context_t *ctx, size_t block_size, void **out, size_t *size, allocator_t *alloc);
 // reads a single primitive
 static sz_response_t sz_read_primitive(sz_context_t *ctx, uint8_t chunktype, uint32_t name, void *out, size_t typesize);
 // writes a single primitive
@@ -107,7 +220,8 @@ sz_write_header(sz_context_t *ctx, sz_header_t header)
 static sz_response_t
 sz_file_error(sz_context_t *ctx)
 {
-  if (stream_eof(ctx->stream)) {
+  // contexts writing on other threads have no stream
+  if (ctx->stream && stream_eof(ctx->stream)) {
     ctx->error = sz_errstr_eof;
     return SZ_ERROR_EOF;
   } else {
@@ -138,6 +252,56 @@ sz_write_root(sz_context_t *ctx, sz_root_t root)
 }
 
 
+static sz_response_t
+sz_emit(sz_context_t *ctx, const void *data, size_t size)
+{
+  if (size && stream_write(data, size, ctx->stream) != size)
+    return sz_file_error(ctx);
+
+  ctx->write_offset += (uint32_t)size;
+
+  return SZ_SUCCESS;
+}
+
+
+static sz_response_t
+sz_emit_buffer(sz_context_t *ctx, buffer_t *buffer, uint32_t *offset)
+{
+  sz_response_t response;
+  uint32_t pad = SZ_ALIGN_UP(ctx->write_offset) - ctx->write_offset;
+
+  response = sz_emit(ctx, sz_zeros, pad);
+  if (response != SZ_SUCCESS)
+    return response;
+
+  *offset = ctx->write_offset;
+
+  return sz_emit(ctx, buffer_pointer(buffer), buffer_size(buffer));
+}
+
+
+static void
+sz_finish_compound(sz_context_t *ctx, uint32_t idx)
+{
+  sz_response_t response;
+  sz_buffer_stream_t *bs = array_at_index(&ctx->compounds, idx - 1);
+
+  response = sz_emit_buffer(ctx, bs->buffer, &bs->offset);
+
+  // closing the stream destroys the buffer's storage, not the block the
+  // buffer itself lives in
+  stream_close(bs->stream);
+  com_free(ctx->alloc, bs->buffer);
+  bs->stream = NULL;
+  bs->buffer = NULL;
+
+  // compound writers can't return errors, so hold on to the first one for
+  // sz_close
+  if (response != SZ_SUCCESS && ctx->write_error == SZ_SUCCESS)
+    ctx->write_error = response;
+}
+
+
 static sz_response_t
 sz_read_root(sz_context_t *ctx, sz_root_t *root)
 {
@@ -152,8 +316,8 @@ sz_read_root(sz_context_t *ctx, sz_root_t *root)
       || stream_read_uint32(stream, &res.data_offset))
     return sz_file_error(ctx);
 
-  // TODO: if the serializer gets new versions, make sure to test for compat
-  if (res.magic != SZ_MAGIC) {
+  // version 1 is version 2 without padding chunks, so both read the same way
+  if (res.magic != SZ_MAGIC && res.magic != SZ_MAGIC_V1) {
     ctx->error = sz_errstr_invalid_root;
     return SZ_INVALID_ROOT;
   }
@@ -165,24 +329,127 @@ sz_read_root(sz_context_t *ctx, sz_root_t *root)
 
 
 static sz_response_t
-sz_read_header(sz_context_t *ctx, sz_header_t *header, uint32_t name, uint8_t kind, bool null_allowed)
+sz_read_next_header(sz_context_t *ctx, sz_header_t *header)
 {
   sz_header_t res;
   stream_t *stream = ctx->stream;
 
-  if (   stream_read_uint8(stream, &res.kind)
-      || stream_read_uint32(stream, &res.name)
-      || stream_read_uint32(stream, &res.size)) {
+  do {
+    if (   stream_read_uint8(stream, &res.kind)
+        || stream_read_uint32(stream, &res.name)
+        || stream_read_uint32(stream, &res.size)) {
 
-    return sz_file_error(ctx);
+      return sz_file_error(ctx);
+
+    }
+
+    if (res.kind == SZ_PADDING_CHUNK) {
+      if (res.size < SZ_HEADER_SIZE) {
+        ctx->error = sz_errstr_bad_padding;
+        return SZ_ERROR_INVALID_STREAM;
+      }
+
+      if (stream_seek(stream, (off_t)(res.size - SZ_HEADER_SIZE), SEEK_CUR) == -1)
+        return sz_file_error(ctx);
+    }
+  } while (res.kind == SZ_PADDING_CHUNK);
+
+  *header = res;
+
+  return SZ_SUCCESS;
+}
+
+
+static void
+sz_index_scope(sz_context_t *ctx, sz_scope_t *scope)
+{
+  stream_t *stream = ctx->stream;
+  off_t resume = stream_tell(stream);
+  off_t pos = scope->start;
+  sz_header_t header;
+
+  hashmap_init(&scope->index, g_mapops_default, NULL, ctx->alloc);
+  scope->indexed = true;
+
+  // a compound's trailing alignment is shorter than a header, so it ends the
+  // loop. A malformed chunk ends it too, leaving later chunks unindexed.
+  while (pos + SZ_HEADER_SIZE <= scope->end) {
+    mapkey_t key;
+
+    if (   stream_seek(stream, pos, SEEK_SET) == -1
+        || stream_read_uint8(stream, &header.kind)
+        || stream_read_uint32(stream, &header.name)
+        || stream_read_uint32(stream, &header.size)
+        || header.size < SZ_HEADER_SIZE)
+      break;
+
+    key = (mapkey_t)(uintptr_t)header.name;
+    if (header.kind != SZ_PADDING_CHUNK && hashmap_get(&scope->index, key) == NULL)
+      hashmap_insert(&scope->index, key, (void *)(uintptr_t)(pos - scope->start + 1));
+
+    pos += (off_t)header.size;
+  }
+
+  stream_seek(stream, resume, SEEK_SET);
+}
+
+
+static off_t
+sz_find_chunk(sz_context_t *ctx, uint32_t name)
+{
+  sz_scope_t *scope = ctx->scope;
+  uintptr_t offset;
+
+  if (scope == NULL)
+    return -1;
+
+  if (!scope->indexed)
+    sz_index_scope(ctx, scope);
+
+  offset = (uintptr_t)hashmap_get(&scope->index, (mapkey_t)(uintptr_t)name);
+
+  return offset ? scope->start + (off_t)(offset - 1) : -1;
+}
+
+
+static sz_response_t
+sz_read_header(sz_context_t *ctx, sz_header_t *header, uint32_t name, uint8_t kind, bool null_allowed)
+{
+  sz_header_t res;
+  sz_response_t response = SZ_SUCCESS;
+  off_t pos = stream_tell(ctx->stream);
+  // at the end of a compound, the next header belongs to something else
+  bool in_scope = ctx->scope == NULL || pos + SZ_HEADER_SIZE <= ctx->scope->end;
+
+  if (in_scope)
+    response = sz_read_next_header(ctx, &res);
+
+  // not next, so look it up
+  if (!in_scope || (response == SZ_SUCCESS && res.name != name)) {
+    off_t found = sz_find_chunk(ctx, name);
+
+    if (found != -1) {
+      if (stream_seek(ctx->stream, found, SEEK_SET) == -1)
+        return sz_file_error(ctx);
 
+      response = sz_read_next_header(ctx, &res);
+    } else if (!in_scope) {
+      ctx->error = sz_errstr_bad_name;
+      return SZ_ERROR_BAD_NAME;
+    }
   }
 
+  if (response != SZ_SUCCESS)
+    return response;
+
   if (header)
     *header = res;
 
-  if (  (res.kind == SZ_NULL_POINTER_CHUNK && !null_allowed)
-      || res.kind != kind) {
+  // only bytes and array chunks are ever compressed
+  if (kind == SZ_BYTES_CHUNK || kind == SZ_ARRAY_CHUNK)
+    res.kind &= ~SZ_COMPRESSED_FLAG;
+
+  if (res.kind != kind && !(null_allowed && res.kind == SZ_NULL_POINTER_CHUNK)) {
 
     ctx->error = sz_errstr_wrong_kind;
     return SZ_ERROR_WRONG_KIND;
@@ -209,14 +476,26 @@ sz_read_array_header(sz_context_t *ctx, sz_array_t *chunk, uint32_t name, uint8_
   if (response != SZ_SUCCESS)
     return response;
 
-  if (   stream_read_uint32(stream, &res.length)
-      || stream_read_uint8(stream, &res.type))
+  // a null pointer chunk is just the header
+  if (res.header.kind == SZ_NULL_POINTER_CHUNK) {
+    res.length = 0;
+    res.type = type;
+  } else if (   stream_read_uint32(stream, &res.length)
+             || stream_read_uint8(stream, &res.type)) {
     return sz_file_error(ctx);
+  }
 
   if (chunk)
     *chunk = res;
 
-  return (res.type == type) ? SZ_SUCCESS : SZ_ERROR_WRONG_KIND;
+  // compound references are read one at a time, so they're never compressed
+  if (res.type != type ||
+      (type == SZ_COMPOUND_REF_CHUNK && (res.header.kind & SZ_COMPRESSED_FLAG))) {
+    ctx->error = sz_errstr_wrong_kind;
+    return SZ_ERROR_WRONG_KIND;
+  }
+
+  return SZ_SUCCESS;
 }
 
 
@@ -255,25 +534,52 @@ sz_read_array_body(sz_context_t *ctx, const sz_array_t *chunk, void **buf_out, s
 
   end_of_block += block_remainder;
 
-  if (buf_out) {
+  if (buf_out && (chunk->header.kind & SZ_COMPRESSED_FLAG)) {
+    size_t raw_size;
+    sz_response_t response = sz_read_compressed(ctx, block_remainder, &buffer, &raw_size, alloc);
+
+    if (response != SZ_SUCCESS)
+      return response;
+
+    element_size = raw_size / arr_length;
+    if (raw_size % arr_length != 0) {
+      com_free(alloc, buffer);
+      ctx->error = sz_errstr_bad_compressed;
+      return SZ_ERROR_INVALID_STREAM;
+    }
+
+    if (!SZ_ARRAYS_IN_PLACE)
+      sz_swap_elements(buffer, arr_length, element_size);
+
+    *buf_out = buffer;
+  } else if (buf_out) {
     char *read_into;
     size_t index = 0;
 
-    read_into = buffer = com_malloc(alloc, block_remainder);
+    /* every byte is read into below, so skip zeroing it */
+    read_into = buffer = com_malloc_uninit(alloc, block_remainder);
+    if (buffer == NULL) {
+      stream_seek(ctx->stream, end_of_block, SEEK_SET);
+      ctx->error = sz_errstr_nomem;
+      return SZ_ERROR_OUT_OF_MEMORY;
+    }
 
     switch (element_size) {
       case 2:
         for (; index < arr_length; ++index, read_into += element_size)
           if (stream_read_uint16(stream, (uint16_t *)read_into))
             goto array_body_read_error;
+        break;
       case 4:
         for (; index < arr_length; ++index, read_into += element_size)
           if (stream_read_uint32(stream, (uint32_t *)read_into))
             goto array_body_read_error;
+        break;
       case 8:
         for (; index < arr_length; ++index, read_into += element_size)
           if (stream_read_uint64(stream, (uint64_t *)read_into))
             goto array_body_read_error;
+        break;
       default:
         if (stream_read(buffer, block_remainder, ctx->stream) != block_remainder)
           goto array_body_read_error;
@@ -304,17 +610,22 @@ sz_new_compound(sz_context_t *ctx, void *p)
 {
   uint32_t idx;
   sz_buffer_stream_t bs;
-  buffer_t *buffer;
-
-  buffer = com_malloc(ctx->alloc, sizeof(*buffer));
-  buffer_init(buffer, 32, ctx->alloc);
-  bs.buffer = buffer;
-  bs.stream = buffer_stream(buffer, STREAM_WRITE, true);
+  sz_compound_buffer_t *compound;
+
+  compound = com_malloc_uninit(ctx->alloc, sizeof(*compound));
+  buffer_init_inline(&compound->buffer, compound->storage, sizeof(compound->storage), ctx->alloc);
+  bs.buffer = &compound->buffer;
+  bs.stream = buffer_stream(bs.buffer, STREAM_WRITE, true);
+  bs.offset = 0;
+  bs.ptr = p;
+  bs.final_index = 0;
+  bs.first_fixup = 0;
+  bs.last_fixup = 0;
 
   array_push(&ctx->compounds, &bs);
 
   idx = (uint32_t)array_size(&ctx->compounds);
-  map_insert(&ctx->compound_ptrs, p, (void *)idx);
+  hashmap_insert(&ctx->compound_ptrs, p, (void *)(uintptr_t)idx);
 
   return idx;
 }
@@ -382,6 +693,219 @@ sz_write_null_pointer(sz_context_t *ctx, uint32_t name)
 }
 
 
+static sz_response_t
+sz_write_padding(sz_context_t *ctx, size_t header_size, size_t alignment)
+{
+  off_t pos;
+  size_t pad;
+  sz_header_t chunk = {
+    .kind = SZ_PADDING_CHUNK,
+    .name = 0,
+    .size = 0
+  };
+
+  if (alignment <= 1)
+    return SZ_SUCCESS;
+
+  pos = stream_tell(ctx->active);
+  if (pos == -1)
+    return sz_file_error(ctx);
+
+  if (((size_t)pos + header_size) % alignment == 0)
+    return SZ_SUCCESS;
+
+  // the padding chunk needs at least its own header, so pad past that to the
+  // next aligned spot
+  pad = SZ_HEADER_SIZE;
+  pad += (alignment - ((size_t)pos + pad + header_size) % alignment) % alignment;
+  chunk.size = (uint32_t)pad;
+
+  if (sz_write_header(ctx, chunk) != SZ_SUCCESS)
+    return sz_file_error(ctx);
+
+  pad -= SZ_HEADER_SIZE;
+  if (pad && stream_write(sz_zeros, pad, ctx->active) != pad)
+    return sz_file_error(ctx);
+
+  return SZ_SUCCESS;
+}
+
+
+static const void *
+sz_memory_ref(sz_context_t *ctx, size_t size, size_t element_size)
+{
+  const char *ref;
+  off_t pos;
+
+  if (ctx->memory == NULL || (element_size > 1 && !SZ_ARRAYS_IN_PLACE))
+    return NULL;
+
+  pos = stream_tell(ctx->stream);
+  if (pos < 0 || (size_t)pos > ctx->memory_size || ctx->memory_size - (size_t)pos < size)
+    return NULL;
+
+  ref = ctx->memory + pos;
+  if (element_size > 1 && ((uintptr_t)ref % element_size) != 0)
+    return NULL;
+
+  stream_seek(ctx->stream, (off_t)size, SEEK_CUR);
+
+  return ref;
+}
+
+
+static void
+sz_swap_elements(void *data, size_t count, size_t element_size)
+{
+  size_t index;
+
+  switch (element_size) {
+    case 2: {
+      uint16_t *elements = (uint16_t *)data;
+      for (index = 0; index < count; ++index)
+        elements[index] = (uint16_t)PHYSFS_swapULE16((PHYSFS_uint16)elements[index]);
+    } break;
+    case 4: {
+      uint32_t *elements = (uint32_t *)data;
+      for (index = 0; index < count; ++index)
+        elements[index] = (uint32_t)PHYSFS_swapULE32((PHYSFS_uint32)elements[index]);
+    } break;
+    case 8: {
+      uint64_t *elements = (uint64_t *)data;
+      for (index = 0; index < count; ++index)
+        elements[index] = (uint64_t)PHYSFS_swapULE64((PHYSFS_uint64)elements[index]);
+    } break;
+    default: break;
+  }
+}
+
+
+static sz_response_t
+sz_write_compressed(sz_context_t *ctx, const sz_array_t *array, uint32_t name,
+                    const void *payload, size_t size, bool *written)
+{
+  sz_response_t response = SZ_SUCCESS;
+  stream_t *stream = ctx->active;
+  const size_t prefix = array ? SZ_ARRAY_SIZE : SZ_HEADER_SIZE;
+  size_t capacity;
+  size_t packed_size;
+  char *packed;
+  sz_header_t header;
+
+  *written = false;
+
+  if (!ctx->compress || size < SZ_COMPRESS_MIN_SIZE || size > LZ_MAX_INPUT_SIZE)
+    return SZ_SUCCESS;
+
+  // anything that doesn't save more than the uncompressed size costs is
+  // written as is
+  capacity = size - sizeof(uint32_t) - 1;
+  packed = (char *)com_malloc_uninit(ctx->alloc, capacity);
+  if (packed == NULL)
+    return SZ_SUCCESS;
+
+  packed_size = lz_compress(payload, size, packed, capacity);
+  if (packed_size == 0)
+    goto sz_write_compressed_done;
+
+  header.kind = (array ? SZ_ARRAY_CHUNK : SZ_BYTES_CHUNK) | SZ_COMPRESSED_FLAG;
+  header.name = name;
+  header.size = (uint32_t)(prefix + sizeof(uint32_t) + packed_size);
+
+  *written = true;
+
+  response = sz_write_header(ctx, header);
+  if (response != SZ_SUCCESS)
+    goto sz_write_compressed_done;
+
+  if (array && (   stream_write_uint32(stream, array->length)
+                || stream_write_uint8(stream, array->type))) {
+    response = sz_file_error(ctx);
+    goto sz_write_compressed_done;
+  }
+
+  if (   stream_write_uint32(stream, (uint32_t)size)
+      || stream_write(packed, packed_size, stream) != packed_size)
+    response = sz_file_error(ctx);
+
+sz_write_compressed_done:
+  com_free(ctx->alloc, packed);
+  return response;
+}
+
+
+static sz_response_t
+sz_read_compressed(sz_context_t *ctx, size_t block_size, void **out, size_t *size, allocator_t *alloc)
+{
+  stream_t *stream = ctx->stream;
+  uint32_t raw_size;
+  size_t packed_size;
+  const void *packed;
+  void *scratch = NULL;
+  void *buffer;
+
+  if (block_size < sizeof(uint32_t) || block_size > UINT32_MAX) {
+    ctx->error = sz_errstr_bad_compressed;
+    return SZ_ERROR_INVALID_STREAM;
+  }
+
+  if (stream_read_uint32(stream, &raw_size))
+    return sz_file_error(ctx);
+
+  packed_size = block_size - sizeof(uint32_t);
+
+  // nothing decompresses to more than about 255 times its size
+  if (raw_size == 0 || raw_size / 255 > packed_size) {
+    ctx->error = sz_errstr_bad_compressed;
+    return SZ_ERROR_INVALID_STREAM;
+  }
+
+  if (size)
+    *size = (size_t)raw_size;
+
+  if (out == NULL) {
+    if (stream_seek(stream, (off_t)packed_size, SEEK_CUR) == -1)
+      return sz_file_error(ctx);
+    return SZ_SUCCESS;
+  }
+
+  // compressed data in memory is decompressed straight out of it
+  packed = sz_memory_ref(ctx, packed_size, 1);
+  if (packed == NULL) {
+    packed = scratch = com_malloc_uninit(ctx->alloc, packed_size);
+
+    if (scratch == NULL) {
+      ctx->error = sz_errstr_nomem;
+      return SZ_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (stream_read(scratch, packed_size, stream) != packed_size) {
+      com_free(ctx->alloc, scratch);
+      return sz_file_error(ctx);
+    }
+  }
+
+  buffer = com_malloc_uninit(alloc, raw_size);
+  if (buffer == NULL) {
+    ctx->error = sz_errstr_nomem;
+  } else if (lz_decompress(packed, packed_size, buffer, raw_size) != raw_size) {
+    com_free(alloc, buffer);
+    buffer = NULL;
+    ctx->error = sz_errstr_bad_compressed;
+  }
+
+  if (scratch)
+    com_free(ctx->alloc, scratch);
+
+  if (buffer == NULL)
+    return (ctx->error == sz_errstr_nomem) ? SZ_ERROR_OUT_OF_MEMORY : SZ_ERROR_INVALID_STREAM;
+
+  *out = buffer;
+
+  return SZ_SUCCESS;
+}
+
+
 static sz_response_t
 sz_read_primitive(sz_context_t *ctx,
                   uint8_t chunktype, uint32_t name,
@@ -398,8 +922,10 @@ sz_read_primitive(sz_context_t *ctx,
   pos = stream_tell(ctx->stream);
 
   response = sz_read_header(ctx, &chunk, name, chunktype, false);
-  if (response != SZ_SUCCESS)
-    goto sz_read_primitive_error;
+  if (response != SZ_SUCCESS) {
+    stream_seek(ctx->stream, pos, SEEK_SET);
+    return response;
+  }
 
   switch(typesize) {
     case 2:
@@ -515,6 +1041,35 @@ sz_write_primitive_array(sz_context_t *ctx,
 
   stream = ctx->active;
 
+  if (ctx->compress && data_size >= SZ_COMPRESS_MIN_SIZE) {
+    const void *payload = values;
+    void *swapped = NULL;
+    bool written = false;
+
+    // the payload is compressed as it would be stored, little-endian
+    if (!SZ_ARRAYS_IN_PLACE && element_size > 1) {
+      payload = swapped = com_malloc_uninit(ctx->alloc, data_size);
+      if (swapped) {
+        memcpy(swapped, values, data_size);
+        sz_swap_elements(swapped, length, element_size);
+      }
+    }
+
+    if (payload)
+      response = sz_write_compressed(ctx, &chunk, name, payload, data_size, &written);
+
+    if (swapped)
+      com_free(ctx->alloc, swapped);
+
+    if (written)
+      return response;
+  }
+
+  // align the payload so readers of memory can use it in place
+  response = sz_write_padding(ctx, SZ_ARRAY_SIZE, element_size);
+  if (response != SZ_SUCCESS)
+    return response;
+
   // write each to deal with possible alignment/packing issues
   response = sz_write_header(ctx, chunk.header);
   if (response != SZ_SUCCESS)
@@ -580,6 +1135,57 @@ sz_read_primitive_array_error:
 }
 
 
+static sz_response_t
+sz_read_primitive_array_ref(sz_context_t *ctx,
+                            uint8_t chunktype, uint32_t name,
+                            const void **out, size_t *length)
+{
+  sz_response_t response;
+  sz_array_t chunk;
+  off_t pos;
+  size_t block_size;
+  const void *ref;
+  void *copy = NULL;
+
+  response = sz_check_context(ctx, SZ_READER);
+  if (response != SZ_SUCCESS) return response;
+
+  pos = stream_tell(ctx->stream);
+
+  response = sz_read_array_header(ctx, &chunk, name, chunktype);
+  if (response != SZ_SUCCESS)
+    goto sz_read_primitive_array_ref_error;
+
+  block_size = (size_t)chunk.header.size - SZ_ARRAY_SIZE;
+
+  if (chunk.header.kind == SZ_ARRAY_CHUNK && chunk.length != 0 &&
+      (ref = sz_memory_ref(ctx, block_size, block_size / chunk.length))) {
+    if (out) *out = ref;
+    if (length) *length = (size_t)chunk.length;
+    return SZ_SUCCESS;
+  }
+
+  response = sz_read_array_body(ctx, &chunk, &copy, length, ctx->alloc);
+  if (response != SZ_SUCCESS)
+    goto sz_read_primitive_array_ref_error;
+
+  if (copy && !array_push(&ctx->ref_copies, &copy)) {
+    com_free(ctx->alloc, copy);
+    ctx->error = sz_errstr_nomem;
+    response = SZ_ERROR_OUT_OF_MEMORY;
+    goto sz_read_primitive_array_ref_error;
+  }
+
+  if (out) *out = copy;
+
+  return SZ_SUCCESS;
+
+sz_read_primitive_array_ref_error:
+  stream_seek(ctx->stream, pos, SEEK_SET);
+  return response;
+}
+
+
 sz_context_t *
 sz_init_context(sz_context_t *ctx, sz_mode_t mode, allocator_t *alloc)
 {
@@ -593,6 +1199,9 @@ sz_init_context(sz_context_t *ctx, sz_mode_t mode, allocator_t *alloc)
     ctx->error = "";
     ctx->mode = mode;
     ctx->open = 0;
+    ctx->threads = 1;
+
+    array_init(&ctx->ref_copies, sizeof(void *), 0, alloc);
   }
 
   return ctx;
@@ -613,6 +1222,18 @@ sz_destroy_context(sz_context_t *ctx)
     }
   }
 
+  if (ctx->mode == SZ_READER) {
+    size_t index;
+    void **copies = array_buffer(&ctx->ref_copies, NULL);
+
+    for (index = 0; index < array_size(&ctx->ref_copies); ++index)
+      com_free(ctx->alloc, copies[index]);
+
+    if (ctx->memory)
+      stream_close(ctx->buffer_stream);
+  }
+
+  array_destroy(&ctx->ref_copies);
   memset(ctx, 0, sizeof(*ctx));
 
   return res;
@@ -621,31 +1242,124 @@ sz_destroy_context(sz_context_t *ctx)
 
 static sz_response_t sz_destroy_reader(sz_context_t *ctx)
 {
-  array_destroy(&ctx->compounds);
+  size_t index;
+  sz_unpacked_compound_t *packs = array_buffer(&ctx->compounds, NULL);
+
+  for (index = 0; index < array_size(&ctx->compounds); ++index) {
+    if (packs[index].scope.indexed)
+      hashmap_destroy(&packs[index].scope.index);
+  }
+
+  if (ctx->data_scope.indexed)
+    hashmap_destroy(&ctx->data_scope.index);
+
+  memset(&ctx->data_scope, 0, sizeof(ctx->data_scope));
+  ctx->scope = NULL;
+
+  array_destroy(&ctx->compounds);
   array_destroy(&ctx->stack);
 
   return SZ_SUCCESS;
 }
 
 
-static sz_response_t sz_destroy_writer(sz_context_t *ctx)
+static void
+sz_free_compound_buffers(sz_context_t *ctx)
 {
   size_t index, len;
   allocator_t *alloc = ctx->alloc;
   sz_buffer_stream_t *buffers = array_buffer(&ctx->compounds, NULL);
 
-  map_destroy(&ctx->compound_ptrs);
+  len = array_size(&ctx->compounds);
+
+  for (index = 0; index < len; ++index) {
+    if (buffers[index].buffer) {
+      stream_close(buffers[index].stream);
+      com_free(alloc, buffers[index].buffer);
+      buffers[index].stream = NULL;
+      buffers[index].buffer = NULL;
+    }
+  }
+}
+
+
+static sz_response_t sz_destroy_writer(sz_context_t *ctx)
+{
+  // compounds still open if the writer is destroyed without closing, or all
+  // of a worker's compounds
+  sz_free_compound_buffers(ctx);
+
+  hashmap_destroy(&ctx->compound_ptrs);
   array_destroy(&ctx->compounds);
   array_destroy(&ctx->stack);
-  stream_close(ctx->buffer_stream);
+  array_destroy(&ctx->fixups);
+  if (ctx->buffer_stream)
+    stream_close(ctx->buffer_stream);
 
-  len = array_size(&ctx->compounds);
+  return SZ_SUCCESS;
+}
 
-  for (index = 0; index < len; ++index) {
-    stream_close(buffers[index].stream);
-    com_free(alloc, buffers[index].buffer);
+
+static int
+sz_compare_offsets(const void *left, const void *right)
+{
+  const uint32_t l = *(const uint32_t *)left;
+  const uint32_t r = *(const uint32_t *)right;
+  return (l > r) - (l < r);
+}
+
+
+static off_t
+sz_scope_end(const array_t *bounds, off_t root_pos, off_t start)
+{
+  // bounds always holds the root's size, so there's a next bound unless the
+  // file is malformed
+  const uint32_t offset = (uint32_t)(start - root_pos);
+  const size_t index = array_upper_bound(bounds, &offset, sz_compare_offsets);
+
+  if (index == array_size(bounds))
+    return start;
+
+  return root_pos + (off_t)((const uint32_t *)array_buffer((array_t *)bounds, NULL))[index];
+}
+
+
+static sz_response_t
+sz_set_scope_ends(sz_context_t *ctx, const sz_root_t *root, off_t root_pos)
+{
+  // each compound, and the data, ends where whatever comes next in the file
+  // begins -- another compound, the data, the mappings, or the end. The
+  // alignment padding between them is too short to read as a chunk.
+  array_t bounds;
+  uint32_t *offsets;
+  sz_unpacked_compound_t *packs = array_buffer(&ctx->compounds, NULL);
+  const size_t len = root->num_compounds;
+  size_t index;
+
+  if (!array_init(&bounds, sizeof(uint32_t), len + 3, ctx->alloc) || !array_resize(&bounds, len + 3)) {
+    ctx->error = sz_errstr_nomem;
+    return SZ_ERROR_OUT_OF_MEMORY;
   }
 
+  offsets = array_buffer(&bounds, NULL);
+  for (index = 0; index < len; ++index)
+    offsets[index] = (uint32_t)(packs[index].scope.start - root_pos);
+  offsets[len] = root->data_offset;
+  offsets[len + 1] = root->mappings_offset;
+  offsets[len + 2] = root->size;
+
+  if (!array_radix_sort(&bounds, 0, ARRAY_KEY_UINT32)) {
+    array_destroy(&bounds);
+    ctx->error = sz_errstr_nomem;
+    return SZ_ERROR_OUT_OF_MEMORY;
+  }
+
+  for (index = 0; index < len; ++index)
+    packs[index].scope.end = sz_scope_end(&bounds, root_pos, packs[index].scope.start);
+  ctx->data_scope.end = sz_scope_end(&bounds, root_pos, ctx->data_scope.start);
+
+  array_destroy(&bounds);
+
   return SZ_SUCCESS;
 }
 
@@ -657,21 +1371,29 @@ sz_reader_begin(sz_context_t *ctx)
   sz_response_t response;
   size_t index;
   size_t len;
-  // arrays
   sz_unpacked_compound_t *packs;
-  uint32_t *offsets;
-  size_t offsets_size;
   stream_t *stream = ctx->stream;
+  off_t root_pos;
 
-  array_init(&ctx->stack, sizeof(off_t), 32, ctx->alloc);
+  array_init_inline(&ctx->stack, sizeof(off_t), ctx->stack_storage, sizeof(ctx->stack_storage), ctx->alloc);
   array_init(&ctx->compounds, sizeof(sz_unpacked_compound_t), 32, ctx->alloc);
 
-  sz_push_stack(ctx);
+  root_pos = stream_tell(stream);
 
   response = sz_read_root(ctx, &root);
   if (response != SZ_SUCCESS)
     return response;
 
+  // the writer couldn't seek back to fill in the root, so it's at the end
+  if (root.mappings_offset == SZ_ROOT_IN_TRAILER) {
+    if (stream_seek(stream, -(off_t)sizeof(root), SEEK_END) == -1)
+      return sz_file_error(ctx);
+
+    response = sz_read_root(ctx, &root);
+    if (response != SZ_SUCCESS)
+      return response;
+  }
+
   array_resize(&ctx->compounds, (size_t)root.num_compounds + 8);
 
   len = root.num_compounds;
@@ -683,32 +1405,30 @@ sz_reader_begin(sz_context_t *ctx)
     return SZ_ERROR_NULL_POINTER;
   }
 
-  offsets_size = sizeof(uint32_t) * len;
-  offsets = com_malloc(ctx->alloc, offsets_size);
-
-  for (index = 0; index < len; ++index) {
-    if (stream_read_uint32(stream, offsets + index)) {
-      sz_pop_stack(ctx);
-      return sz_file_error(ctx);
-    }
-  }
-
-  sz_pop_stack(ctx);
+  memset(packs, 0, sizeof(*packs) * len);
 
-  for (; index < len; ++index) {
-    off_t offset = (off_t)offsets[index];
+  if (stream_seek(stream, root_pos + (off_t)root.mappings_offset, SEEK_SET) == -1)
+    return sz_file_error(ctx);
 
-    sz_push_stack(ctx);
+  for (index = 0; index < len; ++index) {
+    uint32_t offset;
 
-    stream_seek(ctx->stream, offset, SEEK_CUR);
-    packs[index].position = ctx->stream_pos + stream_tell(ctx->stream);
+    if (stream_read_uint32(stream, &offset))
+      return sz_file_error(ctx);
 
-    sz_pop_stack(ctx);
+    // offsets are relative to the root
+    packs[index].scope.start = root_pos + (off_t)offset;
   }
 
-  com_free(ctx->alloc, offsets);
+  ctx->data_scope.start = root_pos + (off_t)root.data_offset;
+  ctx->scope = &ctx->data_scope;
+
+  response = sz_set_scope_ends(ctx, &root, root_pos);
+  if (response != SZ_SUCCESS)
+    return response;
 
-  stream_seek(ctx->stream, (off_t)root.data_offset, SEEK_CUR);
+  if (stream_seek(stream, ctx->data_scope.start, SEEK_SET) == -1)
+    return sz_file_error(ctx);
 
   return SZ_SUCCESS;
 }
@@ -717,15 +1437,30 @@ sz_reader_begin(sz_context_t *ctx)
 static sz_response_t
 sz_writer_begin(sz_context_t *ctx)
 {
+  // offsets aren't known yet, so this says to look for the root at the end
+  // unless sz_writer_flush can come back and fill it in
+  sz_root_t root = {
+    .magic = SZ_MAGIC,
+    .size = 0,
+    .num_compounds = 0,
+    .mappings_offset = SZ_ROOT_IN_TRAILER,
+    .compounds_offset = SZ_ROOT_IN_TRAILER,
+    .data_offset = SZ_ROOT_IN_TRAILER
+  };
+
   buffer_init(&ctx->buffer, 32, ctx->alloc);
   ctx->buffer_stream = buffer_stream(&ctx->buffer, STREAM_WRITE, true);
-  array_init(&ctx->stack, sizeof(stream_t *), 32, ctx->alloc);
+  array_init_inline(&ctx->stack, sizeof(stream_t *), ctx->stack_storage, sizeof(ctx->stack_storage), ctx->alloc);
   array_init(&ctx->compounds, sizeof(sz_buffer_stream_t), 32, ctx->alloc);
-  map_init(&ctx->compound_ptrs, g_mapops_default, ctx->alloc);
+  array_init(&ctx->fixups, sizeof(sz_fixup_t), 0, ctx->alloc);
+  hashmap_init(&ctx->compound_ptrs, g_mapops_default, NULL, ctx->alloc);
 
   ctx->active = ctx->buffer_stream;
+  ctx->stream_pos = stream_tell(ctx->stream);
+  ctx->write_offset = (uint32_t)sizeof(root);
+  ctx->write_error = SZ_SUCCESS;
 
-  return SZ_SUCCESS;
+  return sz_write_root(ctx, root);
 }
 
 
@@ -734,59 +1469,46 @@ sz_writer_flush(sz_context_t *ctx)
 {
   sz_response_t response;
   size_t index, len;
-
   stream_t *stream = ctx->stream;
-
+  sz_buffer_stream_t *comp_buffers = array_buffer(&ctx->compounds, NULL);
   sz_root_t root = {
     .magic = SZ_MAGIC,
     .size = 0,
     .num_compounds = array_size(&ctx->compounds),
-    .mappings_offset = sizeof(root),
-    .compounds_offset = (uint32_t)-1,
-    .data_offset = (uint32_t)-1
+    .mappings_offset = 0,
+    .compounds_offset = sizeof(root),
+    .data_offset = 0
   };
 
-  uint32_t relative_off;
-  buffer_t *data = &ctx->buffer;
-  size_t data_sz = buffer_size(data);
-  void *data_ptr = buffer_pointer(data);
-  sz_buffer_stream_t *comp_buffers = array_buffer(&ctx->compounds, NULL);
-  buffer_t *comp_buf;
-
-  uint32_t mappings_size = (uint32_t)sizeof(uint32_t) * root.num_compounds;
-  uint32_t compounds_size = 0;
-
-  for (index = 0, len = root.num_compounds; index < len; ++index)
-    compounds_size += (uint32_t)buffer_size(comp_buffers[index].buffer);
-
-  root.compounds_offset = root.mappings_offset + mappings_size;
-  root.data_offset = root.compounds_offset + compounds_size;
-  root.size = root.data_offset + (uint32_t)buffer_size(&ctx->buffer);
+  // compounds have all been written as they finished
+  if (ctx->write_error != SZ_SUCCESS)
+    return ctx->write_error;
 
-  response = sz_write_root(ctx, root);
+  response = sz_emit_buffer(ctx, &ctx->buffer, &root.data_offset);
   if (response != SZ_SUCCESS)
     return response;
 
-  // write mappings
-  relative_off = (uint32_t)(sizeof(root) + mappings_size);
-  for (index = 0; index < len; ++index) {
-    comp_buf = comp_buffers[index].buffer;
-    if (stream_write_uint32(stream, relative_off))
+  root.mappings_offset = ctx->write_offset;
+  for (index = 0, len = root.num_compounds; index < len; ++index) {
+    if (stream_write_uint32(stream, comp_buffers[index].offset))
       return sz_file_error(ctx);
-    relative_off += buffer_size(comp_buf);
+    ctx->write_offset += (uint32_t)sizeof(uint32_t);
   }
 
-  for (index = 0; index < len; ++index) {
-    size_t buffer_sz = buffer_size(comp_buf);
-    comp_buf = comp_buffers[index].buffer;
-    if (stream_write(buffer_pointer(comp_buf), buffer_sz, stream) != buffer_sz)
-      return sz_file_error(ctx);
-  }
+  root.size = ctx->write_offset;
 
-  if (data_ptr && stream_write(data_ptr, data_sz, stream) != data_sz)
-    return sz_file_error(ctx);
+  // fill in the root if the stream can go back to it, otherwise repeat it at
+  // the end for readers to find
+  if (   ctx->stream_pos != -1
+      && stream_seek(stream, ctx->stream_pos, SEEK_SET) == ctx->stream_pos) {
+    response = sz_write_root(ctx, root);
+    stream_seek(stream, ctx->stream_pos + (off_t)root.size, SEEK_SET);
+  } else {
+    root.size += (uint32_t)sizeof(root);
+    response = sz_write_root(ctx, root);
+  }
 
-  return SZ_SUCCESS;
+  return response;
 }
 
 
@@ -858,6 +1580,89 @@ sz_set_stream(sz_context_t *ctx, stream_t *stream)
 }
 
 
+sz_response_t
+sz_set_memory(sz_context_t *ctx, const void *data, size_t size)
+{
+  stream_t *stream;
+
+  if (NULL == ctx) return SZ_ERROR_NULL_CONTEXT;
+
+  if (ctx->mode != SZ_READER) {
+    ctx->error = sz_errstr_read_on_write;
+    return SZ_ERROR_INVALID_OPERATION;
+  }
+
+  if (ctx->open) {
+    ctx->error = sz_errstr_already_open;
+    return SZ_ERROR_INVALID_OPERATION;
+  }
+
+  if (NULL == data) {
+    ctx->error = sz_errstr_null_stream;
+    return SZ_ERROR_NULL_POINTER;
+  }
+
+  if (ctx->memory)
+    stream_close(ctx->buffer_stream);
+
+  ctx->memory = NULL;
+  ctx->buffer_stream = NULL;
+
+  // the buffer only ever backs a read stream, so data is never written to
+  buffer_init_with_pointer(&ctx->buffer, size, (void *)data, ctx->alloc);
+  stream = buffer_stream(&ctx->buffer, STREAM_READ, false);
+  if (stream == NULL) {
+    ctx->error = sz_errstr_nomem;
+    return SZ_ERROR_OUT_OF_MEMORY;
+  }
+
+  ctx->memory = (const char *)data;
+  ctx->memory_size = size;
+  ctx->buffer_stream = stream;
+  ctx->stream = stream;
+  ctx->stream_pos = 0;
+
+  return SZ_SUCCESS;
+}
+
+
+sz_response_t
+sz_set_compression(sz_context_t *ctx, bool enabled)
+{
+  if (NULL == ctx) return SZ_ERROR_NULL_CONTEXT;
+
+  if (ctx->mode != SZ_WRITER) {
+    ctx->error = sz_errstr_write_on_read;
+    return SZ_ERROR_INVALID_OPERATION;
+  }
+
+  ctx->compress = enabled;
+
+  return SZ_SUCCESS;
+}
+
+
+sz_response_t
+sz_set_writer_threads(sz_context_t *ctx, int threads)
+{
+  if (NULL == ctx) return SZ_ERROR_NULL_CONTEXT;
+
+  if (ctx->mode != SZ_WRITER) {
+    ctx->error = sz_errstr_write_on_read;
+    return SZ_ERROR_INVALID_OPERATION;
+  }
+
+  if (threads < 1)
+    threads = 1;
+  else if (threads > SZ_MAX_WRITER_THREADS)
+    threads = SZ_MAX_WRITER_THREADS;
+
+  ctx->threads = threads;
+
+  return SZ_SUCCESS;
+}
+
+
 const char *
 sz_get_error(sz_context_t *ctx)
 {
@@ -868,35 +1673,116 @@ sz_get_error(sz_context_t *ctx)
 }
 
 
+bool
+sz_has_chunk(sz_context_t *ctx, uint32_t name)
+{
+  sz_header_t chunk;
+  off_t pos;
+  bool found;
+
+  if (sz_check_context(ctx, SZ_READER) != SZ_SUCCESS || !ctx->open)
+    return false;
+
+  pos = stream_tell(ctx->stream);
+
+  found = (   (ctx->scope == NULL || pos + SZ_HEADER_SIZE <= ctx->scope->end)
+           && sz_read_next_header(ctx, &chunk) == SZ_SUCCESS
+           && chunk.name == name)
+          || sz_find_chunk(ctx, name) != -1;
+
+  stream_seek(ctx->stream, pos, SEEK_SET);
+
+  return found;
+}
+
+
 static uint32_t
 sz_store_compound(sz_context_t *ctx, void *p,
                   sz_compound_writer_t writer, void *writer_ctx)
 {
-  uint32_t idx;
+  uint32_t idx, outer;
 
   if (p == NULL)
     return 0;
 
-  idx = (uint32_t)map_get(&ctx->compound_ptrs, p);
-  if (idx != 0) return idx;
+  idx = (uint32_t)(uintptr_t)hashmap_get(&ctx->compound_ptrs, p);
+  if (idx != 0) return ctx->parent ? (idx | SZ_LOCAL_REF) : idx;
+
+  // on other threads, compounds the parent already has are shared. Nothing
+  // is added to its map until every thread is done with the batch.
+  if (ctx->parent) {
+    idx = (uint32_t)(uintptr_t)hashmap_get(&ctx->parent->compound_ptrs, p);
+    if (idx != 0) return idx;
+  }
 
   idx = sz_new_compound(ctx, p);
+  outer = ctx->active_index;
+  ctx->active_index = idx;
   sz_push_stack(ctx);
 
   writer(ctx, p, writer_ctx);
 
   sz_pop_stack(ctx);
+  ctx->active_index = outer;
+
+  // other threads hold on to their compounds until they're merged
+  if (ctx->parent)
+    return idx | SZ_LOCAL_REF;
+
+  sz_finish_compound(ctx, idx);
 
   return idx;
 }
 
 
+static sz_response_t
+sz_write_compound_index(sz_context_t *ctx, uint32_t idx)
+{
+  sz_fixup_t fixup;
+  sz_buffer_stream_t *owner;
+  off_t pos = stream_tell(ctx->active);
+
+  if (stream_write_uint32(ctx->active, idx))
+    return sz_file_error(ctx);
+
+  if (!(idx & SZ_LOCAL_REF))
+    return SZ_SUCCESS;
+
+  fixup.offset = (uint32_t)pos;
+  fixup.target = idx & ~SZ_LOCAL_REF;
+  fixup.next = 0;
+
+  if (!array_push(&ctx->fixups, &fixup)) {
+    // the ref can't be fixed up, so the output would be corrupt
+    ctx->error = sz_errstr_nomem;
+    if (ctx->write_error == SZ_SUCCESS)
+      ctx->write_error = SZ_ERROR_OUT_OF_MEMORY;
+    return SZ_ERROR_OUT_OF_MEMORY;
+  }
+
+  // refs are only written inside compounds on other threads
+  owner = array_at_index(&ctx->compounds, ctx->active_index - 1);
+  if (owner->last_fixup)
+    ((sz_fixup_t *)array_at_index(&ctx->fixups, owner->last_fixup - 1))->next = (uint32_t)array_size(&ctx->fixups);
+  else
+    owner->first_fixup = (uint32_t)array_size(&ctx->fixups);
+  owner->last_fixup = (uint32_t)array_size(&ctx->fixups);
+
+  return SZ_SUCCESS;
+}
+
+
 sz_response_t
 sz_write_compound(sz_context_t *ctx, uint32_t name, void *p,
                       sz_compound_writer_t writer, void *writer_ctx)
 {
   sz_response_t response;
   uint32_t index;
+  sz_header_t chunk = {
+    .kind = SZ_COMPOUND_REF_CHUNK,
+    .name = name,
+    .size = (uint32_t)(SZ_HEADER_SIZE + sizeof(uint32_t))
+  };
 
   response = sz_check_context(ctx, SZ_WRITER);
   if (response != SZ_SUCCESS)
@@ -907,7 +1793,11 @@ sz_write_compound(sz_context_t *ctx, uint32_t name, void *p,
 
   index = sz_store_compound(ctx, p, writer, writer_ctx);
 
-  return sz_write_primitive(ctx, SZ_COMPOUND_REF_CHUNK, name, &index, sizeof(uint32_t));
+  response = sz_write_header(ctx, chunk);
+  if (response != SZ_SUCCESS)
+    return response;
+
+  return sz_write_compound_index(ctx, index);
 }
 
 
@@ -923,12 +1813,16 @@ sz_get_compound(sz_context_t *ctx, uint32_t idx,
   pkg = array_at_index(&ctx->compounds, idx - 1);
 
   if (pkg->value == NULL) {
+    sz_scope_t *outer = ctx->scope;
+
     sz_push_stack(ctx);
 
-    stream_seek(ctx->stream, pkg->position, SEEK_SET);
+    stream_seek(ctx->stream, pkg->scope.start, SEEK_SET);
+    ctx->scope = &pkg->scope;
 
     reader(ctx, &pkg->value, reader_ctx);
 
+    ctx->scope = outer;
     sz_pop_stack(ctx);
   }
 
@@ -985,6 +1879,186 @@ sz_read_compound_error:
 }
 
 
+static void
+sz_worker_begin(sz_context_t *worker, sz_context_t *parent)
+{
+  allocator_t *alloc = parent->alloc;
+
+  sz_init_context(worker, SZ_WRITER, alloc);
+
+  // no stream or top-level data: compounds are only ever written into their
+  // own buffers, which the parent merges
+  worker->parent = parent;
+  worker->compress = parent->compress;
+  worker->open = 1;
+
+  array_init_inline(&worker->stack, sizeof(stream_t *), worker->stack_storage, sizeof(worker->stack_storage), alloc);
+  array_init(&worker->compounds, sizeof(sz_buffer_stream_t), 32, alloc);
+  array_init(&worker->fixups, sizeof(sz_fixup_t), 32, alloc);
+  hashmap_init(&worker->compound_ptrs, g_mapops_default, NULL, alloc);
+}
+
+
+static void
+sz_worker_reset(sz_context_t *worker)
+{
+  sz_free_compound_buffers(worker);
+  array_clear(&worker->compounds);
+  array_clear(&worker->fixups);
+  hashmap_clear(&worker->compound_ptrs);
+}
+
+
+static void *
+sz_write_batch(void *context)
+{
+  sz_worker_t *worker = (sz_worker_t *)context;
+  sz_batch_t *batch = worker->batch;
+  size_t item;
+
+  // items are handed out one at a time since compounds can vary a lot in
+  // how long they take to write
+  while ((item = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+    batch->refs[item] = sz_store_compound(&worker->ctx, batch->items[item], batch->writer, batch->writer_ctx);
+    batch->owners[item] = worker->id;
+  }
+
+  return NULL;
+}
+
+
+// Merging a compound merges the compounds it refers to first, so indices are
+// handed out in the same order, and compounds written to the stream in the
+// same order, as if the whole list had been written on one thread.
+static uint32_t
+sz_merge_compound(sz_context_t *ctx, sz_context_t *worker, uint32_t ref)
+{
+  sz_response_t response;
+  sz_buffer_stream_t *bs;
+  sz_buffer_stream_t merged = { .buffer = NULL };
+  uint32_t idx, next;
+
+  if (!(ref & SZ_LOCAL_REF))
+    return ref;
+
+  bs = array_at_index(&worker->compounds, (ref & ~SZ_LOCAL_REF) - 1);
+  if (bs->final_index)
+    return bs->final_index;
+
+  // if another thread wrote the same compound, the first one merged is kept
+  idx = (uint32_t)(uintptr_t)hashmap_get(&ctx->compound_ptrs, bs->ptr);
+  if (idx != 0) {
+    bs->final_index = idx;
+    return idx;
+  }
+
+  merged.ptr = bs->ptr;
+  array_push(&ctx->compounds, &merged);
+  idx = (uint32_t)array_size(&ctx->compounds);
+  hashmap_insert(&ctx->compound_ptrs, bs->ptr, (void *)(uintptr_t)idx);
+
+  // set before fixing up refs so refs back to this compound find it
+  bs->final_index = idx;
+
+  for (next = bs->first_fixup; next != 0;) {
+    const sz_fixup_t *fixup = array_at_index(&worker->fixups, next - 1);
+    uint32_t target = sz_merge_compound(ctx, worker, fixup->target | SZ_LOCAL_REF);
+
+    target = (uint32_t)PHYSFS_swapULE32((PHYSFS_uint32)target);
+    memcpy((char *)buffer_pointer(bs->buffer) + fixup->offset, &target, sizeof(target));
+    next = fixup->next;
+  }
+
+  response = sz_emit_buffer(ctx, bs->buffer,
+                            &((sz_buffer_stream_t *)array_at_index(&ctx->compounds, idx - 1))->offset);
+
+  if (response != SZ_SUCCESS && ctx->write_error == SZ_SUCCESS)
+    ctx->write_error = response;
+
+  return idx;
+}
+
+
+static sz_response_t
+sz_write_compounds_parallel(sz_context_t *ctx, void **p, size_t length,
+                            sz_compound_writer_t writer, void *writer_ctx)
+{
+  sz_response_t response = SZ_SUCCESS;
+  thread_t threads[SZ_MAX_WRITER_THREADS];
+  bool started[SZ_MAX_WRITER_THREADS];
+  sz_worker_t *workers;
+  sz_batch_t batch;
+  const int count = ctx->threads;
+  const size_t batch_size = length < SZ_PARALLEL_BATCH_SIZE ? length : SZ_PARALLEL_BATCH_SIZE;
+  size_t start, index;
+  int worker;
+
+  workers = com_malloc(ctx->alloc, sizeof(*workers) * count);
+  batch.refs = com_malloc(ctx->alloc, sizeof(*batch.refs) * batch_size);
+  batch.owners = com_malloc(ctx->alloc, sizeof(*batch.owners) * batch_size);
+
+  if (workers == NULL || batch.refs == NULL || batch.owners == NULL) {
+    ctx->error = sz_errstr_nomem;
+    response = SZ_ERROR_OUT_OF_MEMORY;
+    goto sz_write_compounds_parallel_done;
+  }
+
+  batch.writer = writer;
+  batch.writer_ctx = writer_ctx;
+
+  for (worker = 0; worker < count; ++worker) {
+    sz_worker_begin(&workers[worker].ctx, ctx);
+    workers[worker].batch = &batch;
+    workers[worker].id = (uint8_t)worker;
+  }
+
+  for (start = 0; start < length && response == SZ_SUCCESS; start += batch.count) {
+    batch.items = p + start;
+    batch.count = length - start < batch_size ? length - start : batch_size;
+    batch.next = 0;
+
+    // the calling thread is the first worker -- it takes items until the
+    // batch is empty, so it also writes the share of any thread that
+    // couldn't be created
+    for (worker = 1; worker < count; ++worker)
+      started[worker] = thread_create(&threads[worker], sz_write_batch, &workers[worker]) == 0;
+
+    sz_write_batch(&workers[0]);
+
+    for (worker = 1; worker < count; ++worker) {
+      if (started[worker])
+        thread_join(threads[worker], NULL);
+    }
+
+    for (index = 0; index < batch.count; ++index) {
+      uint32_t ref = sz_merge_compound(ctx, &workers[batch.owners[index]].ctx, batch.refs[index]);
+
+      if (stream_write_uint32(ctx->active, ref)) {
+        response = sz_file_error(ctx);
+        break;
+      }
+    }
+
+    for (worker = 0; worker < count; ++worker) {
+      if (workers[worker].ctx.write_error != SZ_SUCCESS && ctx->write_error == SZ_SUCCESS)
+        ctx->write_error = workers[worker].ctx.write_error;
+
+      sz_worker_reset(&workers[worker].ctx);
+    }
+  }
+
+  for (worker = 0; worker < count; ++worker)
+    sz_destroy_context(&workers[worker].ctx);
+
+sz_write_compounds_parallel_done:
+  com_free(ctx->alloc, batch.owners);
+  com_free(ctx->alloc, batch.refs);
+  com_free(ctx->alloc, workers);
+
+  return response;
+}
+
+
 sz_response_t
 sz_write_compounds(sz_context_t *ctx, uint32_t name, void **p, size_t length,
                        sz_compound_writer_t writer, void *writer_ctx)
@@ -1002,7 +2076,7 @@ sz_write_compounds(sz_context_t *ctx, uint32_t name, void **p, size_t length,
     .type = SZ_COMPOUND_REF_CHUNK
   };
 
-  response = sz_check_context(ctx, SZ_READER);
+  response = sz_check_context(ctx, SZ_WRITER);
   if (response != SZ_SUCCESS)
     return response;
 
@@ -1019,9 +2093,15 @@ sz_write_compounds(sz_context_t *ctx, uint32_t name, void **p, size_t length,
       || stream_write_uint8(stream, chunk.type))
     return sz_file_error(ctx);
 
+  // lists written inside compounds on other threads stay on that thread
+  if (ctx->threads > 1 && ctx->parent == NULL && length >= SZ_PARALLEL_MIN_COMPOUNDS)
+    return sz_write_compounds_parallel(ctx, p, length, writer, writer_ctx);
+
   for (index = 0; index < length; ++index) {
     ref = sz_store_compound(ctx, p[index], writer, writer_ctx);
-    stream_write_uint32(ctx->active, ref);
+    response = sz_write_compound_index(ctx, ref);
+    if (response != SZ_SUCCESS)
+      return response;
   }
 
   return SZ_SUCCESS;
@@ -1062,7 +2142,7 @@ sz_read_compounds(sz_context_t *ctx, uint32_t name, void ***out, size_t *length,
       uint32_t index;
       uint32_t ref;
 
-      buf = (void **)com_malloc(buf_alloc, sizeof(void *) * chunk.length);
+      buf = (void **)com_malloc_uninit(buf_alloc, sizeof(void *) * chunk.length);
 
       for (index = 0; index < chunk.length; ++index) {
         if (stream_read_uint32(ctx->stream, &ref)) {
@@ -1089,6 +2169,19 @@ sz_read_compounds(sz_context_t *ctx, uint32_t name, void ***out, size_t *length,
 sz_response_t
 sz_write_bytes(sz_context_t *ctx, uint32_t name, const void *values, size_t length)
 {
+  sz_response_t response;
+  bool written;
+
+  response = sz_check_context(ctx, SZ_WRITER);
+  if (response != SZ_SUCCESS)
+    return response;
+
+  if (values) {
+    response = sz_write_compressed(ctx, NULL, name, values, length, &written);
+    if (written)
+      return response;
+  }
+
   return sz_write_primitive(ctx, SZ_BYTES_CHUNK, name, values, length);
 }
 
@@ -1118,13 +2211,18 @@ sz_read_bytes(sz_context_t *ctx, uint32_t name, void **out, size_t *length, allo
   if (chunk.kind == SZ_NULL_POINTER_CHUNK) {
     if (out) *out = NULL;
     if (length) *length = 0;
+  } else if (chunk.kind & SZ_COMPRESSED_FLAG) {
+    response = sz_read_compressed(ctx, (size_t)chunk.size - SZ_HEADER_SIZE, out, length, buf_alloc);
+    if (response != SZ_SUCCESS)
+      goto sz_read_bytes_error;
   } else {
     size = (size_t)chunk.size - SZ_HEADER_SIZE;
 
     if (out) {
-      bytes = com_malloc(buf_alloc, size);
+      bytes = com_malloc_uninit(buf_alloc, size);
 
       if (stream_read(bytes, size, ctx->stream) != size) {
+        com_free(buf_alloc, bytes);
         response = sz_file_error(ctx);
         goto sz_read_bytes_error;
       }
@@ -1146,6 +2244,82 @@ sz_read_bytes_error:
 }
 
 
+sz_response_t
+sz_read_bytes_ref(sz_context_t *ctx, uint32_t name, const void **out, size_t *length)
+{
+  sz_response_t response;
+  sz_header_t chunk;
+  off_t pos;
+  size_t size;
+  const void *ref;
+  void *bytes;
+
+  response = sz_check_context(ctx, SZ_READER);
+  if (response != SZ_SUCCESS)
+    return response;
+
+  pos = stream_tell(ctx->stream);
+
+  response = sz_read_header(ctx, &chunk, name, SZ_BYTES_CHUNK, true);
+  if (response != SZ_SUCCESS)
+    goto sz_read_bytes_ref_error;
+
+  if (chunk.kind == SZ_NULL_POINTER_CHUNK) {
+    if (out) *out = NULL;
+    if (length) *length = 0;
+    return SZ_SUCCESS;
+  }
+
+  size = (size_t)chunk.size - SZ_HEADER_SIZE;
+
+  if (chunk.kind & SZ_COMPRESSED_FLAG) {
+    response = sz_read_compressed(ctx, size, &bytes, &size, ctx->alloc);
+    if (response != SZ_SUCCESS)
+      goto sz_read_bytes_ref_error;
+
+    if (!array_push(&ctx->ref_copies, &bytes)) {
+      com_free(ctx->alloc, bytes);
+      ctx->error = sz_errstr_nomem;
+      response = SZ_ERROR_OUT_OF_MEMORY;
+      goto sz_read_bytes_ref_error;
+    }
+
+    ref = bytes;
+  } else if ((ref = sz_memory_ref(ctx, size, 1)) == NULL) {
+    bytes = com_malloc_uninit(ctx->alloc, size);
+
+    if (bytes && !array_push(&ctx->ref_copies, &bytes)) {
+      com_free(ctx->alloc, bytes);
+      bytes = NULL;
+    }
+
+    if (bytes == NULL) {
+      ctx->error = sz_errstr_nomem;
+      response = SZ_ERROR_OUT_OF_MEMORY;
+      goto sz_read_bytes_ref_error;
+    }
+
+    // the copy stays in ref_copies even if the read fails; it's freed with
+    // the rest when the context is destroyed
+    if (stream_read(bytes, size, ctx->stream) != size) {
+      response = sz_file_error(ctx);
+      goto sz_read_bytes_ref_error;
+    }
+
+    ref = bytes;
+  }
+
+  if (out) *out = ref;
+  if (length) *length = size;
+
+  return SZ_SUCCESS;
+
+sz_read_bytes_ref_error:
+  stream_seek(ctx->stream, pos, SEEK_SET);
+  return response;
+}
+
+
 sz_response_t
 sz_write_float(sz_context_t *ctx, uint32_t name, float value)
 {
@@ -1177,6 +2351,13 @@ sz_read_floats(sz_context_t *ctx, uint32_t name, float **out, size_t *length, al
 }
 
 
+sz_response_t
+sz_read_floats_ref(sz_context_t *ctx, uint32_t name, const float **out, size_t *length)
+{
+  return sz_read_primitive_array_ref(ctx, SZ_FLOAT_CHUNK, name, (const void **)out, length);
+}
+
+
 sz_response_t
 sz_write_int(sz_context_t *ctx, uint32_t name, int32_t value)
 {
@@ -1208,6 +2389,13 @@ sz_read_ints(sz_context_t *ctx, uint32_t name, int32_t **out, size_t *length, al
 }
 
 
+sz_response_t
+sz_read_ints_ref(sz_context_t *ctx, uint32_t name, const int32_t **out, size_t *length)
+{
+  return sz_read_primitive_array_ref(ctx, SZ_SINT32_CHUNK, name, (const void **)out, length);
+}
+
+
 sz_response_t
 sz_write_unsigned_int(sz_context_t *ctx, uint32_t name, uint32_t value)
 {
@@ -1238,6 +2426,13 @@ sz_read_unsigned_ints(sz_context_t *ctx, uint32_t name, uint32_t **out, size_t *
   return sz_read_primitive_array(ctx, SZ_UINT32_CHUNK, name, (void **)out, length, buf_alloc);
 }
 
+
+sz_response_t
+sz_read_unsigned_ints_ref(sz_context_t *ctx, uint32_t name, const uint32_t **out, size_t *length)
+{
+  return sz_read_primitive_array_ref(ctx, SZ_UINT32_CHUNK, name, (const void **)out, length);
+}
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
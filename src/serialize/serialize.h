@@ -4,7 +4,7 @@
 #include <snow-config.h>
 #include <buffer/buffer.h>
 #include <structs/dynarray.h>
-#include <structs/map.h>
+#include <structs/hashmap.h>
 #include <stream/stream.h>
 
 #ifdef __SNOW__SERIALIZE_C__
@@ -17,7 +17,10 @@
 extern "C" {
 #endif // __cplusplus
 
-#define SZ_MAGIC (0x31305A53)
+// "SZ02" -- version 2 adds padding chunks so array payloads are aligned
+#define SZ_MAGIC (0x32305A53)
+// "SZ01" -- still readable
+#define SZ_MAGIC_V1 (0x31305A53)
 
 // Chunk types
 #define SZ_COMPOUND_CHUNK (1)
@@ -30,6 +33,33 @@ extern "C" {
 // The null pointer chunk may substitute any compound, array, or bytes chunk
 #define SZ_NULL_POINTER_CHUNK (8)
 #define SZ_DOUBLE_CHUNK (9)
+// Filler written before an array so its payload is aligned to its element
+// size. Readers skip it.
+#define SZ_PADDING_CHUNK (10)
+
+// Set in the kind of a bytes or array chunk whose payload is compressed with
+// lz_compress. The payload is then the uncompressed size as a uint32
+// followed by the compressed data. Uncompressed, it's the same as it would
+// have been without compression, so arrays are still little-endian.
+#define SZ_COMPRESSED_FLAG (0x80)
+// Payloads smaller than this are never compressed
+#define SZ_COMPRESS_MIN_SIZE (512)
+
+// Alignment of compounds and of the data section, relative to the root. Array
+// payloads are aligned within these to their element size.
+#define SZ_ALIGNMENT (8)
+
+// Written in place of the root's offsets when the writer can't seek back to
+// fill them in. The complete root then follows everything else, ending the
+// stream.
+#define SZ_ROOT_IN_TRAILER ((uint32_t)-1)
+
+// Number of stack entries kept inline in the context before the stack spills
+// to the context's allocator
+#define SZ_INLINE_STACK_SIZE (16)
+
+// The most threads sz_write_compounds runs compound writers on
+#define SZ_MAX_WRITER_THREADS (16)
 
 // Responses
 typedef enum {
@@ -96,6 +126,17 @@ typedef void (sz_compound_writer_t)(sz_context_t *ctx,
 typedef void (sz_compound_reader_t)(sz_context_t *ctx,
                                     void **p, void *reader_ctx);
 
+// reading: the chunks of one compound, or of the top-level data. The first
+// time a read doesn't find its chunk next, the scope's chunks are indexed by
+// name so reads can go straight to any of them.
+typedef struct s_sz_scope {
+  off_t start;
+  off_t end;
+  bool indexed;
+  // chunk name -> offset of the chunk from start, plus one
+  hashmap_t index;
+} sz_scope_t;
+
 struct s_sz_context {
   allocator_t *alloc;
 
@@ -108,20 +149,53 @@ struct s_sz_context {
   stream_t *stream;
   off_t stream_pos;
 
+  // reading: the data passed to sz_set_memory, or NULL if reading a stream
+  const char *memory;
+  size_t memory_size;
+  // reading: the top-level data, and the scope currently being read
+  sz_scope_t data_scope;
+  sz_scope_t *scope;
+  // reading: blocks allocated by the _ref functions when data couldn't be
+  // used in place. Freed by sz_destroy_context.
+  array_t ref_copies;
+
   stream_t *active;
 
+  // writing: bytes written to the stream so far, counted from the root
+  uint32_t write_offset;
+  // writing: the first error writing a finished compound to the stream
+  sz_response_t write_error;
+  // writing: whether large bytes and array chunks are compressed
+  bool compress;
+  // writing: how many threads sz_write_compounds may use
+  int threads;
+  // writing: the context that hands compounds to this one to write on
+  // another thread, or NULL
+  sz_context_t *parent;
+  // writing: index of the compound being written, or 0 for the top-level data
+  uint32_t active_index;
+  // writing: refs written on another thread to compounds whose final indices
+  // aren't known yet
+  array_t fixups;
+
   // writing: map of compounds in use to their indices
-  map_t compound_ptrs;
+  hashmap_t compound_ptrs;
   // stack that operates differently when reading and writing
   // writing: stack of active buffers
   // reading: stack of off_t locations in the stream
   array_t stack;
+  // inline storage for the stack
+  union {
+    off_t position;
+    stream_t *stream;
+  } stack_storage[SZ_INLINE_STACK_SIZE];
   // compound pointers
-  // writing: pointers to buffers of compounds
+  // writing: buffers of compounds still being written, and the offsets of
+  // those already written to the stream
   // reading: pointers to file offsets of compounds and their unpacked pointers
   array_t compounds;
   // output buffer
-  // unused in reading
+  // reading: wraps the memory passed to sz_set_memory
   buffer_t buffer;
   stream_t *buffer_stream;
 };
@@ -132,16 +206,16 @@ typedef struct s_sz_root {
   uint32_t size;
   // offsets are from the root
   uint32_t num_compounds;
-  // Always immediately follows the root, so = sizeof(root)
+  // Version 1 files put the mappings right after the root, so don't assume
+  // where they are
   uint32_t mappings_offset;
-  // Follows mappings
   uint32_t compounds_offset;
-  // Follows compounds
   uint32_t data_offset;
 
-  // mappings
+  // compounds, in the order they were finished
   // data
-  // compounds
+  // mappings
+  // root again, if mappings_offset is SZ_ROOT_IN_TRAILER
 } sz_root_t;
 
 typedef struct s_sz_header {
@@ -171,7 +245,9 @@ sz_destroy_context(sz_context_t *ctx);
 sz_response_t
 sz_open(sz_context_t *ctx);
 // Ends de/serialization and closes the context.
-// If serializing, the serialized data will be written to the file.
+// If serializing, the top-level data, the compound offsets and the root are
+// written to the stream. Each compound is written as soon as it's finished,
+// so only compounds still being written are held in memory.
 sz_response_t
 sz_close(sz_context_t *ctx);
 
@@ -181,12 +257,52 @@ sz_close(sz_context_t *ctx);
 sz_response_t
 sz_set_stream(sz_context_t *ctx, stream_t *stream);
 
+// Reads from size bytes of memory instead of a stream, e.g. a mapped file.
+// Nothing is copied: the _ref read functions return pointers into data when
+// they can, so data must stay valid until sz_destroy_context. Arrays can only
+// be used in place if data is aligned to SZ_ALIGNMENT.
+sz_response_t
+sz_set_memory(sz_context_t *ctx, const void *data, size_t size);
+
+// Compresses bytes and array chunks of at least SZ_COMPRESS_MIN_SIZE bytes
+// written from now on, as long as compressing them saves space. Off by
+// default. Compressed chunks are always copied when read, so leave this off
+// for data meant to be read in place from memory. Writers only, and unlike
+// other attributes, it can be changed at any time.
+sz_response_t
+sz_set_compression(sz_context_t *ctx, bool enabled);
+
+// Lets sz_write_compounds run the writers of up to threads compounds at once
+// (at most SZ_MAX_WRITER_THREADS), each thread writing into its own buffers.
+// Compounds are still numbered and written to the stream in list order, so
+// the output is the same as with one thread as long as what a writer writes
+// only depends on its compound. Writers, and those of any compounds they
+// write, must then be safe to call from several threads at once and must
+// only use the ctx they're given, and the context's allocator must be
+// thread-safe. 1, the default, writes everything on the calling thread.
+// Writers only, and like compression it can be changed at any time.
+sz_response_t
+sz_set_writer_threads(sz_context_t *ctx, int threads);
+
+// Returns whether the compound being read, or the top-level data, has a chunk
+// with the given name. Use it to check for optional chunks before reading
+// them.
+bool
+sz_has_chunk(sz_context_t *ctx, uint32_t name);
+
 // Returns a NULL-terminated error string.
 const char *
 sz_get_error(sz_context_t *ctx);
 
 //////////// Read/write operations
 
+// Reads look for the named chunk next, in the order chunks were written. If
+// it isn't next, the reader looks it up by name within the compound being
+// read (or the top-level data), so fields can be read in any order and
+// skipped without being parsed. If a name appears more than once in a
+// compound, a lookup finds the first. Reading then carries on from the end of
+// whichever chunk was read.
+
 // Begins a compound for the pointer P
 // Returns SZ_CONTINUE for
 sz_response_t
@@ -196,6 +312,8 @@ sz_response_t
 sz_read_compound(sz_context_t *ctx, uint32_t name, void **p,
                  sz_compound_reader_t reader, void *reader_ctx);
 
+// Writes the compounds in a list, on several threads if sz_set_writer_threads
+// allows it and the list is long enough to be worth it.
 sz_response_t
 sz_write_compounds(sz_context_t *ctx, uint32_t name,
                    void **out, size_t length,
@@ -219,6 +337,15 @@ sz_read_bytes(sz_context_t *ctx, uint32_t name,
               void **out, size_t *length,
               allocator_t *buf_alloc);
 
+// Reads an array of bytes and returns a pointer to it via `out`.
+// The pointer stays valid until the context is destroyed and must not be
+// freed. When reading memory set by sz_set_memory, it points into that
+// memory. Otherwise, or if the data can't be used as is, it points to a copy
+// owned by the context.
+sz_response_t
+sz_read_bytes_ref(sz_context_t *ctx, uint32_t name,
+                  const void **out, size_t *length);
+
 sz_response_t
 sz_write_float(sz_context_t *ctx, uint32_t name, float value);
 sz_response_t
@@ -235,6 +362,11 @@ sz_read_floats(sz_context_t *ctx, uint32_t name,
                float **out, size_t *length,
                allocator_t *buf_alloc);
 
+// As sz_read_bytes_ref, for an array of floats.
+sz_response_t
+sz_read_floats_ref(sz_context_t *ctx, uint32_t name,
+                   const float **out, size_t *length);
+
 sz_response_t
 sz_write_int(sz_context_t *ctx, uint32_t name, int32_t value);
 sz_response_t
@@ -251,6 +383,11 @@ sz_read_ints(sz_context_t *ctx, uint32_t name,
              int32_t **out, size_t *length,
              allocator_t *buf_alloc);
 
+// As sz_read_bytes_ref, for an array of int32_t values.
+sz_response_t
+sz_read_ints_ref(sz_context_t *ctx, uint32_t name,
+                 const int32_t **out, size_t *length);
+
 sz_response_t
 sz_write_unsigned_int(sz_context_t *ctx, uint32_t name, uint32_t value);
 sz_response_t
@@ -266,6 +403,10 @@ sz_response_t
 sz_read_unsigned_ints(sz_context_t *ctx, uint32_t name,
                       uint32_t **out, size_t *length,
                       allocator_t *buf_alloc);
+// As sz_read_bytes_ref, for an array of uint32_t values.
+sz_response_t
+sz_read_unsigned_ints_ref(sz_context_t *ctx, uint32_t name,
+                          const uint32_t **out, size_t *length);
 
 #ifdef __cplusplus
 }
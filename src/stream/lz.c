@@ -0,0 +1,329 @@
+#define __SNOW__LZ_C__
+
+#include "lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#define LZ_MIN_MATCH (4)
+// Matches can't start in the last LZ_MF_LIMIT bytes of the input, and the
+// input always ends with at least LZ_LAST_LITERALS literals. This is what
+// lets a decoder copy in whole words without checking each byte.
+#define LZ_MF_LIMIT (12)
+#define LZ_LAST_LITERALS (5)
+#define LZ_MAX_OFFSET (65535)
+// Token nibble meaning the length continues in the following bytes
+#define LZ_RUN_MASK (15)
+#define LZ_HASH_BITS (12)
+// After 2^LZ_SKIP_TRIGGER failed lookups, the search starts stepping over
+// bytes, faster the longer it goes without a match. Incompressible data is
+// skimmed rather than hashed byte by byte.
+#define LZ_SKIP_TRIGGER (6)
+// Literal runs up to this long are copied as one fixed-size block
+#define LZ_SHORT_COPY (16)
+// Likewise matches whose length fits in their token nibble
+#define LZ_SHORT_MATCH (LZ_RUN_MASK - 1 + LZ_MIN_MATCH)
+
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+
+static inline uint64_t lz_read64(const uint8_t *p)
+{
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+
+static inline uint32_t lz_hash(uint32_t sequence)
+{
+  return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+
+// Returns how many bytes at ip match those at ref, stopping at limit.
+static inline size_t lz_count(const uint8_t *ip, const uint8_t *ref, const uint8_t *limit)
+{
+  const uint8_t *const start = ip;
+
+  while (ip + sizeof(uint64_t) <= limit) {
+    const uint64_t diff = lz_read64(ip) ^ lz_read64(ref);
+
+    if (diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return (size_t)(ip - start) + (size_t)(__builtin_clzll(diff) >> 3);
+#else
+      return (size_t)(ip - start) + (size_t)(__builtin_ctzll(diff) >> 3);
+#endif
+    }
+
+    ip += sizeof(uint64_t);
+    ref += sizeof(uint64_t);
+  }
+
+  while (ip < limit && *ip == *ref) {
+    ++ip;
+    ++ref;
+  }
+
+  return (size_t)(ip - start);
+}
+
+
+// Writes the part of a length that didn't fit in its token nibble.
+static inline uint8_t *lz_write_length(uint8_t *op, size_t length)
+{
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+
+  *op++ = (uint8_t)length;
+
+  return op;
+}
+
+
+// Adds the continuation bytes of a length to length. Returns false if they
+// run past the end of the input.
+static inline bool lz_read_length(const uint8_t **ip, const uint8_t *ip_end, size_t *length)
+{
+  unsigned byte;
+
+  do {
+    if (*ip >= ip_end || *length > LZ_MAX_INPUT_SIZE)
+      return false;
+
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+
+// Writes a token and its literals. The match half of the token is filled in
+// by the caller. Returns NULL if it doesn't fit.
+static inline uint8_t *lz_write_literals(uint8_t *op, const uint8_t *out_end,
+                                         const uint8_t *literals, size_t length,
+                                         size_t reserve)
+{
+  if ((size_t)(out_end - op) < 1 + length / 255 + 1 + length + reserve)
+    return NULL;
+
+  if (length >= LZ_RUN_MASK) {
+    *op++ = LZ_RUN_MASK << 4;
+    op = lz_write_length(op, length - LZ_RUN_MASK);
+  } else {
+    *op++ = (uint8_t)(length << 4);
+  }
+
+  memcpy(op, literals, length);
+
+  return op + length;
+}
+
+
+size_t lz_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity)
+{
+  const uint8_t *const base = (const uint8_t *)src;
+  const uint8_t *const in_end = base + src_size;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  uint8_t *const out = (uint8_t *)dst;
+  const uint8_t *const out_end = out + dst_capacity;
+  uint8_t *op = out;
+  // positions of recent 4-byte sequences, relative to base
+  uint32_t table[1 << LZ_HASH_BITS];
+
+  if (src_size > LZ_MAX_INPUT_SIZE)
+    return 0;
+
+  if (src_size > LZ_MF_LIMIT) {
+    const uint8_t *const mf_limit = in_end - LZ_MF_LIMIT;
+    const uint8_t *const match_limit = in_end - LZ_LAST_LITERALS;
+
+    // empty entries point at the start of the input, which is only ever
+    // used if it really matches
+    memset(table, 0, sizeof(table));
+    ++ip;
+
+    for (;;) {
+      const uint8_t *ref;
+      uint8_t *token;
+      size_t match_length;
+      size_t offset;
+      unsigned attempts = 1 << LZ_SKIP_TRIGGER;
+
+      for (;;) {
+        const uint32_t sequence = lz_read32(ip);
+        const uint32_t hash = lz_hash(sequence);
+
+        ref = base + table[hash];
+        table[hash] = (uint32_t)(ip - base);
+
+        if (ip - ref <= LZ_MAX_OFFSET && lz_read32(ref) == sequence)
+          break;
+
+        ip += attempts++ >> LZ_SKIP_TRIGGER;
+        if (ip > mf_limit)
+          goto lz_last_literals;
+      }
+
+      // the match may have started before the sequence that was hashed
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+
+      match_length = LZ_MIN_MATCH + lz_count(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, match_limit);
+      offset = (size_t)(ip - ref);
+
+      // reserve room for the offset and the match length
+      token = op;
+      op = lz_write_literals(op, out_end, anchor, (size_t)(ip - anchor),
+                             2 + (match_length - LZ_MIN_MATCH) / 255 + 1);
+      if (op == NULL)
+        return 0;
+
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8);
+
+      match_length -= LZ_MIN_MATCH;
+      if (match_length >= LZ_RUN_MASK) {
+        *token |= LZ_RUN_MASK;
+        op = lz_write_length(op, match_length - LZ_RUN_MASK);
+      } else {
+        *token |= (uint8_t)match_length;
+      }
+
+      ip += match_length + LZ_MIN_MATCH;
+      anchor = ip;
+
+      if (ip > mf_limit)
+        break;
+
+      // the bytes just matched were never hashed, so catch up a little
+      table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+    }
+  }
+
+lz_last_literals:
+  op = lz_write_literals(op, out_end, anchor, (size_t)(in_end - anchor), 0);
+
+  return op ? (size_t)(op - out) : 0;
+}
+
+
+size_t lz_decompress(const void *src, size_t src_size, void *dst, size_t dst_size)
+{
+  const uint8_t *ip = (const uint8_t *)src;
+  const uint8_t *const ip_end = ip + src_size;
+  uint8_t *const out = (uint8_t *)dst;
+  uint8_t *const op_end = out + dst_size;
+  uint8_t *op = out;
+
+  for (;;) {
+    const uint8_t *match;
+    uint8_t *copy_end;
+    size_t offset;
+    size_t length;
+    unsigned token;
+
+    // every sequence, including the last, has a token
+    if (ip >= ip_end)
+      return LZ_ERROR;
+
+    token = *ip++;
+
+    length = token >> 4;
+    if (length == LZ_RUN_MASK && !lz_read_length(&ip, ip_end, &length))
+      return LZ_ERROR;
+
+    if (length <= LZ_SHORT_COPY && ip_end - ip >= LZ_SHORT_COPY && op_end - op >= LZ_SHORT_COPY) {
+      memcpy(op, ip, LZ_SHORT_COPY);
+    } else {
+      if (length > (size_t)(ip_end - ip) || length > (size_t)(op_end - op))
+        return LZ_ERROR;
+
+      memcpy(op, ip, length);
+    }
+
+    ip += length;
+    op += length;
+
+    // the last sequence is only literals
+    if (ip == ip_end)
+      break;
+
+    if (ip_end - ip < 2)
+      return LZ_ERROR;
+
+    offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+
+    if (offset == 0 || offset > (size_t)(op - out))
+      return LZ_ERROR;
+
+    length = token & LZ_RUN_MASK;
+    if (length == LZ_RUN_MASK && !lz_read_length(&ip, ip_end, &length))
+      return LZ_ERROR;
+
+    length += LZ_MIN_MATCH;
+    if (length > (size_t)(op_end - op))
+      return LZ_ERROR;
+
+    match = op - offset;
+    copy_end = op + length;
+
+    // most matches are short and far enough back to copy as a fixed block
+    if (length <= LZ_SHORT_MATCH && offset >= sizeof(uint64_t) &&
+        (size_t)(op_end - op) >= LZ_SHORT_MATCH) {
+      memcpy(op, match, 8);
+      memcpy(op + 8, match + 8, 8);
+      memcpy(op + 16, match + 16, 2);
+      op = copy_end;
+      continue;
+    }
+
+    if (offset < sizeof(uint64_t)) {
+      // the match overlaps what it's producing. The output repeats every
+      // offset bytes, so after the first few bytes the copy can read from a
+      // multiple of offset back instead, far enough for word copies.
+      const size_t period = offset * ((sizeof(uint64_t) + offset - 1) / offset);
+      size_t head = period < length ? period : length;
+
+      while (head--)
+        *op++ = *match++;
+
+      match = op - period;
+    }
+
+    if ((size_t)(op_end - copy_end) >= sizeof(uint64_t)) {
+      // may write up to 7 bytes past copy_end, which the check above allows
+      while (op < copy_end) {
+        memcpy(op, match, sizeof(uint64_t));
+        op += sizeof(uint64_t);
+        match += sizeof(uint64_t);
+      }
+    } else {
+      while (op < copy_end)
+        *op++ = *match++;
+    }
+
+    op = copy_end;
+  }
+
+  return (size_t)(op - out);
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,53 @@
+#ifndef __SNOW__LZ_H__
+#define __SNOW__LZ_H__ 1
+
+#include <snow-config.h>
+
+#ifdef __SNOW__LZ_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+  Fast LZ77 block compression. The format is the LZ4 block format: a run of
+  sequences, each a token byte holding the literal and match lengths, the
+  literals, then a two-byte little-endian offset back into the output. Any
+  LZ4 block decoder can read what lz_compress writes and vice versa.
+
+  Compression is greedy with a single-entry hash table, so it trades ratio
+  for speed. Decompression never reads or writes outside the buffers it's
+  given, even for corrupt input.
+*/
+
+// Returned by lz_decompress for malformed input or a too-small output
+#define LZ_ERROR ((size_t)-1)
+// Largest input lz_compress accepts
+#define LZ_MAX_INPUT_SIZE ((size_t)0x7E000000)
+
+// Returns the most bytes lz_compress can produce for size bytes of input.
+S_INLINE size_t lz_compress_bound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+// Compresses src_size bytes of src into dst. Returns the compressed size, or
+// 0 if it didn't fit in dst_capacity bytes. A dst_capacity of at least
+// lz_compress_bound(src_size) always fits.
+size_t lz_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity);
+
+// Decompresses src_size bytes of src into dst. Returns the decompressed size,
+// or LZ_ERROR if src is malformed or decompresses to more than dst_size bytes.
+size_t lz_decompress(const void *src, size_t src_size, void *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#include <inline.end>
+
+#endif /* end __SNOW__LZ_H__ include guard */
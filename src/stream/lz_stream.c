@@ -0,0 +1,482 @@
+#define __SNOW__LZ_STREAM_C__
+
+#include "lz_stream.h"
+#include "lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/* context mapping:
+  unknown[0] -> lz_stream_state_t pointer
+*/
+
+#define STATE_INDEX (0)
+
+// LZ4 frame format
+#define LZ_FRAME_MAGIC (0x184D2204U)
+#define LZ_FLG_VERSION_MASK (0xC0)
+#define LZ_FLG_VERSION (0x40)
+#define LZ_FLG_INDEPENDENT (0x20)
+#define LZ_FLG_BLOCK_CHECKSUM (0x10)
+#define LZ_FLG_CONTENT_SIZE (0x08)
+#define LZ_FLG_CONTENT_CHECKSUM (0x04)
+#define LZ_FLG_DICT_ID (0x01)
+// Set in a block's size when the block is stored uncompressed
+#define LZ_BLOCK_STORED (0x80000000U)
+// Written frames: version 1, independent blocks, no checksums, 64KB blocks.
+// The header checksum is the second byte of the XXH32 of the two bytes
+// before it, so it's fixed as well.
+#define LZ_WRITE_FLG (LZ_FLG_VERSION | LZ_FLG_INDEPENDENT)
+#define LZ_WRITE_BD (0x40)
+#define LZ_WRITE_HC (0x82)
+#define LZ_WRITE_BLOCK_SIZE (65536)
+
+typedef struct {
+  stream_t *target;
+  bool close_target;
+  // reading: the FLG byte of the current frame
+  uint8_t flags;
+  // reading: whether the next thing in target is a frame header
+  bool at_frame;
+  // reading: set at the end of target or on an error
+  bool ended;
+  // uncompressed data
+  // writing: bytes waiting to be compressed
+  // reading: the block last decompressed
+  uint8_t *block;
+  size_t block_capacity;
+  size_t block_size;
+  // reading: offset of the next byte to return from block
+  size_t block_pos;
+  // a compressed block
+  uint8_t *packed;
+  // uncompressed bytes before those in block
+  off_t position;
+} lz_stream_state_t;
+
+// STREAM OPS
+
+static size_t lz_stream_write(const void * const p, size_t len, stream_t *stream);
+static size_t lz_stream_read(void * const p, size_t len, stream_t *stream);
+static off_t lz_stream_seek(stream_t *stream, off_t pos, int whence);
+static int lz_stream_eof(stream_t *stream);
+static int lz_stream_close(stream_t *stream);
+
+// compresses and writes out the buffered block
+static int lz_stream_flush_block(stream_t *stream, lz_stream_state_t *state);
+// reads and decompresses the next block. Returns 1 if there was one, 0 at the
+// end of target, or -1 on error.
+static int lz_stream_next_block(stream_t *stream, lz_stream_state_t *state);
+static void lz_stream_free_state(allocator_t *alloc, lz_stream_state_t *state);
+
+
+// IMPLEMENTATION
+
+stream_t *lz_stream(stream_t *target, bool close_target, allocator_t *alloc)
+{
+  stream_t *stream;
+  lz_stream_state_t *state;
+
+  if (!target)
+    return NULL;
+
+  if (!alloc)
+    alloc = g_default_allocator;
+
+  stream = stream_alloc(target->mode, alloc);
+  if (!stream)
+    return NULL;
+
+  state = (lz_stream_state_t *)com_calloc(alloc, 1, sizeof(*state));
+  if (!state)
+    goto lz_stream_error;
+
+  state->target = target;
+  state->close_target = close_target;
+  state->at_frame = true;
+
+  stream->read = lz_stream_read;
+  stream->write = lz_stream_write;
+  stream->seek = lz_stream_seek;
+  stream->eof = lz_stream_eof;
+  stream->close = lz_stream_close;
+  stream->context.unknown[STATE_INDEX] = state;
+
+  // readers allocate once they know the frame's block size
+  if (target->mode != STREAM_READ) {
+    const uint8_t header[3] = { LZ_WRITE_FLG, LZ_WRITE_BD, LZ_WRITE_HC };
+
+    state->block_capacity = LZ_WRITE_BLOCK_SIZE;
+    state->block = (uint8_t *)com_malloc_uninit(alloc, LZ_WRITE_BLOCK_SIZE);
+    state->packed = (uint8_t *)com_malloc_uninit(alloc, LZ_WRITE_BLOCK_SIZE);
+
+    if (!state->block || !state->packed) {
+      s_log_error("Failed to allocate compression buffers.");
+      goto lz_stream_error;
+    }
+
+    if (   stream_write_uint32(target, LZ_FRAME_MAGIC)
+        || stream_write(header, sizeof(header), target) != sizeof(header)) {
+      s_log_error("Failed to write frame header to stream.");
+      goto lz_stream_error;
+    }
+  }
+
+  return stream;
+
+lz_stream_error:
+  lz_stream_free_state(alloc, state);
+  com_free(alloc, stream);
+  return NULL;
+}
+
+
+static void lz_stream_free_state(allocator_t *alloc, lz_stream_state_t *state)
+{
+  if (state) {
+    if (state->block)
+      com_free(alloc, state->block);
+    if (state->packed)
+      com_free(alloc, state->packed);
+    com_free(alloc, state);
+  }
+}
+
+
+static int lz_stream_flush_block(stream_t *stream, lz_stream_state_t *state)
+{
+  const uint8_t *data = state->packed;
+  uint32_t size;
+
+  if (state->block_size == 0)
+    return 0;
+
+  // only keep the compressed block if it's smaller
+  size = (uint32_t)lz_compress(state->block, state->block_size,
+                               state->packed, state->block_size - 1);
+
+  if (size == 0) {
+    data = state->block;
+    size = (uint32_t)state->block_size;
+  }
+
+  if (   stream_write_uint32(state->target, data == state->block ? size | LZ_BLOCK_STORED : size)
+      || stream_write(data, size, state->target) != size) {
+    stream->error = state->target->error;
+    return -1;
+  }
+
+  state->position += (off_t)state->block_size;
+  state->block_size = 0;
+
+  return 0;
+}
+
+
+// reads and discards size bytes of target
+static int lz_stream_skip(lz_stream_state_t *state, size_t size)
+{
+  uint8_t skipped[8];
+
+  while (size) {
+    const size_t chunk = size < sizeof(skipped) ? size : sizeof(skipped);
+
+    if (stream_read(skipped, chunk, state->target) != chunk)
+      return -1;
+
+    size -= chunk;
+  }
+
+  return 0;
+}
+
+
+// reads a frame header. Returns 1 if there was one, 0 at the end of target,
+// or -1 on error.
+static int lz_stream_read_frame(stream_t *stream, lz_stream_state_t *state)
+{
+  allocator_t *alloc = stream->alloc;
+  uint8_t header[6];
+  uint32_t magic;
+  size_t block_max;
+  size_t got;
+
+  got = stream_read(header, sizeof(header), state->target);
+  if (got == 0)
+    return 0;
+  else if (got != sizeof(header))
+    goto lz_stream_bad_frame;
+
+  memcpy(&magic, header, sizeof(magic));
+  magic = (uint32_t)PHYSFS_swapULE32((PHYSFS_uint32)magic);
+
+  if (magic != LZ_FRAME_MAGIC || (header[4] & LZ_FLG_VERSION_MASK) != LZ_FLG_VERSION)
+    goto lz_stream_bad_frame;
+
+  // blocks that refer back to earlier blocks would need the previous 64KB
+  // kept around, which lz_decompress doesn't support
+  if (!(header[4] & LZ_FLG_INDEPENDENT)) {
+    s_log_error("Compressed stream uses linked blocks, which aren't supported.");
+    stream->error = STREAM_ERROR_FAILURE;
+    return -1;
+  }
+
+  // 4 -> 64KB, 5 -> 256KB, 6 -> 1MB, 7 -> 4MB
+  switch ((header[5] >> 4) & 7) {
+    case 4: block_max = 1 << 16; break;
+    case 5: block_max = 1 << 18; break;
+    case 6: block_max = 1 << 20; break;
+    case 7: block_max = 1 << 22; break;
+    default: goto lz_stream_bad_frame;
+  }
+
+  // content size and dictionary ID, then the header checksum
+  if (lz_stream_skip(state, ((header[4] & LZ_FLG_CONTENT_SIZE) ? 8 : 0) +
+                            ((header[4] & LZ_FLG_DICT_ID) ? 4 : 0) + 1))
+    goto lz_stream_bad_frame;
+
+  if (block_max > state->block_capacity) {
+    if (state->block)
+      com_free(alloc, state->block);
+    if (state->packed)
+      com_free(alloc, state->packed);
+    state->block_capacity = 0;
+    state->block = (uint8_t *)com_malloc_uninit(alloc, block_max);
+    state->packed = (uint8_t *)com_malloc_uninit(alloc, block_max);
+
+    if (!state->block || !state->packed) {
+      s_log_error("Failed to allocate decompression buffers.");
+      stream->error = STREAM_ERROR_FAILURE;
+      return -1;
+    }
+
+    state->block_capacity = block_max;
+  }
+
+  state->flags = header[4];
+  state->at_frame = false;
+
+  return 1;
+
+lz_stream_bad_frame:
+  s_log_error("Invalid compressed stream frame header.");
+  stream->error = STREAM_ERROR_FAILURE;
+  return -1;
+}
+
+
+static int lz_stream_next_block(stream_t *stream, lz_stream_state_t *state)
+{
+  uint32_t size;
+  size_t block_size;
+  int result;
+
+  state->position += (off_t)state->block_size;
+  state->block_size = 0;
+  state->block_pos = 0;
+
+  while (!state->ended) {
+    if (state->at_frame) {
+      result = lz_stream_read_frame(stream, state);
+      if (result <= 0) {
+        state->ended = true;
+        return result;
+      }
+    }
+
+    if (stream_read_uint32(state->target, &size))
+      goto lz_stream_bad_block;
+
+    // end of the frame
+    if (size == 0) {
+      if ((state->flags & LZ_FLG_CONTENT_CHECKSUM) && lz_stream_skip(state, 4))
+        goto lz_stream_bad_block;
+
+      state->at_frame = true;
+      continue;
+    }
+
+    block_size = size & ~LZ_BLOCK_STORED;
+    if (block_size > state->block_capacity)
+      goto lz_stream_bad_block;
+
+    if (size & LZ_BLOCK_STORED) {
+      if (stream_read(state->block, block_size, state->target) != block_size)
+        goto lz_stream_bad_block;
+    } else {
+      if (stream_read(state->packed, block_size, state->target) != block_size)
+        goto lz_stream_bad_block;
+
+      block_size = lz_decompress(state->packed, block_size, state->block, state->block_capacity);
+      if (block_size == LZ_ERROR)
+        goto lz_stream_bad_block;
+    }
+
+    if ((state->flags & LZ_FLG_BLOCK_CHECKSUM) && lz_stream_skip(state, 4))
+      goto lz_stream_bad_block;
+
+    if (block_size) {
+      state->block_size = block_size;
+      return 1;
+    }
+  }
+
+  return 0;
+
+lz_stream_bad_block:
+  s_log_error("Invalid or truncated compressed stream block.");
+  stream->error = STREAM_ERROR_FAILURE;
+  state->ended = true;
+  return -1;
+}
+
+
+// STREAM OPS
+
+static size_t lz_stream_write(const void * const p, size_t len, stream_t *stream)
+{
+  lz_stream_state_t *state = (lz_stream_state_t *)stream->context.unknown[STATE_INDEX];
+  const uint8_t *input = (const uint8_t *)p;
+  size_t written = 0;
+
+  while (written < len) {
+    size_t chunk;
+
+    if (state->block_size == state->block_capacity && lz_stream_flush_block(stream, state))
+      break;
+
+    chunk = state->block_capacity - state->block_size;
+    if (chunk > len - written)
+      chunk = len - written;
+
+    memcpy(state->block + state->block_size, input + written, chunk);
+    state->block_size += chunk;
+    written += chunk;
+  }
+
+  return written;
+}
+
+
+static size_t lz_stream_read(void * const p, size_t len, stream_t *stream)
+{
+  lz_stream_state_t *state = (lz_stream_state_t *)stream->context.unknown[STATE_INDEX];
+  uint8_t *output = (uint8_t *)p;
+  size_t read = 0;
+
+  while (read < len) {
+    size_t chunk;
+
+    if (state->block_pos == state->block_size && lz_stream_next_block(stream, state) <= 0)
+      break;
+
+    chunk = state->block_size - state->block_pos;
+    if (chunk > len - read)
+      chunk = len - read;
+
+    memcpy(output + read, state->block + state->block_pos, chunk);
+    state->block_pos += chunk;
+    read += chunk;
+  }
+
+  return read;
+}
+
+
+static off_t lz_stream_seek(stream_t *stream, off_t pos, int whence)
+{
+  lz_stream_state_t *state = (lz_stream_state_t *)stream->context.unknown[STATE_INDEX];
+  const bool reading = stream->mode == STREAM_READ;
+  const off_t current = state->position + (off_t)(reading ? state->block_pos : state->block_size);
+  off_t new_pos;
+
+  switch (whence) {
+    case SEEK_SET:
+      new_pos = pos;
+      break;
+
+    case SEEK_CUR:
+      new_pos = current + pos;
+      break;
+
+    case SEEK_END:
+      stream->error = STREAM_ERROR_SEEK_NOT_PERMITTED;
+      return -1;
+
+    default:
+      stream->error = STREAM_ERROR_INVALID_WHENCE;
+      return -1;
+  }
+
+  if (new_pos == current)
+    return current;
+
+  if (!reading || new_pos < state->position) {
+    stream->error = STREAM_ERROR_SEEK_NOT_PERMITTED;
+    return -1;
+  }
+
+  while (new_pos > state->position + (off_t)state->block_size) {
+    if (lz_stream_next_block(stream, state) <= 0) {
+      stream->error = STREAM_ERROR_OUT_OF_RANGE;
+      return -1;
+    }
+  }
+
+  state->block_pos = (size_t)(new_pos - state->position);
+
+  return new_pos;
+}
+
+
+static int lz_stream_eof(stream_t *stream)
+{
+  lz_stream_state_t *state = (lz_stream_state_t *)stream->context.unknown[STATE_INDEX];
+
+  if (stream->mode != STREAM_READ)
+    return 0;
+  else if (state->block_pos < state->block_size)
+    return 0;
+
+  switch (lz_stream_next_block(stream, state)) {
+    case 0: return 1;
+    case 1: return 0;
+    default: return -1;
+  }
+}
+
+
+static int lz_stream_close(stream_t *stream)
+{
+  lz_stream_state_t *state = (lz_stream_state_t *)stream->context.unknown[STATE_INDEX];
+  int result = 0;
+
+  if (!state) {
+    stream->error = STREAM_ERROR_INVALID_CONTEXT;
+    return -1;
+  }
+
+  if (stream->mode != STREAM_READ) {
+    // last block, then the end mark
+    if (lz_stream_flush_block(stream, state) || stream_write_uint32(state->target, 0)) {
+      s_log_error("Failed to finish compressed stream.");
+      stream->error = STREAM_ERROR_FAILURE;
+      result = -1;
+    }
+  }
+
+  if (state->close_target && stream_close(state->target) != STREAM_ERROR_NONE) {
+    stream->error = STREAM_ERROR_FAILURE;
+    result = -1;
+  }
+
+  lz_stream_free_state(stream->alloc, state);
+  stream->context.unknown[STATE_INDEX] = NULL;
+
+  return result;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
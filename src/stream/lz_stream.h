@@ -0,0 +1,36 @@
+#ifndef __SNOW__LZ_STREAM_H__
+#define __SNOW__LZ_STREAM_H__ 1
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include "stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+  Wraps target in a stream that compresses everything written to it, or
+  decompresses everything read from it, with lz_compress. The new stream has
+  target's mode.
+
+  The data is stored as LZ4 frames, so files written this way can be opened
+  with the lz4 command line tool, and files it writes can be read here as
+  long as they use independent blocks (its default). Checksums in frames
+  from elsewhere are skipped, not verified. Frames written one after another
+  are read back as one stream.
+
+  Writes are buffered 64KB at a time. Closing the stream writes out the last
+  block and ends the frame, so it must be closed even if target is kept.
+
+  Seeking can only report the position in the uncompressed data, or when
+  reading, move forward (by decompressing and discarding) or back within the
+  block last decompressed.
+*/
+stream_t *lz_stream(stream_t *target, bool close_target, allocator_t *alloc);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif /* end __SNOW__LZ_STREAM_H__ include guard */
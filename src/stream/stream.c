@@ -70,7 +70,7 @@ size_t stream_write(const void * const ptr, size_t length, stream_t *stream)
   } else if (stream->mode == STREAM_READ) {
     stream->error = STREAM_ERROR_WRITE_NOT_PERMITTED;
     return 0;
-  } else if (stream->read == NULL) {
+  } else if (stream->write == NULL) {
     stream->error = STREAM_ERROR_WRITE_NOT_SPECIFIED;
     return 0;
   } else if (ptr == NULL) {
@@ -0,0 +1,437 @@
+/*
+  Sorting and searching for arrays
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__ARRAY_SORT_C__
+
+#include "array_sort.h"
+#include <threads/thread.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define RADIX_BITS (8)
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MAX_DIGITS (8)
+
+typedef struct s_sort_job sort_job_t;
+
+/*! A chunk to sort or a pair of runs to merge for array_sort_parallel. */
+struct s_sort_job
+{
+  array_compare_fn_t comparator;
+  size_t obj_size;
+  /*! If set, runs [begin, middle) and [middle, end) of src are merged into
+      dst. Otherwise [begin, end) of dst is sorted in place. */
+  bool merge;
+  const char *src;
+  char *dst;
+  size_t begin;
+  size_t middle;
+  size_t end;
+};
+
+
+/*
+  Reads the key of an element as an unsigned integer that sorts in the same
+  order as the key.
+*/
+static uint64_t radix_key(const char *elem, array_key_t key_type)
+{
+  switch (key_type) {
+  case ARRAY_KEY_UINT32: {
+    uint32_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key;
+  }
+  case ARRAY_KEY_INT32: {
+    uint32_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key ^ 0x80000000U;
+  }
+  case ARRAY_KEY_FLOAT: {
+    uint32_t key;
+    memcpy(&key, elem, sizeof(key));
+    // flip negatives entirely so they sort in reverse, and just the sign bit
+    // of positives so they sort after negatives
+    return key ^ ((uint32_t)-(int32_t)(key >> 31) | 0x80000000U);
+  }
+  case ARRAY_KEY_UINT64: {
+    uint64_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key;
+  }
+  case ARRAY_KEY_INT64: {
+    uint64_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key ^ 0x8000000000000000ULL;
+  }
+  case ARRAY_KEY_DOUBLE: {
+    uint64_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key ^ ((uint64_t)-(int64_t)(key >> 63) | 0x8000000000000000ULL);
+  }
+  }
+
+  return 0;
+}
+
+
+static size_t radix_key_size(array_key_t key_type)
+{
+  switch (key_type) {
+  case ARRAY_KEY_UINT32:
+  case ARRAY_KEY_INT32:
+  case ARRAY_KEY_FLOAT:
+    return 4;
+  case ARRAY_KEY_UINT64:
+  case ARRAY_KEY_INT64:
+  case ARRAY_KEY_DOUBLE:
+    return 8;
+  }
+
+  return 0;
+}
+
+
+bool array_radix_sort(array_t *self, size_t key_offset, array_key_t key_type)
+{
+  size_t counts[RADIX_MAX_DIGITS][RADIX_BUCKETS];
+  size_t key_size;
+  size_t digits;
+  size_t digit;
+  size_t index;
+  size_t obj_size;
+  size_t size;
+  char *src;
+  char *dst;
+  char *scratch;
+
+  if (self == NULL) {
+    s_fatal_error(1, "Cannot sort NULL array.");
+    return false;
+  }
+
+  key_size = radix_key_size(key_type);
+  if (key_size == 0 || key_offset + key_size > self->obj_size) {
+    s_log_error("Radix sort key (%zu bytes at offset %zu) does not fit in a %zu byte element.",
+      key_size, key_offset, self->obj_size);
+    return false;
+  }
+
+  size = self->size;
+  obj_size = self->obj_size;
+  if (size < 2)
+    return true;
+
+  scratch = (char *)com_malloc_uninit(self->allocator, size * obj_size);
+  if (scratch == NULL) {
+    s_log_error("Unable to allocate scratch space to sort %zu elements.", size);
+    return false;
+  }
+
+  digits = key_size;
+  memset(counts, 0, sizeof(counts[0]) * digits);
+
+  // histogram every digit in a single pass
+  for (index = 0; index < size; ++index) {
+    uint64_t key = radix_key(self->buf + index * obj_size + key_offset, key_type);
+    for (digit = 0; digit < digits; ++digit)
+      counts[digit][(key >> (digit * RADIX_BITS)) & (RADIX_BUCKETS - 1)] += 1;
+  }
+
+  src = self->buf;
+  dst = scratch;
+
+  for (digit = 0; digit < digits; ++digit) {
+    size_t *count = counts[digit];
+    const unsigned shift = (unsigned)(digit * RADIX_BITS);
+    size_t offset = 0;
+    size_t bucket;
+    char *swap;
+
+    // skip digits that are the same for every element
+    if (count[(radix_key(src + key_offset, key_type) >> shift) & (RADIX_BUCKETS - 1)] == size)
+      continue;
+
+    for (bucket = 0; bucket < RADIX_BUCKETS; ++bucket) {
+      size_t bucket_size = count[bucket];
+      count[bucket] = offset;
+      offset += bucket_size;
+    }
+
+    for (index = 0; index < size; ++index) {
+      const char *elem = src + index * obj_size;
+      uint64_t key = radix_key(elem + key_offset, key_type);
+      size_t *slot = &count[(key >> shift) & (RADIX_BUCKETS - 1)];
+      memcpy(dst + *slot * obj_size, elem, obj_size);
+      *slot += 1;
+    }
+
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != self->buf)
+    memcpy(self->buf, src, size * obj_size);
+
+  com_free(self->allocator, scratch);
+
+  return true;
+}
+
+
+static void *array_sort_worker(void *context)
+{
+  sort_job_t *job = (sort_job_t *)context;
+  const size_t obj_size = job->obj_size;
+
+  if (! job->merge) {
+    qsort(job->dst + job->begin * obj_size, job->end - job->begin, obj_size, job->comparator);
+  } else {
+    const char *left = job->src + job->begin * obj_size;
+    const char *left_end = job->src + job->middle * obj_size;
+    const char *right = left_end;
+    const char *right_end = job->src + job->end * obj_size;
+    char *out = job->dst + job->begin * obj_size;
+
+    // take from the left run on ties to keep the merge stable
+    while (left < left_end && right < right_end) {
+      if (job->comparator(right, left) < 0) {
+        memcpy(out, right, obj_size);
+        right += obj_size;
+      } else {
+        memcpy(out, left, obj_size);
+        left += obj_size;
+      }
+      out += obj_size;
+    }
+
+    if (left < left_end)
+      memcpy(out, left, (size_t)(left_end - left));
+    else if (right < right_end)
+      memcpy(out, right, (size_t)(right_end - right));
+  }
+
+  return NULL;
+}
+
+
+/*
+  Runs every job, each on its own thread except the first, which runs on the
+  calling thread. Jobs whose thread can't be created also run on the calling
+  thread.
+*/
+static void array_sort_run_jobs(sort_job_t *jobs, int count)
+{
+  thread_t threads[ARRAY_PARALLEL_SORT_MAX_THREADS];
+  bool started[ARRAY_PARALLEL_SORT_MAX_THREADS];
+  int index;
+
+  for (index = 1; index < count; ++index)
+    started[index] = thread_create(&threads[index], array_sort_worker, &jobs[index]) == 0;
+
+  array_sort_worker(&jobs[0]);
+
+  for (index = 1; index < count; ++index) {
+    if (started[index])
+      thread_join(threads[index], NULL);
+    else
+      array_sort_worker(&jobs[index]);
+  }
+}
+
+
+bool array_sort_parallel(array_t *self, array_compare_fn_t comparator, int threads)
+{
+  sort_job_t jobs[ARRAY_PARALLEL_SORT_MAX_THREADS];
+  size_t bounds[ARRAY_PARALLEL_SORT_MAX_THREADS + 1];
+  int runs;
+  int index;
+  size_t size;
+  size_t obj_size;
+  char *src;
+  char *dst;
+  char *scratch;
+
+  if (self == NULL) {
+    s_fatal_error(1, "Cannot sort NULL array.");
+    return false;
+  }
+
+  size = self->size;
+  obj_size = self->obj_size;
+
+  if (threads > ARRAY_PARALLEL_SORT_MAX_THREADS)
+    threads = ARRAY_PARALLEL_SORT_MAX_THREADS;
+
+  if (threads < 2 || size < ARRAY_PARALLEL_SORT_MIN)
+    return array_sort(self, comparator);
+
+  scratch = (char *)com_malloc_uninit(self->allocator, size * obj_size);
+  if (scratch == NULL) {
+    s_log_error("Unable to allocate scratch space to sort %zu elements.", size);
+    return false;
+  }
+
+  runs = threads;
+  for (index = 0; index <= runs; ++index)
+    bounds[index] = size * (size_t)index / (size_t)runs;
+
+  for (index = 0; index < runs; ++index) {
+    jobs[index].comparator = comparator;
+    jobs[index].obj_size = obj_size;
+    jobs[index].merge = false;
+    jobs[index].src = NULL;
+    jobs[index].dst = self->buf;
+    jobs[index].begin = bounds[index];
+    jobs[index].middle = 0;
+    jobs[index].end = bounds[index + 1];
+  }
+
+  array_sort_run_jobs(jobs, runs);
+
+  src = self->buf;
+  dst = scratch;
+
+  while (runs > 1) {
+    const int merged = (runs + 1) / 2;
+    char *swap;
+
+    for (index = 0; index < merged; ++index) {
+      const int left = index * 2;
+      jobs[index].comparator = comparator;
+      jobs[index].obj_size = obj_size;
+      jobs[index].merge = true;
+      jobs[index].src = src;
+      jobs[index].dst = dst;
+      jobs[index].begin = bounds[left];
+      if (left + 1 < runs) {
+        jobs[index].middle = bounds[left + 1];
+        jobs[index].end = bounds[left + 2];
+      } else {
+        // odd run out -- merging it with an empty run just copies it
+        jobs[index].middle = bounds[left + 1];
+        jobs[index].end = bounds[left + 1];
+      }
+    }
+
+    array_sort_run_jobs(jobs, merged);
+
+    for (index = 0; index <= merged; ++index)
+      bounds[index] = bounds[index * 2 < runs ? index * 2 : runs];
+
+    runs = merged;
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != self->buf)
+    memcpy(self->buf, src, size * obj_size);
+
+  com_free(self->allocator, scratch);
+
+  return true;
+}
+
+
+size_t array_lower_bound(const array_t *self, const void *key, array_compare_fn_t comparator)
+{
+  size_t low = 0;
+  size_t count;
+
+  if (self == NULL) {
+    s_fatal_error(1, "Cannot search NULL array.");
+    return 0;
+  }
+
+  count = self->size;
+  while (count > 0) {
+    size_t step = count / 2;
+    if (comparator(self->buf + (low + step) * self->obj_size, key) < 0) {
+      low += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+
+  return low;
+}
+
+
+size_t array_upper_bound(const array_t *self, const void *key, array_compare_fn_t comparator)
+{
+  size_t low = 0;
+  size_t count;
+
+  if (self == NULL) {
+    s_fatal_error(1, "Cannot search NULL array.");
+    return 0;
+  }
+
+  count = self->size;
+  while (count > 0) {
+    size_t step = count / 2;
+    if (comparator(key, self->buf + (low + step) * self->obj_size) >= 0) {
+      low += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+
+  return low;
+}
+
+
+bool array_binary_search(const array_t *self, const void *key, array_compare_fn_t comparator, size_t *index)
+{
+  size_t found = array_lower_bound(self, key, comparator);
+
+  if (self == NULL || found == self->size ||
+      comparator(self->buf + found * self->obj_size, key) != 0)
+    return false;
+
+  if (index)
+    *index = found;
+
+  return true;
+}
+
+
+void *array_insert_sorted(array_t *self, const void *value, array_compare_fn_t comparator)
+{
+  size_t index;
+  char *slot;
+
+  if (self == NULL) {
+    s_fatal_error(1, "Cannot insert into NULL array.");
+    return NULL;
+  } else if (value == NULL) {
+    s_fatal_error(1, "Cannot insert NULL value into sorted array.");
+    return NULL;
+  }
+
+  index = array_upper_bound(self, value, comparator);
+
+  if (self->size == self->capacity && !array_reserve(self, self->size + 1))
+    return NULL;
+
+  slot = self->buf + index * self->obj_size;
+  memmove(slot + self->obj_size, slot, (self->size - index) * self->obj_size);
+  memcpy(slot, value, self->obj_size);
+  self->size += 1;
+
+  return slot;
+}
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
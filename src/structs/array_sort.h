@@ -0,0 +1,431 @@
+/*
+  Sorting and searching for arrays
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__ARRAY_SORT_H__
+
+#define __SNOW__ARRAY_SORT_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include "dynarray.h"
+
+/*!
+  \file
+
+  Sort and search routines for array_t beyond the qsort wrapper array_sort.
+
+  - ::array_radix_sort sorts by an integer or floating point key stored at a
+    fixed offset in each element, with no comparisons at all.
+  - ::array_sort_parallel sorts chunks of a large array on several threads
+    and merges them.
+  - ::array_lower_bound, ::array_upper_bound, ::array_binary_search and
+    ::array_insert_sorted work on arrays already sorted by a comparator.
+  - DEFINE_ARRAY_SORT generates the same operations for a DEFINE_ARRAY type
+    with the comparison inlined.
+*/
+
+#ifdef __SNOW__ARRAY_SORT_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+typedef int (*array_compare_fn_t)(const void *left, const void *right);
+
+/*! Type of the key read by ::array_radix_sort. */
+typedef enum
+{
+  ARRAY_KEY_UINT32,
+  ARRAY_KEY_INT32,
+  ARRAY_KEY_FLOAT,
+  ARRAY_KEY_UINT64,
+  ARRAY_KEY_INT64,
+  ARRAY_KEY_DOUBLE
+} array_key_t;
+
+/*! Arrays smaller than this are sorted on the calling thread by
+    ::array_sort_parallel. */
+#define ARRAY_PARALLEL_SORT_MIN (16384)
+/*! Most threads ::array_sort_parallel will use. */
+#define ARRAY_PARALLEL_SORT_MAX_THREADS (16)
+
+/*!
+ * Sorts the array in ascending order of the key_type value at key_offset
+ * bytes into each element, using a least-significant-digit radix sort. The
+ * sort is stable. Negative floats sort before positive ones, and NaNs sort
+ * by their bit patterns. Needs scratch space the size of the array from the
+ * array's allocator. Returns false if the key doesn't fit in an element or
+ * the scratch space can't be allocated.
+ */
+bool array_radix_sort(array_t *self, size_t key_offset, array_key_t key_type);
+
+/*!
+ * Sorts the array with the comparator using up to threads threads. The array
+ * is split into one chunk per thread, each chunk is sorted with qsort, and
+ * the chunks are merged pairwise, also in parallel. Needs scratch space the
+ * size of the array from the array's allocator. Arrays with fewer than
+ * ARRAY_PARALLEL_SORT_MIN elements are passed to array_sort.
+ */
+bool array_sort_parallel(array_t *self, array_compare_fn_t comparator, int threads);
+
+/*!
+ * Returns the index of the first element of a sorted array that doesn't
+ * compare less than key, or the array's size if there is none. key points to
+ * a value laid out like an element; only the fields the comparator reads need
+ * to be set.
+ */
+size_t array_lower_bound(const array_t *self, const void *key, array_compare_fn_t comparator);
+/*!
+ * Returns the index of the first element of a sorted array that compares
+ * greater than key, or the array's size if there is none.
+ */
+size_t array_upper_bound(const array_t *self, const void *key, array_compare_fn_t comparator);
+/*!
+ * Searches a sorted array for an element comparing equal to key. If one is
+ * found, stores its index in index (if not NULL) and returns true.
+ */
+bool array_binary_search(const array_t *self, const void *key, array_compare_fn_t comparator, size_t *index);
+/*!
+ * Copies value into a sorted array after any elements that compare equal to
+ * it, keeping the array sorted. Returns a pointer to the new element, or NULL
+ * if the array couldn't grow.
+ */
+void *array_insert_sorted(array_t *self, const void *value, array_compare_fn_t comparator);
+
+/*
+  Typed sorting
+
+  DEFINE_ARRAY_SORT(TYPE, NAME, LESS) adds sort and search routines to NAME_t,
+  which must already be defined with DEFINE_ARRAY(TYPE, NAME). LESS(a, b) is
+  an expression taking two `const TYPE *` and evaluating to nonzero if *a
+  sorts before *b -- a macro, so the comparison is inlined:
+
+    #define EVENT_TIME_LESS(A, B) ((A)->time < (B)->time)
+    DEFINE_ARRAY_SORT(event_t, event_array, EVENT_TIME_LESS)
+
+  defines:
+
+    NAME_sort(NAME_t *) and NAME_sort_range(TYPE *begin, TYPE *end)
+      Unstable pattern-defeating quicksort: quicksort with insertion sort for
+      small ranges, a median-of-three (ninther for large ranges) pivot,
+      partitioning that puts runs of equal elements in place, an early exit
+      for ranges that are already sorted, and a fall back to heapsort once
+      too many partitions come out badly unbalanced, so the worst case is
+      O(n log n).
+    NAME_lower_bound(const NAME_t *, const TYPE *key)
+    NAME_upper_bound(const NAME_t *, const TYPE *key)
+      As ::array_lower_bound and ::array_upper_bound.
+    NAME_insert_sorted(NAME_t *, TYPE value)
+      As ::array_insert_sorted.
+*/
+#define ARRAY_SORT_INSERTION_LIMIT (24)
+#define ARRAY_SORT_NINTHER_LIMIT (128)
+#define ARRAY_SORT_PARTIAL_LIMIT (8)
+
+#define DEFINE_ARRAY_SORT(TYPE, NAME, LESS) \
+  static inline void NAME##_sort_swap(TYPE *a, TYPE *b) \
+  { \
+    TYPE tmp = *a; \
+    *a = *b; \
+    *b = tmp; \
+  } \
+  \
+  static inline void NAME##_sort_sort3(TYPE *a, TYPE *b, TYPE *c) \
+  { \
+    if (LESS(b, a)) NAME##_sort_swap(a, b); \
+    if (LESS(c, b)) NAME##_sort_swap(b, c); \
+    if (LESS(b, a)) NAME##_sort_swap(a, b); \
+  } \
+  \
+  static inline void NAME##_sort_insertion(TYPE *begin, TYPE *end) \
+  { \
+    TYPE *cur; \
+    if (begin == end) return; \
+    for (cur = begin + 1; cur != end; ++cur) { \
+      TYPE *sift = cur; \
+      if (LESS(cur, cur - 1)) { \
+        TYPE tmp = *cur; \
+        do { \
+          *sift = *(sift - 1); \
+          --sift; \
+        } while (sift != begin && LESS(&tmp, sift - 1)); \
+        *sift = tmp; \
+      } \
+    } \
+  } \
+  \
+  /* Insertion sort that assumes *(begin - 1) sorts before every element */ \
+  static inline void NAME##_sort_insertion_unguarded(TYPE *begin, TYPE *end) \
+  { \
+    TYPE *cur; \
+    if (begin == end) return; \
+    for (cur = begin + 1; cur != end; ++cur) { \
+      TYPE *sift = cur; \
+      if (LESS(cur, cur - 1)) { \
+        TYPE tmp = *cur; \
+        do { \
+          *sift = *(sift - 1); \
+          --sift; \
+        } while (LESS(&tmp, sift - 1)); \
+        *sift = tmp; \
+      } \
+    } \
+  } \
+  \
+  /* Insertion sort that gives up once it has moved too many elements */ \
+  static inline bool NAME##_sort_insertion_partial(TYPE *begin, TYPE *end) \
+  { \
+    TYPE *cur; \
+    size_t moved = 0; \
+    if (begin == end) return true; \
+    for (cur = begin + 1; cur != end; ++cur) { \
+      TYPE *sift = cur; \
+      if (LESS(cur, cur - 1)) { \
+        TYPE tmp = *cur; \
+        do { \
+          *sift = *(sift - 1); \
+          --sift; \
+        } while (sift != begin && LESS(&tmp, sift - 1)); \
+        *sift = tmp; \
+        moved += (size_t)(cur - sift); \
+      } \
+      if (moved > ARRAY_SORT_PARTIAL_LIMIT) \
+        return false; \
+    } \
+    return true; \
+  } \
+  \
+  static inline void NAME##_sort_sift_down(TYPE *base, size_t index, size_t count) \
+  { \
+    TYPE tmp = base[index]; \
+    size_t child; \
+    while ((child = index * 2 + 1) < count) { \
+      if (child + 1 < count && LESS(&base[child], &base[child + 1])) \
+        ++child; \
+      if (!LESS(&tmp, &base[child])) \
+        break; \
+      base[index] = base[child]; \
+      index = child; \
+    } \
+    base[index] = tmp; \
+  } \
+  \
+  static inline void NAME##_sort_heap(TYPE *begin, TYPE *end) \
+  { \
+    size_t count = (size_t)(end - begin); \
+    size_t index = count / 2; \
+    while (index-- > 0) \
+      NAME##_sort_sift_down(begin, index, count); \
+    while (count-- > 1) { \
+      NAME##_sort_swap(begin, begin + count); \
+      NAME##_sort_sift_down(begin, 0, count); \
+    } \
+  } \
+  \
+  /* Partitions around *begin, placing elements equal to it on the right. \
+     Sets *already_partitioned if no elements had to be swapped. */ \
+  static inline TYPE *NAME##_sort_partition_right(TYPE *begin, TYPE *end, bool *already_partitioned) \
+  { \
+    TYPE pivot = *begin; \
+    TYPE *first = begin; \
+    TYPE *last = end; \
+    TYPE *pivot_pos; \
+    while (LESS(++first, &pivot)) ; \
+    if (first - 1 == begin) { \
+      while (first < last && !LESS(--last, &pivot)) ; \
+    } else { \
+      while (!LESS(--last, &pivot)) ; \
+    } \
+    *already_partitioned = first >= last; \
+    while (first < last) { \
+      NAME##_sort_swap(first, last); \
+      while (LESS(++first, &pivot)) ; \
+      while (!LESS(--last, &pivot)) ; \
+    } \
+    pivot_pos = first - 1; \
+    *begin = *pivot_pos; \
+    *pivot_pos = pivot; \
+    return pivot_pos; \
+  } \
+  \
+  /* Partitions around *begin, placing elements equal to it on the left. \
+     Used when the pivot equals the element before the range, so everything \
+     on the left afterward equals the pivot and is already in place. */ \
+  static inline TYPE *NAME##_sort_partition_left(TYPE *begin, TYPE *end) \
+  { \
+    TYPE pivot = *begin; \
+    TYPE *first = begin; \
+    TYPE *last = end; \
+    while (LESS(&pivot, --last)) ; \
+    if (last + 1 == end) { \
+      while (first < last && !LESS(&pivot, ++first)) ; \
+    } else { \
+      while (!LESS(&pivot, ++first)) ; \
+    } \
+    while (first < last) { \
+      NAME##_sort_swap(first, last); \
+      while (LESS(&pivot, --last)) ; \
+      while (!LESS(&pivot, ++first)) ; \
+    } \
+    *begin = *last; \
+    *last = pivot; \
+    return last; \
+  } \
+  \
+  /* Swaps a few elements of an unbalanced partition around to break up \
+     patterns that keep producing bad pivots. */ \
+  static inline void NAME##_sort_shuffle(TYPE *begin, TYPE *end) \
+  { \
+    size_t size = (size_t)(end - begin); \
+    size_t quarter = size / 4; \
+    if (size < ARRAY_SORT_INSERTION_LIMIT) return; \
+    NAME##_sort_swap(begin, begin + quarter); \
+    NAME##_sort_swap(end - 1, end - quarter); \
+    if (size > ARRAY_SORT_NINTHER_LIMIT) { \
+      NAME##_sort_swap(begin + 1, begin + quarter + 1); \
+      NAME##_sort_swap(begin + 2, begin + quarter + 2); \
+      NAME##_sort_swap(end - 2, end - quarter - 1); \
+      NAME##_sort_swap(end - 3, end - quarter - 2); \
+    } \
+  } \
+  \
+  static void NAME##_sort_loop(TYPE *begin, TYPE *end, int bad_allowed, bool leftmost) \
+  { \
+    for (;;) { \
+      size_t size = (size_t)(end - begin); \
+      size_t half = size / 2; \
+      TYPE *pivot_pos; \
+      bool already_partitioned; \
+      size_t left_size, right_size; \
+      \
+      if (size < ARRAY_SORT_INSERTION_LIMIT) { \
+        if (leftmost) \
+          NAME##_sort_insertion(begin, end); \
+        else \
+          NAME##_sort_insertion_unguarded(begin, end); \
+        return; \
+      } \
+      \
+      if (size > ARRAY_SORT_NINTHER_LIMIT) { \
+        NAME##_sort_sort3(begin, begin + half, end - 1); \
+        NAME##_sort_sort3(begin + 1, begin + (half - 1), end - 2); \
+        NAME##_sort_sort3(begin + 2, begin + (half + 1), end - 3); \
+        NAME##_sort_sort3(begin + (half - 1), begin + half, begin + (half + 1)); \
+        NAME##_sort_swap(begin, begin + half); \
+      } else { \
+        NAME##_sort_sort3(begin + half, begin, end - 1); \
+      } \
+      \
+      if (!leftmost && !LESS(begin - 1, begin)) { \
+        begin = NAME##_sort_partition_left(begin, end) + 1; \
+        continue; \
+      } \
+      \
+      pivot_pos = NAME##_sort_partition_right(begin, end, &already_partitioned); \
+      left_size = (size_t)(pivot_pos - begin); \
+      right_size = (size_t)(end - (pivot_pos + 1)); \
+      \
+      if (left_size < size / 8 || right_size < size / 8) { \
+        if (--bad_allowed == 0) { \
+          NAME##_sort_heap(begin, end); \
+          return; \
+        } \
+        NAME##_sort_shuffle(begin, pivot_pos); \
+        NAME##_sort_shuffle(pivot_pos + 1, end); \
+      } else if (already_partitioned && \
+                 NAME##_sort_insertion_partial(begin, pivot_pos) && \
+                 NAME##_sort_insertion_partial(pivot_pos + 1, end)) { \
+        return; \
+      } \
+      \
+      /* recurse into the smaller side to bound the stack depth */ \
+      if (left_size < right_size) { \
+        NAME##_sort_loop(begin, pivot_pos, bad_allowed, leftmost); \
+        begin = pivot_pos + 1; \
+        leftmost = false; \
+      } else { \
+        NAME##_sort_loop(pivot_pos + 1, end, bad_allowed, false); \
+        end = pivot_pos; \
+      } \
+    } \
+  } \
+  \
+  static inline void NAME##_sort_range(TYPE *begin, TYPE *end) \
+  { \
+    size_t size = (size_t)(end - begin); \
+    int log2_size = 0; \
+    while (size >>= 1) \
+      ++log2_size; \
+    if (begin != end) \
+      NAME##_sort_loop(begin, end, log2_size + 1, true); \
+  } \
+  \
+  static inline void NAME##_sort(NAME##_t *self) \
+  { \
+    TYPE *base = (TYPE *)self->array.buf; \
+    NAME##_sort_range(base, base + self->array.size); \
+  } \
+  \
+  static inline size_t NAME##_lower_bound(const NAME##_t *self, const TYPE *key) \
+  { \
+    const TYPE *base = (const TYPE *)self->array.buf; \
+    size_t low = 0; \
+    size_t count = self->array.size; \
+    while (count > 0) { \
+      size_t step = count / 2; \
+      if (LESS(&base[low + step], key)) { \
+        low += step + 1; \
+        count -= step + 1; \
+      } else { \
+        count = step; \
+      } \
+    } \
+    return low; \
+  } \
+  \
+  static inline size_t NAME##_upper_bound(const NAME##_t *self, const TYPE *key) \
+  { \
+    const TYPE *base = (const TYPE *)self->array.buf; \
+    size_t low = 0; \
+    size_t count = self->array.size; \
+    while (count > 0) { \
+      size_t step = count / 2; \
+      if (!LESS(key, &base[low + step])) { \
+        low += step + 1; \
+        count -= step + 1; \
+      } else { \
+        count = step; \
+      } \
+    } \
+    return low; \
+  } \
+  \
+  static inline TYPE *NAME##_insert_sorted(NAME##_t *self, TYPE value) \
+  { \
+    size_t index = NAME##_upper_bound(self, &value); \
+    TYPE *slot; \
+    if (self->array.size == self->array.capacity && \
+        !array_reserve(&self->array, self->array.size + 1)) \
+      return NULL; \
+    slot = (TYPE *)self->array.buf + index; \
+    memmove(slot + 1, slot, (self->array.size - index) * sizeof(TYPE)); \
+    *slot = value; \
+    ++self->array.size; \
+    return slot; \
+  }
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__ARRAY_SORT_H__ */
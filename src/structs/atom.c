@@ -0,0 +1,313 @@
+/*
+  Interned strings
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__ATOM_C__
+
+#include "atom.h"
+#include <threads/mutex.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Size of the blocks atoms are carved from. Strings too long to share a
+   block sensibly get a block of their own. */
+#define ATOM_BLOCK_SIZE (16384)
+#define ATOM_BLOCK_SHARED_MAX (ATOM_BLOCK_SIZE / 4)
+#define ATOM_TABLE_MIN_CAPACITY (256)
+
+typedef struct s_atom_block atom_block_t;
+typedef struct s_atom_table atom_table_t;
+
+struct s_atom_block
+{
+  atom_block_t *next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+/*
+  Open-addressed table of atoms with linear probing, kept at most half full.
+  Slots only ever go from NULL to an atom, so readers can probe without
+  locking: an acquire load of a slot either sees NULL, ending the probe, or
+  a fully written atom.
+
+  Growing replaces the table outright. Readers may still be probing the old
+  one, so it's kept on the retired chain until shutdown. Since each table
+  is twice the size of the last, the retired tables never add up to more
+  than the current one.
+*/
+struct s_atom_table
+{
+  atom_table_t *retired;
+  size_t mask;
+  atom_t slots[];
+};
+
+static allocator_t *g_atom_alloc = NULL;
+static mutex_t g_atom_lock;
+static atom_table_t *g_atom_table = NULL;
+static atom_block_t *g_atom_blocks = NULL;
+static size_t g_atom_count = 0;
+
+
+static size_t atom_hash_bytes(const char *str, size_t length)
+{
+  // 64-bit FNV-1a, folded for 32-bit size_t
+  uint64_t hash = 14695981039346656037ULL;
+
+  while (length--) {
+    hash ^= (unsigned char)*str++;
+    hash *= 1099511628211ULL;
+  }
+
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+
+static atom_table_t *atom_table_new(size_t capacity)
+{
+  atom_table_t *table = (atom_table_t *)com_calloc(g_atom_alloc, 1,
+                                                   sizeof(*table) + capacity * sizeof(atom_t));
+
+  if (table == NULL) {
+    s_log_error("Unable to allocate atom table of %zu slots.", capacity);
+    return NULL;
+  }
+
+  table->mask = capacity - 1;
+
+  return table;
+}
+
+
+static atom_t atom_table_find(const atom_table_t *table, const char *str, size_t length, size_t hash)
+{
+  size_t index = hash & table->mask;
+
+  for (;;) {
+    atom_t atom = __atomic_load_n(&table->slots[index], __ATOMIC_ACQUIRE);
+
+    if (atom == NULL)
+      return NULL;
+
+    if (atom->hash == hash && atom->length == length && memcmp(atom->str, str, length) == 0)
+      return atom;
+
+    index = (index + 1) & table->mask;
+  }
+}
+
+
+/* Only called with the lock held. */
+static void atom_table_insert(atom_table_t *table, atom_t atom)
+{
+  size_t index = atom->hash & table->mask;
+
+  while (table->slots[index] != NULL)
+    index = (index + 1) & table->mask;
+
+  __atomic_store_n(&table->slots[index], atom, __ATOMIC_RELEASE);
+}
+
+
+/* Only called with the lock held. */
+static atom_table_t *atom_table_grow(atom_table_t *table)
+{
+  const size_t capacity = table->mask + 1;
+  atom_table_t *grown = atom_table_new(capacity * 2);
+  size_t index;
+
+  if (grown == NULL)
+    return NULL;
+
+  for (index = 0; index < capacity; ++index) {
+    if (table->slots[index])
+      atom_table_insert(grown, table->slots[index]);
+  }
+
+  grown->retired = table;
+  __atomic_store_n(&g_atom_table, grown, __ATOMIC_RELEASE);
+
+  return grown;
+}
+
+
+/* Only called with the lock held. */
+static atom_data_t *atom_alloc(const char *str, size_t length, size_t hash)
+{
+  const size_t align = sizeof(size_t);
+  const size_t size = (sizeof(atom_data_t) + length + 1 + align - 1) & ~(align - 1);
+  atom_block_t *block = g_atom_blocks;
+  atom_data_t *atom;
+
+  if (size > ATOM_BLOCK_SHARED_MAX) {
+    block = (atom_block_t *)com_malloc_uninit(g_atom_alloc, sizeof(*block) + size);
+    if (block == NULL)
+      goto atom_alloc_error;
+
+    block->used = 0;
+    block->size = size;
+
+    // keep the block being filled at the head of the list
+    if (g_atom_blocks) {
+      block->next = g_atom_blocks->next;
+      g_atom_blocks->next = block;
+    } else {
+      block->next = NULL;
+      g_atom_blocks = block;
+    }
+  } else if (block == NULL || block->size - block->used < size) {
+    block = (atom_block_t *)com_malloc_uninit(g_atom_alloc, sizeof(*block) + ATOM_BLOCK_SIZE);
+    if (block == NULL)
+      goto atom_alloc_error;
+
+    block->next = g_atom_blocks;
+    block->used = 0;
+    block->size = ATOM_BLOCK_SIZE;
+    g_atom_blocks = block;
+  }
+
+  atom = (atom_data_t *)(block->data + block->used);
+  block->used += size;
+
+  atom->hash = hash;
+  atom->length = length;
+  memcpy(atom->str, str, length);
+  atom->str[length] = '\0';
+
+  return atom;
+
+atom_alloc_error:
+  s_log_error("Unable to allocate atom of %zu bytes.", length);
+  return NULL;
+}
+
+
+void sys_atoms_init(allocator_t *alloc)
+{
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  g_atom_alloc = alloc;
+  g_atom_blocks = NULL;
+  g_atom_count = 0;
+  mutex_init(&g_atom_lock, false);
+
+  __atomic_store_n(&g_atom_table, atom_table_new(ATOM_TABLE_MIN_CAPACITY), __ATOMIC_RELEASE);
+}
+
+
+void sys_atoms_shutdown(void)
+{
+  atom_table_t *table = g_atom_table;
+  atom_block_t *block = g_atom_blocks;
+
+  mutex_lock(&g_atom_lock);
+
+  while (table) {
+    atom_table_t *retired = table->retired;
+    com_free(g_atom_alloc, table);
+    table = retired;
+  }
+
+  while (block) {
+    atom_block_t *next = block->next;
+    com_free(g_atom_alloc, block);
+    block = next;
+  }
+
+  __atomic_store_n(&g_atom_table, NULL, __ATOMIC_RELEASE);
+  g_atom_blocks = NULL;
+  g_atom_count = 0;
+
+  mutex_unlock(&g_atom_lock);
+  mutex_destroy(&g_atom_lock);
+}
+
+
+atom_t atom_find_length(const char *str, size_t length)
+{
+  const atom_table_t *table = __atomic_load_n(&g_atom_table, __ATOMIC_ACQUIRE);
+
+  if (str == NULL)
+    return NULL;
+
+  if (table == NULL) {
+    s_log_error("Atom table used before sys_atoms_init.");
+    return NULL;
+  }
+
+  return atom_table_find(table, str, length, atom_hash_bytes(str, length));
+}
+
+
+atom_t atom_find(const char *str)
+{
+  return str ? atom_find_length(str, strlen(str)) : NULL;
+}
+
+
+atom_t atom_intern_length(const char *str, size_t length)
+{
+  atom_table_t *table = __atomic_load_n(&g_atom_table, __ATOMIC_ACQUIRE);
+  size_t hash;
+  atom_t atom;
+
+  if (str == NULL)
+    return NULL;
+
+  if (table == NULL) {
+    s_log_error("Atom table used before sys_atoms_init.");
+    return NULL;
+  }
+
+  hash = atom_hash_bytes(str, length);
+  atom = atom_table_find(table, str, length, hash);
+  if (atom)
+    return atom;
+
+  mutex_lock(&g_atom_lock);
+
+  // look again -- another thread may have added it or grown the table
+  table = g_atom_table;
+  atom = atom_table_find(table, str, length, hash);
+
+  if (atom == NULL) {
+    if ((g_atom_count + 1) * 2 > table->mask + 1)
+      table = atom_table_grow(table);
+
+    if (table)
+      atom = atom_alloc(str, length, hash);
+
+    if (atom) {
+      atom_table_insert(table, atom);
+      __atomic_store_n(&g_atom_count, g_atom_count + 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  mutex_unlock(&g_atom_lock);
+
+  return atom;
+}
+
+
+atom_t atom_intern(const char *str)
+{
+  return str ? atom_intern_length(str, strlen(str)) : NULL;
+}
+
+
+size_t atom_count(void)
+{
+  return __atomic_load_n(&g_atom_count, __ATOMIC_RELAXED);
+}
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
@@ -0,0 +1,93 @@
+/*
+  Interned strings
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__ATOM_H__
+
+#define __SNOW__ATOM_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+
+/*!
+  \file
+
+  Atoms are interned strings. Interning the same string twice gives the same
+  atom_t, so atoms compare equal exactly when their pointers do. Each atom
+  stores its length and a precomputed hash alongside its characters. The
+  characters are NUL-terminated, so ::atom_str can be passed anywhere a C
+  string is expected.
+
+  Atoms live until ::sys_atoms_shutdown. Their storage is carved out of
+  large blocks taken from the table's allocator and is never freed
+  individually.
+
+  Looking up an atom that already exists takes no lock. Only adding a new
+  atom locks the table. Every routine may be called from any thread between
+  ::sys_atoms_init and ::sys_atoms_shutdown.
+*/
+
+#ifdef __SNOW__ATOM_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+typedef struct s_atom atom_data_t;
+typedef const atom_data_t *atom_t;
+
+struct s_atom
+{
+  size_t hash;
+  size_t length;
+  char str[];
+};
+
+/*! Initializes the global atom table. */
+void sys_atoms_init(allocator_t *alloc);
+/*! Destroys the global atom table, releasing every atom. */
+void sys_atoms_shutdown(void);
+
+/*! Returns the atom for the NUL-terminated string str, adding it if needed.
+    Returns NULL if str is NULL or the atom couldn't be allocated. */
+atom_t atom_intern(const char *str);
+/*! Returns the atom for the first length bytes of str, adding it if needed.
+    The bytes may not contain a NUL. */
+atom_t atom_intern_length(const char *str, size_t length);
+/*! Returns the atom for str if it has already been interned, otherwise
+    NULL. Never adds an atom and never locks. */
+atom_t atom_find(const char *str);
+atom_t atom_find_length(const char *str, size_t length);
+
+/*! Returns the number of atoms interned so far. */
+size_t atom_count(void);
+
+S_INLINE const char *atom_str(atom_t atom)
+{
+  return atom->str;
+}
+
+S_INLINE size_t atom_length(atom_t atom)
+{
+  return atom->length;
+}
+
+S_INLINE size_t atom_hash(atom_t atom)
+{
+  return atom->hash;
+}
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__ATOM_H__ */
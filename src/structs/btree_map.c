@@ -0,0 +1,581 @@
+/*
+  B-tree map collection
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__BTREE_MAP_C__
+
+#include "btree_map.h"
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define MIN_DEG BTREE_MIN_DEGREE
+
+#define LEAF_NODE_SIZE (offsetof(btree_node_t, children))
+#define INTERNAL_NODE_SIZE (sizeof(btree_node_t))
+
+/* node management */
+
+static btree_node_t *btree_node_new(btree_map_t *map, bool leaf)
+{
+  size_t size = leaf ? LEAF_NODE_SIZE : INTERNAL_NODE_SIZE;
+  char *origin = (char *)com_malloc_uninit(map->allocator, size + BTREE_NODE_ALIGN - 1);
+  btree_node_t *node;
+
+  if (origin == NULL) {
+    s_fatal_error(1, "Unable to allocate B-tree node");
+    return NULL;
+  }
+
+  node = (btree_node_t *)(((uintptr_t)origin + (BTREE_NODE_ALIGN - 1)) & ~(uintptr_t)(BTREE_NODE_ALIGN - 1));
+  node->origin = origin;
+  node->count = 0;
+  node->leaf = leaf;
+
+  return node;
+}
+
+static void btree_node_free(btree_map_t *map, btree_node_t *node)
+{
+  com_free(map->allocator, node->origin);
+}
+
+static void btree_node_destroy_r(btree_map_t *map, btree_node_t *node)
+{
+  allocator_t *alloc = map->allocator;
+  int index;
+
+  for (index = 0; index < node->count; ++index) {
+    map->ops.destroy_key(node->keys[index], alloc);
+    map->ops.destroy_value(node->values[index], alloc);
+  }
+
+  if (!node->leaf) {
+    for (index = 0; index <= node->count; ++index)
+      btree_node_destroy_r(map, node->children[index]);
+  }
+
+  btree_node_free(map, node);
+}
+
+/*
+  Returns the index of the first key in node not less than key. Sets found if
+  the key at that index equals key.
+*/
+static int btree_node_search(const btree_map_t *map, const btree_node_t *node, mapkey_t key, bool *found)
+{
+  int low = 0;
+  int high = node->count;
+
+  if (map->ops.compare_key == g_mapops_default.compare_key) {
+    /* Keys compared by address: count the smaller keys without branching,
+       which beats a binary search over so few keys. */
+    const uintptr_t value = (uintptr_t)key;
+    for (; high > 0; --high)
+      low += (uintptr_t)node->keys[high - 1] < value;
+    *found = low < node->count && (uintptr_t)node->keys[low] == value;
+    return low;
+  }
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    int comparison = map->ops.compare_key(node->keys[mid], key);
+    if (comparison < 0) {
+      low = mid + 1;
+    } else if (comparison > 0) {
+      high = mid;
+    } else {
+      *found = true;
+      return mid;
+    }
+  }
+
+  *found = false;
+  return low;
+}
+
+static void btree_node_insert_at(btree_node_t *node, int index, mapkey_t key, void *p)
+{
+  memmove(&node->keys[index + 1], &node->keys[index], (node->count - index) * sizeof(mapkey_t));
+  memmove(&node->values[index + 1], &node->values[index], (node->count - index) * sizeof(void *));
+  node->keys[index] = key;
+  node->values[index] = p;
+  node->count += 1;
+}
+
+static void btree_node_erase_at(btree_node_t *node, int index)
+{
+  memmove(&node->keys[index], &node->keys[index + 1], (node->count - index - 1) * sizeof(mapkey_t));
+  memmove(&node->values[index], &node->values[index + 1], (node->count - index - 1) * sizeof(void *));
+  node->count -= 1;
+}
+
+/*
+  Splits the full child at index of node in two, moving its median key up
+  into node.
+*/
+static void btree_split_child(btree_map_t *map, btree_node_t *node, int index)
+{
+  btree_node_t *left = node->children[index];
+  btree_node_t *right = btree_node_new(map, left->leaf);
+
+  right->count = MIN_DEG - 1;
+  memcpy(right->keys, &left->keys[MIN_DEG], (MIN_DEG - 1) * sizeof(mapkey_t));
+  memcpy(right->values, &left->values[MIN_DEG], (MIN_DEG - 1) * sizeof(void *));
+  if (!left->leaf)
+    memcpy(right->children, &left->children[MIN_DEG], MIN_DEG * sizeof(btree_node_t *));
+  left->count = MIN_DEG - 1;
+
+  memmove(&node->children[index + 2], &node->children[index + 1], (node->count - index) * sizeof(btree_node_t *));
+  node->children[index + 1] = right;
+  btree_node_insert_at(node, index, left->keys[MIN_DEG - 1], left->values[MIN_DEG - 1]);
+}
+
+/*
+  Merges the child at index + 1 of node and the key between them into the
+  child at index. Both children must have MIN_DEG - 1 keys.
+*/
+static void btree_merge_children(btree_map_t *map, btree_node_t *node, int index)
+{
+  btree_node_t *left = node->children[index];
+  btree_node_t *right = node->children[index + 1];
+
+  left->keys[left->count] = node->keys[index];
+  left->values[left->count] = node->values[index];
+  memcpy(&left->keys[left->count + 1], right->keys, right->count * sizeof(mapkey_t));
+  memcpy(&left->values[left->count + 1], right->values, right->count * sizeof(void *));
+  if (!left->leaf)
+    memcpy(&left->children[left->count + 1], right->children, (right->count + 1) * sizeof(btree_node_t *));
+  left->count += right->count + 1;
+
+  btree_node_erase_at(node, index);
+  memmove(&node->children[index + 1], &node->children[index + 2], (node->count - index) * sizeof(btree_node_t *));
+
+  btree_node_free(map, right);
+}
+
+/*
+  Ensures the child at index of node has at least MIN_DEG keys before
+  descending into it, borrowing from a sibling or merging with one. Returns
+  the index of the child holding the keys that were in the original child.
+*/
+static int btree_fill_child(btree_map_t *map, btree_node_t *node, int index)
+{
+  btree_node_t *child = node->children[index];
+
+  if (child->count >= MIN_DEG)
+    return index;
+
+  if (index > 0 && node->children[index - 1]->count >= MIN_DEG) {
+    btree_node_t *left = node->children[index - 1];
+
+    if (!child->leaf) {
+      memmove(&child->children[1], child->children, (child->count + 1) * sizeof(btree_node_t *));
+      child->children[0] = left->children[left->count];
+    }
+    btree_node_insert_at(child, 0, node->keys[index - 1], node->values[index - 1]);
+    node->keys[index - 1] = left->keys[left->count - 1];
+    node->values[index - 1] = left->values[left->count - 1];
+    left->count -= 1;
+
+    return index;
+  }
+
+  if (index < node->count && node->children[index + 1]->count >= MIN_DEG) {
+    btree_node_t *right = node->children[index + 1];
+
+    child->keys[child->count] = node->keys[index];
+    child->values[child->count] = node->values[index];
+    if (!child->leaf) {
+      child->children[child->count + 1] = right->children[0];
+      memmove(right->children, &right->children[1], right->count * sizeof(btree_node_t *));
+    }
+    child->count += 1;
+    node->keys[index] = right->keys[0];
+    node->values[index] = right->values[0];
+    btree_node_erase_at(right, 0);
+
+    return index;
+  }
+
+  if (index < node->count) {
+    btree_merge_children(map, node, index);
+    return index;
+  }
+
+  btree_merge_children(map, node, index - 1);
+  return index - 1;
+}
+
+/*
+  Removes the smallest or largest entry of the subtree at node, which must
+  have at least MIN_DEG keys unless it's the root, and returns it in key and
+  p.
+*/
+static void btree_take_extreme(btree_map_t *map, btree_node_t *node, bool largest, mapkey_t *key, void **p)
+{
+  while (!node->leaf) {
+    int index = btree_fill_child(map, node, largest ? node->count : 0);
+    node = node->children[index];
+  }
+
+  if (largest) {
+    *key = node->keys[node->count - 1];
+    *p = node->values[node->count - 1];
+    node->count -= 1;
+  } else {
+    *key = node->keys[0];
+    *p = node->values[0];
+    btree_node_erase_at(node, 0);
+  }
+}
+
+/*
+  Removes key from the subtree at node, returning its stored key and value
+  in out_key and out_p. Returns false if key isn't in the subtree.
+*/
+static bool btree_remove_r(btree_map_t *map, btree_node_t *node, mapkey_t key, mapkey_t *out_key, void **out_p)
+{
+  bool found;
+  int index = btree_node_search(map, node, key, &found);
+
+  if (found) {
+    *out_key = node->keys[index];
+    *out_p = node->values[index];
+
+    if (node->leaf) {
+      btree_node_erase_at(node, index);
+      return true;
+    }
+
+    if (node->children[index]->count >= MIN_DEG) {
+      btree_take_extreme(map, node->children[index], true, &node->keys[index], &node->values[index]);
+      return true;
+    }
+
+    if (node->children[index + 1]->count >= MIN_DEG) {
+      btree_take_extreme(map, node->children[index + 1], false, &node->keys[index], &node->values[index]);
+      return true;
+    }
+
+    btree_merge_children(map, node, index);
+    return btree_remove_r(map, node->children[index], key, out_key, out_p);
+  }
+
+  if (node->leaf)
+    return false;
+
+  index = btree_fill_child(map, node, index);
+  return btree_remove_r(map, node->children[index], key, out_key, out_p);
+}
+
+/*
+  Builds a subtree of the given height from count sorted entries, copying
+  keys and values. count must be within what a subtree of that height holds.
+*/
+static btree_node_t *btree_build_r(btree_map_t *map, const mapkey_t *keys, void *const *values, int count, int height)
+{
+  allocator_t *alloc = map->allocator;
+  btree_node_t *node = btree_node_new(map, height == 1);
+  int64_t child_capacity = 1;
+  int children, per_child, extra;
+  int index;
+
+  if (height == 1) {
+    for (index = 0; index < count; ++index) {
+      node->keys[index] = map->ops.copy_key(keys[index], alloc);
+      node->values[index] = map->ops.copy_value(values[index], alloc);
+    }
+    node->count = count;
+    return node;
+  }
+
+  for (index = 1; index < height; ++index)
+    child_capacity *= 2 * MIN_DEG;
+  child_capacity -= 1;
+
+  // each child holds at most child_capacity entries and each separator one
+  // more, so count + 1 entries need ceil((count + 1) / (child_capacity + 1))
+  children = (int)((count + 1 + child_capacity) / (child_capacity + 1));
+  if (children < 2)
+    children = 2;
+  assert(children <= 2 * MIN_DEG);
+
+  per_child = (count - (children - 1)) / children;
+  extra = (count - (children - 1)) % children;
+
+  for (index = 0; index < children; ++index) {
+    int child_count = per_child + (index < extra);
+
+    node->children[index] = btree_build_r(map, keys, values, child_count, height - 1);
+    keys += child_count;
+    values += child_count;
+
+    if (index < children - 1) {
+      node->keys[index] = map->ops.copy_key(*keys++, alloc);
+      node->values[index] = map->ops.copy_value(*values++, alloc);
+    }
+  }
+
+  node->count = children - 1;
+  return node;
+}
+
+static void btree_get_values_r(const btree_node_t *node, mapkey_t *keys, void **values, int *count, size_t capacity)
+{
+  int index;
+
+  for (index = 0; index <= node->count && (size_t)*count < capacity; ++index) {
+    if (!node->leaf)
+      btree_get_values_r(node->children[index], keys, values, count, capacity);
+
+    if (index < node->count && (size_t)*count < capacity) {
+      if (keys) keys[*count] = node->keys[index];
+      if (values) values[*count] = node->values[index];
+      *count += 1;
+    }
+  }
+}
+
+static void btree_iter_push_leftmost(btree_iter_t *iter, const btree_node_t *node)
+{
+  for (;;) {
+    iter->stack[iter->depth].node = node;
+    iter->stack[iter->depth].index = 0;
+    iter->depth += 1;
+
+    if (node->leaf)
+      break;
+
+    node = node->children[0];
+  }
+}
+
+/* implementation */
+
+void btree_map_init(btree_map_t *map, mapops_t ops, allocator_t *alloc)
+{
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  map->root = NULL;
+  map->size = 0;
+  map->allocator = alloc;
+
+  if (ops.copy_key == NULL) ops.copy_key = g_mapops_default.copy_key;
+  if (ops.destroy_key == NULL) ops.destroy_key = g_mapops_default.destroy_key;
+  if (ops.compare_key == NULL) ops.compare_key = g_mapops_default.compare_key;
+  if (ops.copy_value == NULL) ops.copy_value = g_mapops_default.copy_value;
+  if (ops.destroy_value == NULL) ops.destroy_value = g_mapops_default.destroy_value;
+
+  map->ops = ops;
+}
+
+void btree_map_destroy(btree_map_t *map)
+{
+  if (map->root)
+    btree_node_destroy_r(map, map->root);
+  memset(map, 0, sizeof(*map));
+}
+
+int btree_map_build(btree_map_t *map, const mapkey_t *keys, void *const *values, int count)
+{
+  int height = 1;
+  int64_t capacity = BTREE_MAX_KEYS;
+  int index;
+
+  for (index = 1; index < count; ++index) {
+    if (map->ops.compare_key(keys[index - 1], keys[index]) >= 0) {
+      s_log_error("Keys passed to btree_map_build are not sorted (index %d)", index);
+      return -1;
+    }
+  }
+
+  if (map->root) {
+    for (index = 0; index < count; ++index)
+      btree_map_insert(map, keys[index], values[index]);
+    return 0;
+  }
+
+  if (count <= 0)
+    return 0;
+
+  while (capacity < count) {
+    capacity = (capacity + 1) * 2 * MIN_DEG - 1;
+    height += 1;
+  }
+
+  map->root = btree_build_r(map, keys, values, count, height);
+  map->size = count;
+
+  return 0;
+}
+
+void btree_map_insert(btree_map_t *map, mapkey_t key, void *p)
+{
+  allocator_t *alloc = map->allocator;
+  btree_node_t *node = map->root;
+
+  if (node == NULL) {
+    node = map->root = btree_node_new(map, true);
+  } else if (node->count == BTREE_MAX_KEYS) {
+    btree_node_t *root = btree_node_new(map, false);
+    root->children[0] = node;
+    btree_split_child(map, root, 0);
+    node = map->root = root;
+  }
+
+  for (;;) {
+    bool found;
+    int index = btree_node_search(map, node, key, &found);
+
+    if (found) {
+      map->ops.destroy_value(node->values[index], alloc);
+      node->values[index] = map->ops.copy_value(p, alloc);
+      return;
+    }
+
+    if (node->leaf) {
+      btree_node_insert_at(node, index, map->ops.copy_key(key, alloc), map->ops.copy_value(p, alloc));
+      map->size += 1;
+      return;
+    }
+
+    if (node->children[index]->count == BTREE_MAX_KEYS) {
+      int comparison;
+
+      btree_split_child(map, node, index);
+
+      comparison = map->ops.compare_key(key, node->keys[index]);
+      if (comparison == 0) {
+        map->ops.destroy_value(node->values[index], alloc);
+        node->values[index] = map->ops.copy_value(p, alloc);
+        return;
+      } else if (comparison > 0) {
+        index += 1;
+      }
+    }
+
+    node = node->children[index];
+  }
+}
+
+bool btree_map_remove(btree_map_t *map, mapkey_t key)
+{
+  allocator_t *alloc = map->allocator;
+  btree_node_t *root = map->root;
+  mapkey_t old_key;
+  void *p;
+
+  if (root == NULL || !btree_remove_r(map, root, key, &old_key, &p))
+    return false;
+
+  map->size -= 1;
+
+  if (root->count == 0) {
+    map->root = root->leaf ? NULL : root->children[0];
+    btree_node_free(map, root);
+  }
+
+  map->ops.destroy_key(old_key, alloc);
+  map->ops.destroy_value(p, alloc);
+
+  return true;
+}
+
+int btree_map_size(const btree_map_t *map)
+{
+  return map->size;
+}
+
+void *btree_map_get(const btree_map_t *map, mapkey_t key)
+{
+  void **addr = btree_map_get_addr((btree_map_t *)map, key);
+  return addr ? *addr : NULL;
+}
+
+void **btree_map_get_addr(btree_map_t *map, mapkey_t key)
+{
+  btree_node_t *node = map->root;
+
+  while (node) {
+    bool found;
+    int index = btree_node_search(map, node, key, &found);
+
+    if (found)
+      return &node->values[index];
+
+    node = node->leaf ? NULL : node->children[index];
+  }
+
+  return NULL;
+}
+
+int btree_map_get_values(const btree_map_t *map, mapkey_t *keys, void **values, size_t capacity)
+{
+  int count = 0;
+  if (map->root)
+    btree_get_values_r(map->root, keys, values, &count, capacity);
+  return count;
+}
+
+void btree_map_begin(const btree_map_t *map, btree_iter_t *iter)
+{
+  iter->depth = 0;
+  if (map->root)
+    btree_iter_push_leftmost(iter, map->root);
+}
+
+void btree_map_lower_bound(const btree_map_t *map, mapkey_t key, btree_iter_t *iter)
+{
+  const btree_node_t *node = map->root;
+
+  iter->depth = 0;
+
+  while (node) {
+    bool found;
+    int index = btree_node_search(map, node, key, &found);
+
+    iter->stack[iter->depth].node = node;
+    iter->stack[iter->depth].index = index;
+    iter->depth += 1;
+
+    if (found || node->leaf)
+      break;
+
+    node = node->children[index];
+  }
+}
+
+bool btree_iter_next(btree_iter_t *iter, mapkey_t *key, void **value)
+{
+  while (iter->depth > 0) {
+    const btree_node_t *node = iter->stack[iter->depth - 1].node;
+    int index = iter->stack[iter->depth - 1].index;
+
+    if (index >= node->count) {
+      iter->depth -= 1;
+      continue;
+    }
+
+    if (key) *key = node->keys[index];
+    if (value) *value = node->values[index];
+
+    iter->stack[iter->depth - 1].index = index + 1;
+    if (!node->leaf)
+      btree_iter_push_leftmost(iter, node->children[index + 1]);
+
+    return true;
+  }
+
+  return false;
+}
+
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
@@ -0,0 +1,131 @@
+/*
+  B-tree map collection
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__BTREE_MAP_H__
+
+#define __SNOW__BTREE_MAP_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include "map.h"
+
+/*!
+  \file
+
+  An ordered map stored as a B-tree with wide nodes. Each node holds up to
+  BTREE_MAX_KEYS keys in a contiguous, cache-line-aligned array. A lookup
+  touches one node per level, and the tree is far shallower than map_t's
+  red-black tree. Every node except the root holds at least
+  BTREE_MIN_DEGREE - 1 keys.
+
+  The map uses the same mapops_t hooks as map_t. Iterators visit entries in
+  key order and are invalidated by any insertion or removal.
+*/
+
+#ifdef __SNOW__BTREE_MAP_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*! Minimum degree of the tree. Nodes hold between this minus one and twice
+    this minus one keys. */
+#define BTREE_MIN_DEGREE (8)
+#define BTREE_MAX_KEYS (2 * BTREE_MIN_DEGREE - 1)
+/*! Alignment of nodes. */
+#define BTREE_NODE_ALIGN (64)
+/*! Deepest tree an iterator can walk. With the minimum degree above, this
+    is far more entries than fit in memory. */
+#define BTREE_MAX_DEPTH (16)
+
+typedef struct s_btree_node btree_node_t;
+typedef struct s_btree_map btree_map_t;
+typedef struct s_btree_iter btree_iter_t;
+
+struct s_btree_node
+{
+  uint16_t count;
+  uint16_t leaf;
+  /*! Pointer to free. */
+  void *origin;
+  mapkey_t keys[BTREE_MAX_KEYS];
+  void *values[BTREE_MAX_KEYS];
+  /*! Only allocated for internal nodes. */
+  btree_node_t *children[BTREE_MAX_KEYS + 1];
+};
+
+struct s_btree_map
+{
+  /*! Root node. NULL if the map is empty. */
+  btree_node_t *root;
+  int size;
+  mapops_t ops;
+  allocator_t *allocator;
+};
+
+/*!
+ * Position within a btree_map_t. Use ::btree_iter_next to read entries from
+ * it.
+ */
+struct s_btree_iter
+{
+  int depth;
+  struct {
+    const btree_node_t *node;
+    int index;
+  } stack[BTREE_MAX_DEPTH];
+};
+
+/*!
+ * Initializes an empty map. Any NULL hooks in ops are replaced by the
+ * defaults from g_mapops_default.
+ */
+void btree_map_init(btree_map_t *map, mapops_t ops, allocator_t *alloc);
+void btree_map_destroy(btree_map_t *map);
+
+/*!
+ * Adds count entries from keys and values, which must be sorted in ascending
+ * order with no duplicate keys. If the map is empty, the tree is built
+ * directly in O(n). Otherwise the entries are inserted one at a time.
+ * Returns 0 on success, -1 if the keys are not sorted.
+ */
+int btree_map_build(btree_map_t *map, const mapkey_t *keys, void *const *values, int count);
+
+void btree_map_insert(btree_map_t *map, mapkey_t key, void *p);
+bool btree_map_remove(btree_map_t *map, mapkey_t key);
+
+int btree_map_size(const btree_map_t *map);
+
+void *btree_map_get(const btree_map_t *map, mapkey_t key);
+void **btree_map_get_addr(btree_map_t *map, mapkey_t key);
+/*!
+ * Copies up to capacity keys and values, in key order, into keys and values,
+ * either of which may be NULL. Returns the number of entries copied.
+ */
+int btree_map_get_values(const btree_map_t *map, mapkey_t *keys, void **values, size_t capacity);
+
+/*! Sets iter to the first entry of the map. */
+void btree_map_begin(const btree_map_t *map, btree_iter_t *iter);
+/*! Sets iter to the first entry whose key is not less than key. */
+void btree_map_lower_bound(const btree_map_t *map, mapkey_t key, btree_iter_t *iter);
+/*!
+ * Reads the entry at iter into key and value, either of which may be NULL,
+ * and advances iter. Returns false once iter is past the last entry.
+ */
+bool btree_iter_next(btree_iter_t *iter, mapkey_t *key, void **value);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__BTREE_MAP_H__ */
@@ -23,7 +23,7 @@ void array_destroy(array_t *self)
 
   allocator_t *alloc = self->allocator;
 
-  if (self->buf != NULL)
+  if (self->buf != NULL && self->buf != self->inline_buf)
     com_free(alloc, self->buf);
 
   memset(self, 0, sizeof(*self));
@@ -50,6 +50,7 @@ array_t *array_init(array_t *self, size_t object_size, size_t capacity, allocato
   self->size = 0;
   self->capacity = 0;
   self->buf = NULL;
+  self->inline_buf = NULL;
 
   if (!array_reserve(self, capacity)) {
     array_destroy(self);
@@ -60,6 +61,25 @@ array_t *array_init(array_t *self, size_t object_size, size_t capacity, allocato
   return self;
 }
 
+array_t *array_init_inline(array_t *self, size_t object_size, void *storage, size_t storage_size, allocator_t *alloc)
+{
+  if (storage == NULL && storage_size != 0) {
+    s_fatal_error(1, "Inline storage for array is NULL.");
+    return NULL;
+  } else if (array_init(self, object_size, 0, alloc) == NULL) {
+    return NULL;
+  }
+
+  self->capacity = storage_size / object_size;
+  if (self->capacity) {
+    self->buf = (char *)storage;
+    self->inline_buf = self->buf;
+    memset(storage, 0, self->capacity * object_size);
+  }
+
+  return self;
+}
+
 bool array_copy(const array_t *src, array_t *dst)
 {
   if (src == NULL || dst == NULL) {
@@ -77,7 +97,8 @@ bool array_copy(const array_t *src, array_t *dst)
     if (dst_buffer_size < src_buffer_size) {
       // release the buffer since it can't hold the source buffer
       dst->buf = NULL;
-      com_free(copy.allocator, copy.buf);
+      if (copy.buf != copy.inline_buf)
+        com_free(copy.allocator, copy.buf);
       copy.buf = NULL;
       copy.capacity = 0;
     } else {
@@ -141,7 +162,7 @@ bool array_resize(array_t *self, size_t size)
 
 bool array_reserve(array_t *self, size_t capacity)
 {
-  size_t new_size, new_cap, orig_size;
+  size_t new_size, new_cap, orig_size, usable_size;
   char *new_buf = NULL;
   bool tried_min = false;
 
@@ -158,7 +179,9 @@ bool array_reserve(array_t *self, size_t capacity)
 reserve_capacity:
   new_size = new_cap * self->obj_size;
 
-  new_buf = (char *)com_malloc(self->allocator, new_size);
+  /* the copy and the memset below cover the whole buffer, so it needn't be
+     zeroed first */
+  new_buf = (char *)com_malloc_usable(self->allocator, new_size, &usable_size);
   if (NULL == new_buf) {
     /* in the event that the new buffer can't be allocated, try one more route
        before giving up
@@ -178,8 +201,13 @@ reserve_capacity:
   if (self->buf && orig_size)
     memcpy(new_buf, self->buf, orig_size);
 
+  /* take any slack the allocator handed back as extra capacity */
+  new_cap = usable_size / self->obj_size;
+  new_size = new_cap * self->obj_size;
+
   memset(new_buf + orig_size, 0, new_size - orig_size);
-  if (self->buf) com_free(self->allocator, self->buf);
+  if (self->buf && self->buf != self->inline_buf)
+    com_free(self->allocator, self->buf);
   self->buf = new_buf;
   self->capacity = new_cap;
 
@@ -224,7 +252,7 @@ bool array_sort(array_t *self, int (*comparator)(const void *left, const void *r
   if (self->size < 2)
     return true;
 
-  qsort(self->buf, self->size*self->obj_size, self->obj_size, comparator);
+  qsort(self->buf, self->size, self->obj_size, comparator);
 
   return true;
 }
@@ -380,7 +408,7 @@ void *array_last(array_t *self)
   if (self->size < 1)
     return NULL;
 
-  return (self->buf + (self->size - 1));
+  return (self->buf + ((self->size - 1) * self->obj_size));
 }
 
 #if defined(__cplusplus)
@@ -41,11 +41,19 @@ struct s_array
   size_t size;
   /*! The array's allocator */
   allocator_t *allocator;
+  /*! Storage passed to array_init_inline, if any. The array uses it until it
+    outgrows it and never frees it. */
+  char *inline_buf;
 };
 
 /* Initialize an array with the given object size, capacity, and allocator.
    Object size specifies the size of each element in the array. */
 array_t *array_init(array_t *self, size_t object_size, size_t capacity, allocator_t *alloc);
+/* Initialize an array that stores its elements in the given storage until
+   it needs more than storage_size bytes, at which point they're moved to
+   memory from the allocator. The storage must outlive the array and must not
+   move while the array is in use. */
+array_t *array_init_inline(array_t *self, size_t object_size, void *storage, size_t storage_size, allocator_t *alloc);
 
 /* Destroys an array. */
 void array_destroy(array_t *self);
@@ -98,6 +106,127 @@ void array_each(array_t *self, iterator_fn_t iter, void *context);
    returns NULL. */
 void *array_last(array_t *self);
 
+/*
+  Typed arrays
+
+  DEFINE_ARRAY(TYPE, NAME) defines NAME_t, an array of TYPE, along with static
+  inline routines for it that know the element size at compile time and copy
+  elements by assignment:
+
+    NAME_init, NAME_init_inline, NAME_destroy, NAME_size, NAME_capacity,
+    NAME_empty, NAME_clear, NAME_reserve, NAME_at, NAME_get, NAME_store,
+    NAME_push, NAME_pop, NAME_last, NAME_buffer
+
+  NAME_t wraps a plain array_t in its `array` member, so a typed array can be
+  passed to any array_ routine as &typed->array and existing code can move
+  over a piece at a time. Growth goes through array_reserve, which doubles
+  the capacity. As with array_t, elements beyond the size are kept zeroed.
+
+  Bounds are only checked in debug builds.
+*/
+#if !NDEBUG
+#define ARRAY_CHECK_INDEX(ARRAY, INDEX) \
+  do { \
+    if ((ARRAY)->size <= (INDEX)) \
+      s_fatal_error(1, "Index %zu out of bounds [0..%zu]", (size_t)(INDEX), (ARRAY)->size - 1); \
+  } while (0)
+#else
+#define ARRAY_CHECK_INDEX(ARRAY, INDEX)
+#endif
+
+#define DEFINE_ARRAY(TYPE, NAME) \
+  typedef struct { array_t array; } NAME##_t; \
+  \
+  static inline NAME##_t *NAME##_init(NAME##_t *self, size_t capacity, allocator_t *alloc) \
+  { \
+    return array_init(&self->array, sizeof(TYPE), capacity, alloc) ? self : NULL; \
+  } \
+  \
+  static inline NAME##_t *NAME##_init_inline(NAME##_t *self, TYPE *storage, size_t count, allocator_t *alloc) \
+  { \
+    return array_init_inline(&self->array, sizeof(TYPE), storage, count * sizeof(TYPE), alloc) ? self : NULL; \
+  } \
+  \
+  static inline void NAME##_destroy(NAME##_t *self) \
+  { \
+    array_destroy(&self->array); \
+  } \
+  \
+  static inline size_t NAME##_size(const NAME##_t *self) \
+  { \
+    return self->array.size; \
+  } \
+  \
+  static inline size_t NAME##_capacity(const NAME##_t *self) \
+  { \
+    return self->array.capacity; \
+  } \
+  \
+  static inline bool NAME##_empty(const NAME##_t *self) \
+  { \
+    return self->array.size == 0; \
+  } \
+  \
+  static inline bool NAME##_clear(NAME##_t *self) \
+  { \
+    return array_clear(&self->array); \
+  } \
+  \
+  static inline bool NAME##_reserve(NAME##_t *self, size_t capacity) \
+  { \
+    return array_reserve(&self->array, capacity); \
+  } \
+  \
+  static inline TYPE *NAME##_buffer(NAME##_t *self) \
+  { \
+    return (TYPE *)self->array.buf; \
+  } \
+  \
+  static inline TYPE *NAME##_at(NAME##_t *self, size_t index) \
+  { \
+    ARRAY_CHECK_INDEX(&self->array, index); \
+    return (TYPE *)self->array.buf + index; \
+  } \
+  \
+  static inline TYPE NAME##_get(const NAME##_t *self, size_t index) \
+  { \
+    ARRAY_CHECK_INDEX(&self->array, index); \
+    return ((const TYPE *)self->array.buf)[index]; \
+  } \
+  \
+  static inline void NAME##_store(NAME##_t *self, size_t index, TYPE value) \
+  { \
+    ARRAY_CHECK_INDEX(&self->array, index); \
+    ((TYPE *)self->array.buf)[index] = value; \
+  } \
+  \
+  static inline TYPE *NAME##_push(NAME##_t *self, TYPE value) \
+  { \
+    TYPE *slot; \
+    if (self->array.size == self->array.capacity && \
+        !array_reserve(&self->array, self->array.size + 1)) \
+      return NULL; \
+    slot = (TYPE *)self->array.buf + self->array.size++; \
+    *slot = value; \
+    return slot; \
+  } \
+  \
+  static inline TYPE NAME##_pop(NAME##_t *self) \
+  { \
+    TYPE *slot; \
+    TYPE value; \
+    ARRAY_CHECK_INDEX(&self->array, 0); \
+    slot = (TYPE *)self->array.buf + --self->array.size; \
+    value = *slot; \
+    memset(slot, 0, sizeof(TYPE)); \
+    return value; \
+  } \
+  \
+  static inline TYPE *NAME##_last(NAME##_t *self) \
+  { \
+    return self->array.size ? (TYPE *)self->array.buf + self->array.size - 1 : NULL; \
+  }
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
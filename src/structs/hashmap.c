@@ -0,0 +1,420 @@
+/*
+  Hash map collection
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__HASHMAP_C__
+
+#include "hashmap.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Control byte values. Full slots hold the low seven bits of their hash. */
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+#define CTRL_IS_FULL(C) ((C) >= 0)
+
+#define HASH_H1(HASH) ((HASH) >> 7)
+#define HASH_H2(HASH) ((int8_t)((HASH) & 0x7F))
+
+/*
+  Group probing. A group is a run of control bytes starting at any slot.
+  Matching control bytes are reported as a bitmask with GROUP_SHIFT bits per
+  byte, so the slot offset of the lowest match is ctz(mask) >> GROUP_SHIFT.
+*/
+#if defined(__SSE2__)
+
+#define GROUP_WIDTH (16)
+#define GROUP_SHIFT (0)
+
+typedef uint32_t groupmask_t;
+typedef __m128i group_t;
+
+static inline group_t group_load(const int8_t *ctrl)
+{
+  return _mm_loadu_si128((const __m128i *)ctrl);
+}
+
+static inline groupmask_t group_match(group_t group, int8_t h2)
+{
+  return (groupmask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), group));
+}
+
+static inline groupmask_t group_match_empty(group_t group)
+{
+  return group_match(group, CTRL_EMPTY);
+}
+
+static inline groupmask_t group_match_empty_or_deleted(group_t group)
+{
+  /* Empty and deleted are the only values below -1. */
+  return (groupmask_t)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));
+}
+
+#else /* portable, eight bytes at a time in a 64-bit word */
+
+#define GROUP_WIDTH (8)
+#define GROUP_SHIFT (3)
+#define GROUP_LSBS (0x0101010101010101ULL)
+#define GROUP_MSBS (0x8080808080808080ULL)
+
+typedef uint64_t groupmask_t;
+typedef uint64_t group_t;
+
+static inline group_t group_load(const int8_t *ctrl)
+{
+  group_t group;
+  memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+
+static inline groupmask_t group_match(group_t group, int8_t h2)
+{
+  /* May report a false match next to a real one, which is harmless since the
+     keys are compared anyway. */
+  group_t x = group ^ (GROUP_LSBS * (uint8_t)h2);
+  return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+static inline groupmask_t group_match_empty(group_t group)
+{
+  /* Empty is the only value with the high bit set and bit 1 clear. */
+  return group & ~(group << 6) & GROUP_MSBS;
+}
+
+static inline groupmask_t group_match_empty_or_deleted(group_t group)
+{
+  /* Empty and deleted both have the high bit set and bit 0 clear. */
+  return group & ~(group << 7) & GROUP_MSBS;
+}
+
+#endif
+
+#define GROUPMASK_FIRST(MASK) ((size_t)__builtin_ctzll(MASK) >> GROUP_SHIFT)
+#define GROUPMASK_NEXT(MASK) ((MASK) &= (MASK) - 1)
+
+/* Empty control bytes probed by maps with no table. */
+static const int8_t g_empty_group[GROUP_WIDTH] = {
+  CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+  CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+#if GROUP_WIDTH > 8
+  CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+  CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+#endif
+};
+
+/* implementation */
+
+size_t maphash_pointer(mapkey_t key)
+{
+  /* 64-bit finalizer from MurmurHash3 */
+  uint64_t h = (uint64_t)(uintptr_t)key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+static inline size_t hashmap_max_load(size_t capacity)
+{
+  return capacity - capacity / 8;
+}
+
+static inline void hashmap_set_ctrl(hashmap_t *map, size_t index, int8_t ctrl)
+{
+  map->ctrl[index] = ctrl;
+  if (index < GROUP_WIDTH)
+    map->ctrl[map->capacity + index] = ctrl;
+}
+
+/*
+  Returns the slot index holding key, or capacity if key isn't in the map.
+  Groups are probed with a triangular sequence, which visits every group once
+  when the capacity is a power of two.
+*/
+static size_t hashmap_find(const hashmap_t *map, mapkey_t key, size_t hash)
+{
+  const size_t mask = map->capacity ? map->capacity - 1 : 0;
+  const int8_t h2 = HASH_H2(hash);
+  size_t pos = HASH_H1(hash) & mask;
+  size_t step = 0;
+
+  for (;;) {
+    group_t group = group_load(map->ctrl + pos);
+    groupmask_t match = group_match(group, h2);
+
+    for (; match; GROUPMASK_NEXT(match)) {
+      size_t index = (pos + GROUPMASK_FIRST(match)) & mask;
+      if (map->ops.compare_key(key, map->slots[index].key) == 0)
+        return index;
+    }
+
+    if (group_match_empty(group))
+      return map->capacity;
+
+    step += GROUP_WIDTH;
+    pos = (pos + step) & mask;
+  }
+}
+
+/* Returns the first empty or deleted slot in key's probe sequence. */
+static size_t hashmap_find_insert(const hashmap_t *map, size_t hash)
+{
+  const size_t mask = map->capacity - 1;
+  size_t pos = HASH_H1(hash) & mask;
+  size_t step = 0;
+
+  for (;;) {
+    groupmask_t free_slots = group_match_empty_or_deleted(group_load(map->ctrl + pos));
+
+    if (free_slots)
+      return (pos + GROUPMASK_FIRST(free_slots)) & mask;
+
+    step += GROUP_WIDTH;
+    pos = (pos + step) & mask;
+  }
+}
+
+static void hashmap_resize(hashmap_t *map, size_t capacity)
+{
+  int8_t *old_ctrl = map->ctrl;
+  hashmap_slot_t *old_slots = map->slots;
+  size_t old_capacity = map->capacity;
+  size_t index;
+  char *block;
+
+  block = (char *)com_malloc_uninit(map->allocator,
+    capacity * sizeof(hashmap_slot_t) + capacity + GROUP_WIDTH);
+  if (block == NULL) {
+    s_fatal_error(1, "Unable to allocate hash map table of %zu slots", capacity);
+    return;
+  }
+
+  map->slots = (hashmap_slot_t *)block;
+  map->ctrl = (int8_t *)(block + capacity * sizeof(hashmap_slot_t));
+  map->capacity = capacity;
+  map->growth_left = hashmap_max_load(capacity) - (size_t)map->size;
+  memset(map->ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+
+  for (index = 0; index < old_capacity; ++index) {
+    if (CTRL_IS_FULL(old_ctrl[index])) {
+      size_t hash = map->hash(old_slots[index].key);
+      size_t dest = hashmap_find_insert(map, hash);
+      hashmap_set_ctrl(map, dest, HASH_H2(hash));
+      map->slots[dest] = old_slots[index];
+    }
+  }
+
+  if (old_capacity)
+    com_free(map->allocator, old_slots);
+}
+
+/* Makes room for one more entry, either by growing or, if much of the table
+   is deleted slots, by rehashing in place to clear them out. */
+static void hashmap_make_room(hashmap_t *map)
+{
+  if (map->capacity == 0)
+    hashmap_resize(map, GROUP_WIDTH);
+  else if ((size_t)map->size < map->capacity / 2 - map->capacity / 16)
+    hashmap_resize(map, map->capacity);
+  else
+    hashmap_resize(map, map->capacity * 2);
+}
+
+void hashmap_init(hashmap_t *map, mapops_t ops, maphash_fn_t hash, allocator_t *alloc)
+{
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  map->ctrl = (int8_t *)g_empty_group;
+  map->slots = NULL;
+  map->capacity = 0;
+  map->size = 0;
+  map->growth_left = 0;
+  map->hash = hash ? hash : maphash_pointer;
+  map->allocator = alloc;
+
+  if (ops.copy_key == NULL) ops.copy_key = g_mapops_default.copy_key;
+  if (ops.destroy_key == NULL) ops.destroy_key = g_mapops_default.destroy_key;
+  if (ops.compare_key == NULL) ops.compare_key = g_mapops_default.compare_key;
+  if (ops.copy_value == NULL) ops.copy_value = g_mapops_default.copy_value;
+  if (ops.destroy_value == NULL) ops.destroy_value = g_mapops_default.destroy_value;
+
+  map->ops = ops;
+}
+
+void hashmap_destroy(hashmap_t *map)
+{
+  allocator_t *alloc = map->allocator;
+  size_t index;
+
+  for (index = 0; index < map->capacity; ++index) {
+    if (CTRL_IS_FULL(map->ctrl[index])) {
+      map->ops.destroy_key(map->slots[index].key, alloc);
+      map->ops.destroy_value(map->slots[index].p, alloc);
+    }
+  }
+
+  if (map->capacity)
+    com_free(alloc, map->slots);
+
+  memset(map, 0, sizeof(*map));
+}
+
+void hashmap_reserve(hashmap_t *map, int count)
+{
+  size_t capacity = map->capacity ? map->capacity : GROUP_WIDTH;
+
+  if (count <= 0 || (map->capacity && hashmap_max_load(map->capacity) >= (size_t)count))
+    return;
+
+  while (hashmap_max_load(capacity) < (size_t)count)
+    capacity *= 2;
+
+  hashmap_resize(map, capacity);
+}
+
+void hashmap_insert(hashmap_t *map, mapkey_t key, void *p)
+{
+  allocator_t *alloc = map->allocator;
+  size_t hash = map->hash(key);
+  size_t index = hashmap_find(map, key, hash);
+
+  if (index != map->capacity) {
+    map->ops.destroy_value(map->slots[index].p, alloc);
+    map->slots[index].p = map->ops.copy_value(p, alloc);
+    return;
+  }
+
+  index = map->capacity ? hashmap_find_insert(map, hash) : 0;
+  if (map->capacity == 0 || (map->growth_left == 0 && map->ctrl[index] == CTRL_EMPTY)) {
+    hashmap_make_room(map);
+    index = hashmap_find_insert(map, hash);
+  }
+
+  if (map->ctrl[index] == CTRL_EMPTY)
+    map->growth_left -= 1;
+
+  hashmap_set_ctrl(map, index, HASH_H2(hash));
+  map->slots[index].key = map->ops.copy_key(key, alloc);
+  map->slots[index].p = map->ops.copy_value(p, alloc);
+  map->size += 1;
+}
+
+bool hashmap_remove(hashmap_t *map, mapkey_t key)
+{
+  allocator_t *alloc = map->allocator;
+  size_t index = hashmap_find(map, key, map->hash(key));
+  mapkey_t old_key;
+  void *p;
+
+  if (index == map->capacity)
+    return false;
+
+  old_key = map->slots[index].key;
+  p = map->slots[index].p;
+
+  hashmap_set_ctrl(map, index, CTRL_DELETED);
+  map->size -= 1;
+
+  map->ops.destroy_key(old_key, alloc);
+  map->ops.destroy_value(p, alloc);
+
+  return true;
+}
+
+int hashmap_size(const hashmap_t *map)
+{
+  return map->size;
+}
+
+void *hashmap_get(const hashmap_t *map, mapkey_t key)
+{
+  size_t index = hashmap_find(map, key, map->hash(key));
+
+  if (index != map->capacity)
+    return map->slots[index].p;
+
+  return NULL;
+}
+
+void **hashmap_get_addr(hashmap_t *map, mapkey_t key)
+{
+  size_t index = hashmap_find(map, key, map->hash(key));
+
+  if (index != map->capacity)
+    return &map->slots[index].p;
+
+  return NULL;
+}
+
+int hashmap_get_values(const hashmap_t *map, mapkey_t *keys, void **values, size_t capacity)
+{
+  size_t index;
+  int count = 0;
+
+  for (index = 0; index < map->capacity && (size_t)count < capacity; ++index) {
+    if (CTRL_IS_FULL(map->ctrl[index])) {
+      if (keys) keys[count] = map->slots[index].key;
+      if (values) values[count] = map->slots[index].p;
+      count += 1;
+    }
+  }
+
+  return count;
+}
+
+void hashmap_clear(hashmap_t *map)
+{
+  allocator_t *alloc = map->allocator;
+  size_t index;
+
+  if (map->capacity == 0)
+    return;
+
+  for (index = 0; index < map->capacity; ++index) {
+    if (CTRL_IS_FULL(map->ctrl[index])) {
+      map->ops.destroy_key(map->slots[index].key, alloc);
+      map->ops.destroy_value(map->slots[index].p, alloc);
+    }
+  }
+
+  memset(map->ctrl, CTRL_EMPTY, map->capacity + GROUP_WIDTH);
+  map->size = 0;
+  map->growth_left = hashmap_max_load(map->capacity);
+}
+
+bool hashmap_iter_next(const hashmap_t *map, size_t *iter, mapkey_t *key, void **value)
+{
+  size_t index;
+
+  for (index = *iter; index < map->capacity; ++index) {
+    if (CTRL_IS_FULL(map->ctrl[index])) {
+      if (key) *key = map->slots[index].key;
+      if (value) *value = map->slots[index].p;
+      *iter = index + 1;
+      return true;
+    }
+  }
+
+  *iter = index;
+  return false;
+}
+
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
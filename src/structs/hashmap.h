@@ -0,0 +1,120 @@
+/*
+  Hash map collection
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__HASHMAP_H__
+
+#define __SNOW__HASHMAP_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include "map.h"
+
+/*!
+  \file
+
+  An unordered map with open addressing. Keys and values are stored inline in
+  a single table, alongside one control byte per slot holding seven bits of
+  the key's hash or an empty/deleted marker. Lookups scan the control bytes a
+  group at a time (16 with SSE2, 8 otherwise) and only compare keys whose
+  hash bits match.
+
+  The map uses the same mapops_t hooks as map_t, plus a hash hook. Keys that
+  compare equal must hash equally. The table grows once it is seven-eighths
+  full, so pointers returned by ::hashmap_get_addr are only valid until the
+  next insertion.
+*/
+
+#ifdef __SNOW__HASHMAP_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+typedef struct s_hashmap_slot hashmap_slot_t;
+typedef struct s_hashmap hashmap_t;
+typedef size_t (*maphash_fn_t)(mapkey_t key);
+
+struct s_hashmap_slot
+{
+  mapkey_t key;
+  void *p;
+};
+
+struct s_hashmap
+{
+  /*! Control bytes, one per slot plus a copy of the first group's worth at
+      the end so groups can be loaded without wrapping. */
+  int8_t *ctrl;
+  hashmap_slot_t *slots;
+  /*! Number of slots. Always zero or a power of two. */
+  size_t capacity;
+  int size;
+  /*! Number of empty slots that can be filled before the table grows. */
+  size_t growth_left;
+  mapops_t ops;
+  maphash_fn_t hash;
+  allocator_t *allocator;
+};
+
+/*!
+ * Hashes a pointer-sized key by its value. Used if no hash function is given
+ * to ::hashmap_init.
+ */
+size_t maphash_pointer(mapkey_t key);
+
+/*!
+ * Initializes an empty hash map. Any NULL hooks in ops are replaced by the
+ * defaults from g_mapops_default, and a NULL hash by ::maphash_pointer. No
+ * memory is allocated until the first insertion.
+ */
+void hashmap_init(hashmap_t *map, mapops_t ops, maphash_fn_t hash, allocator_t *alloc);
+void hashmap_destroy(hashmap_t *map);
+
+/*!
+ * Ensures the map can hold at least count entries without growing.
+ */
+void hashmap_reserve(hashmap_t *map, int count);
+
+void hashmap_insert(hashmap_t *map, mapkey_t key, void *p);
+bool hashmap_remove(hashmap_t *map, mapkey_t key);
+
+int hashmap_size(const hashmap_t *map);
+
+void *hashmap_get(const hashmap_t *map, mapkey_t key);
+void **hashmap_get_addr(hashmap_t *map, mapkey_t key);
+/*!
+ * Copies up to capacity keys and values into keys and values, either of which
+ * may be NULL. Entries are in no particular order. Returns the number of
+ * entries copied.
+ */
+int hashmap_get_values(const hashmap_t *map, mapkey_t *keys, void **values, size_t capacity);
+
+/*!
+ * Removes and destroys every entry in the map. The table is kept for reuse.
+ */
+void hashmap_clear(hashmap_t *map);
+
+/*!
+ * Reads the next entry at or after the slot index in iter into key and value,
+ * either of which may be NULL, and advances iter past it. Start with iter set
+ * to zero. Returns false once there are no more entries. Removing entries
+ * while iterating is allowed; inserting may cause entries to be skipped or
+ * visited twice.
+ */
+bool hashmap_iter_next(const hashmap_t *map, size_t *iter, mapkey_t *key, void **value);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__HASHMAP_H__ */
@@ -22,10 +22,31 @@ static listnode_t *list_alloc_node(list_t *list, void *ptr) {
   return node;
 }
 
+static void list_unlink_all(list_t *list)
+{
+  listnode_t *node = list->head.next;
+
+  while (node != &list->head) {
+    listnode_t *next = node->next;
+    node->list = NULL;
+    node->next = node->prev = NULL;
+    node = next;
+  }
+
+  list->head.next = list->head.prev = &list->head;
+  list->size = 0;
+}
+
 void list_destroy(list_t *self)
 {
   allocator_t *alloc = self->allocator;
 
+  if (self->intrusive) {
+    list_unlink_all(self);
+    memset(self, 0, sizeof(*self));
+    return;
+  }
+
   self->head.prev->next = NULL;
   listnode_t *next = self->head.next;
   while (next) {
@@ -44,11 +65,19 @@ list_t *list_init(list_t *self, allocator_t *alloc)
 
   self->allocator = alloc;
   self->size = 0;
+  self->intrusive = false;
   self->head.next = self->head.prev = &self->head;
   self->head.list = self;
   return self;
 }
 
+list_t *list_init_intrusive(list_t *self)
+{
+  list_init(self, NULL);
+  self->intrusive = true;
+  return self;
+}
+
 bool list_insert_node_before(listnode_t *succ, listnode_t *pred)
 {
   if (!(succ && pred))
@@ -123,6 +152,18 @@ listnode_t *list_prepend(list_t *list, void *pointer)
   return list_insert_before(list->head.next, pointer);
 }
 
+listnode_t *list_append_node(list_t *list, listnode_t *node)
+{
+  list_insert_node_before(&list->head, node);
+  return node;
+}
+
+listnode_t *list_prepend_node(list_t *list, listnode_t *node)
+{
+  list_insert_node_after(&list->head, node);
+  return node;
+}
+
 void *list_at(const list_t *list, size_t index)
 {
   if (list->size <= index) {
@@ -207,6 +248,11 @@ void list_clear(list_t *list)
 
   if (node == &list->head) return;
 
+  if (list->intrusive) {
+    list_unlink_all(list);
+    return;
+  }
+
   list->head.next->prev = NULL;
   list->head.prev->next = NULL;
   list->head.next = list->head.prev = &list->head;
@@ -219,11 +265,23 @@ void list_clear(list_t *list)
   }
 }
 
-void list_remove(listnode_t *node)
+void list_unlink(listnode_t *node)
 {
   node->next->prev = node->prev;
   node->prev->next = node->next;
-  com_free(node->list->allocator, node);
+  node->list->size -= 1;
+  node->list = NULL;
+  node->next = node->prev = NULL;
+}
+
+void list_remove(listnode_t *node)
+{
+  list_t *list = node->list;
+
+  list_unlink(node);
+
+  if (!list->intrusive)
+    com_free(list->allocator, node);
 }
 
 bool list_remove_pointer(list_t *list, const void *pointer)
@@ -40,6 +40,9 @@ struct s_list
   listnode_t head;
   size_t size;
   bool release;
+  /*! Whether the list's nodes are embedded in its elements. See
+      ::list_init_intrusive. */
+  bool intrusive;
   allocator_t *allocator;
 };
 
@@ -55,13 +58,45 @@ struct s_list
  * List init/destroy routines do not allocate an entirely new list or free an
  * existing list from memory, they only prepare a list for use and destroy its
  * nodes, respectively.  If you allocate a list, you must also free it.
+ *
+ *  \p Intrusive Lists
+ * A list initialized with ::list_init_intrusive never allocates or frees
+ * nodes. Instead, each element embeds a listnode_t and inserts it with
+ * ::list_append_node, ::list_prepend_node, or the list_insert_node_ routines.
+ * Use ::list_container to get from a node back to its element, and
+ * ::list_foreach_entry to walk the elements. Removing, clearing, or
+ * destroying an intrusive list only unlinks nodes. The elements still belong
+ * to whoever allocated them. The pointer member of embedded nodes is unused.
  */
 
+/*! Gets the element of type TYPE containing the listnode_t NODE as its
+    member MEMBER. */
+#define list_container(NODE, TYPE, MEMBER) \
+  ((TYPE *)((char *)(NODE) - offsetof(TYPE, MEMBER)))
+
+/*! Loops NODE over every node in LIST. NODE must not be removed from the
+    list inside the loop. */
+#define list_foreach_node(NODE, LIST) \
+  for ((NODE) = (LIST)->head.next; (NODE) != &(LIST)->head; (NODE) = (NODE)->next)
+
+/*! Loops ENTRY over every element of the intrusive LIST, where ENTRY is a
+    TYPE * whose node is MEMBER. ENTRY must not be removed from the list
+    inside the loop. */
+#define list_foreach_entry(ENTRY, LIST, TYPE, MEMBER) \
+  for ((ENTRY) = list_container((LIST)->head.next, TYPE, MEMBER); \
+       &(ENTRY)->MEMBER != &(LIST)->head; \
+       (ENTRY) = list_container((ENTRY)->MEMBER.next, TYPE, MEMBER))
+
 
 /*! \brief Allocates and initializes a linked list.
  *  \param[in] list The list to be initialized.
  */
 list_t *list_init(list_t *list, allocator_t *alloc);
+/*! \brief Initializes an intrusive linked list, whose nodes are embedded in
+ *  its elements.
+ *  \param[in] list The list to be initialized.
+ */
+list_t *list_init_intrusive(list_t *list);
 void list_destroy(list_t *self);
 
 bool list_insert_node_before(listnode_t *succ, listnode_t *pred);
@@ -71,6 +106,10 @@ listnode_t *list_insert_after(listnode_t *node, void *value);
 
 listnode_t *list_append(list_t *list, void *value);
 listnode_t *list_prepend(list_t *list, void *value);
+/*! Inserts node at the end or start of the list. The node must not be in a
+    list already. Returns the node. */
+listnode_t *list_append_node(list_t *list, listnode_t *node);
+listnode_t *list_prepend_node(list_t *list, listnode_t *node);
 
 void *list_at(const list_t *list, size_t index);
 listnode_t *list_node_at(const list_t *list, size_t index);
@@ -87,7 +126,11 @@ size_t list_count(const list_t *list);
 bool list_is_empty(const list_t *list);
 
 void list_clear(list_t *list);
+/*! Removes the node from its list. Nodes of intrusive lists are only
+    unlinked, while other nodes are freed. */
 void list_remove(listnode_t *node);
+/*! Unlinks the node from its list without freeing it. */
+void list_unlink(listnode_t *node);
 bool list_remove_pointer(list_t *list, const void *ptr);
 size_t list_remove_all_of_pointer(list_t *list, const void *ptr);
 bool list_remove_value(list_t *list, const void *ptr, is_equal_fn_t equals);
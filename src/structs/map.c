@@ -222,10 +222,6 @@ static void mapnode_remove(map_t *map, mapnode_t *node)
 finish_removal:
   com_free(alloc, destroyed);
   map->size -= 1;
-
-#if !defined(NDEBUG)
-  map_test(map->root);
-#endif
 }
 
 static mapnode_t *mapnode_find(const map_t *map, mapnode_t *node, mapkey_t key)
@@ -286,6 +282,13 @@ void map_destroy(map_t *map)
   memset(map, 0, sizeof(*map));
 }
 
+void map_clear(map_t *map)
+{
+  mapnode_destroy_r(map, map->root);
+  map->root = NIL;
+  map->size = 0;
+}
+
 #if !defined(NDEBUG)
 static int map_test(mapnode_t *node)
 {
@@ -413,6 +416,10 @@ bool map_remove(map_t *map, mapkey_t key)
 
     mapnode_remove(map, node);
 
+#if !defined(NDEBUG)
+    map_test(map->root);
+#endif
+
     map->ops.destroy_key(key, alloc);
     map->ops.destroy_value(p, alloc);
 
@@ -472,6 +479,130 @@ int map_get_values(const map_t *map, mapkey_t *keys, void **values, size_t capac
   return count;
 }
 
+static mapnode_t *mapnode_leftmost(mapnode_t *node)
+{
+  if (node == NIL)
+    return NULL;
+
+  while (node->left != NIL)
+    node = node->left;
+
+  return node;
+}
+
+static mapnode_t *mapnode_rightmost(mapnode_t *node)
+{
+  if (node == NIL)
+    return NULL;
+
+  while (node->right != NIL)
+    node = node->right;
+
+  return node;
+}
+
+mapnode_t *map_first(const map_t *map)
+{
+  return mapnode_leftmost(map->root);
+}
+
+mapnode_t *map_last(const map_t *map)
+{
+  return mapnode_rightmost(map->root);
+}
+
+mapnode_t *map_next(const mapnode_t *node)
+{
+  mapnode_t *parent;
+
+  if (node->right != NIL)
+    return mapnode_leftmost(node->right);
+
+  parent = node->parent;
+  while (parent != NIL && node == parent->right) {
+    node = parent;
+    parent = parent->parent;
+  }
+
+  return parent != NIL ? parent : NULL;
+}
+
+mapnode_t *map_prev(const mapnode_t *node)
+{
+  mapnode_t *parent;
+
+  if (node->left != NIL)
+    return mapnode_rightmost(node->left);
+
+  parent = node->parent;
+  while (parent != NIL && node == parent->left) {
+    node = parent;
+    parent = parent->parent;
+  }
+
+  return parent != NIL ? parent : NULL;
+}
+
+mapnode_t *map_lower_bound(const map_t *map, mapkey_t key)
+{
+  mapnode_t *node = map->root;
+  mapnode_t *bound = NULL;
+
+  while (node != NIL) {
+    int comparison = map->ops.compare_key(key, node->key);
+
+    if (comparison == 0)
+      return node;
+
+    if (comparison < 0) {
+      bound = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+
+  return bound;
+}
+
+int map_remove_range(map_t *map, mapkey_t low, mapkey_t high)
+{
+  allocator_t *alloc = map->allocator;
+  mapnode_t *node = map_lower_bound(map, low);
+  int removed = 0;
+
+  if (node == NULL)
+    return 0;
+
+  if (node == map_first(map) && map->ops.compare_key(map_last(map)->key, high) < 0) {
+    removed = map->size;
+    map_clear(map);
+    return removed;
+  }
+
+  while (node && map->ops.compare_key(node->key, high) < 0) {
+    /* Removing a node with two children moves its predecessor's entry into
+       it and frees the predecessor, so the successor stays valid. */
+    mapnode_t *next = map_next(node);
+    mapkey_t key = node->key;
+    void *p = node->p;
+
+    mapnode_remove(map, node);
+
+    map->ops.destroy_key(key, alloc);
+    map->ops.destroy_value(p, alloc);
+
+    node = next;
+    removed += 1;
+  }
+
+#if !defined(NDEBUG)
+  map_test(map->root);
+#endif
+
+  return removed;
+}
+
 
 #if defined(__cplusplus)
 }
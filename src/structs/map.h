@@ -76,6 +76,30 @@ void *map_get(const map_t *map, mapkey_t key);
 void **map_get_addr(map_t *map, mapkey_t key);
 int map_get_values(const map_t *map, mapkey_t *keys, void **values, size_t capacity);
 
+/*!
+ * Removes and destroys every entry in the map, leaving it empty and ready for
+ * reuse.
+ */
+void map_clear(map_t *map);
+/*!
+ * Removes every entry with a key in [low, high). Returns the number of
+ * entries removed.
+ */
+int map_remove_range(map_t *map, mapkey_t low, mapkey_t high);
+
+/*
+  In-order iteration. Nodes are the iterators: read an entry through the
+  node's key and p members. Functions return NULL past either end of the map.
+  Removing an entry invalidates its node and the node before it. Insertions
+  leave nodes valid.
+*/
+mapnode_t *map_first(const map_t *map);
+mapnode_t *map_last(const map_t *map);
+mapnode_t *map_next(const mapnode_t *node);
+mapnode_t *map_prev(const mapnode_t *node);
+/*! Returns the first node whose key is not less than key. */
+mapnode_t *map_lower_bound(const map_t *map, mapkey_t key);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
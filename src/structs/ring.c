@@ -0,0 +1,548 @@
+/*
+  Bounded lock-free ring buffers
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__RING_C__
+
+#include "ring.h"
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*
+  Indices count up forever and are masked to find a slot, so head == tail
+  means empty and tail - head == capacity means full.
+
+  Atomics use the GCC/Clang __atomic builtins, which follow the C11 memory
+  model without requiring a C11 compiler mode. The producer publishes
+  elements with a release store after copying them in. The consumer frees
+  slots with a release store after copying elements out. Each side reads the
+  other's index with an acquire load.
+*/
+
+typedef bool (*ring_ready_fn_t)(const void *ring);
+
+
+static size_t ring_round_capacity(size_t capacity)
+{
+  size_t rounded = 1;
+  while (rounded < capacity)
+    rounded <<= 1;
+  return rounded;
+}
+
+
+/* Copies count elements into the ring starting at index, wrapping as needed. */
+static void ring_copy_in(char *buf, size_t mask, size_t obj_size, size_t index,
+                         const char *items, size_t count)
+{
+  const size_t slot = index & mask;
+  size_t first = mask + 1 - slot;
+
+  if (first > count)
+    first = count;
+
+  memcpy(buf + slot * obj_size, items, first * obj_size);
+  if (first < count)
+    memcpy(buf, items + first * obj_size, (count - first) * obj_size);
+}
+
+
+static void ring_copy_out(const char *buf, size_t mask, size_t obj_size, size_t index,
+                          char *items, size_t count)
+{
+  const size_t slot = index & mask;
+  size_t first = mask + 1 - slot;
+
+  if (first > count)
+    first = count;
+
+  memcpy(items, buf + slot * obj_size, first * obj_size);
+  if (first < count)
+    memcpy(items + first * obj_size, buf, (count - first) * obj_size);
+}
+
+
+static int ring_waiter_init(ring_waiter_t *waiter)
+{
+  waiter->consumers_waiting = 0;
+  waiter->producers_waiting = 0;
+
+  if (mutex_init(&waiter->lock, false))
+    return -1;
+
+  if (cond_init(&waiter->not_empty)) {
+    mutex_destroy(&waiter->lock);
+    return -1;
+  }
+
+  if (cond_init(&waiter->not_full)) {
+    cond_destroy(&waiter->not_empty);
+    mutex_destroy(&waiter->lock);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void ring_waiter_destroy(ring_waiter_t *waiter)
+{
+  cond_destroy(&waiter->not_full);
+  cond_destroy(&waiter->not_empty);
+  mutex_destroy(&waiter->lock);
+}
+
+
+/*
+  Wakes threads waiting on cond, if there are any. Called after publishing a
+  change to the ring. The fence orders that change before the read of
+  waiting, pairing with the fence in ring_block, so either the waiter sees
+  the change or this sees the waiter.
+*/
+static void ring_wake(ring_waiter_t *waiter, int *waiting, cond_t *cond)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED) > 0) {
+    mutex_lock(&waiter->lock);
+    cond_broadcast(cond);
+    mutex_unlock(&waiter->lock);
+  }
+}
+
+
+/*
+  Sleeps on cond until ready returns true or timeout seconds pass. Returns
+  the last result of ready.
+*/
+static bool ring_block(ring_waiter_t *waiter, int *waiting, cond_t *cond,
+                       ring_ready_fn_t ready, const void *ring, s_time_t timeout)
+{
+  const s_time_t deadline = timeout < 0 ? 0 : current_time() + timeout;
+  bool result;
+
+  mutex_lock(&waiter->lock);
+  __atomic_fetch_add(waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  while (!(result = ready(ring))) {
+    if (timeout < 0) {
+      cond_wait(cond, &waiter->lock);
+    } else {
+      s_time_t remaining = deadline - current_time();
+      if (remaining <= 0 || cond_timedwait(cond, &waiter->lock, remaining) == 1) {
+        result = ready(ring);
+        break;
+      }
+    }
+  }
+
+  __atomic_fetch_sub(waiting, 1, __ATOMIC_SEQ_CST);
+  mutex_unlock(&waiter->lock);
+
+  return result;
+}
+
+
+//////// SPSC
+
+spsc_ring_t *spsc_ring_init(spsc_ring_t *ring, size_t obj_size, size_t capacity, bool blocking, allocator_t *alloc)
+{
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  if (ring == NULL) {
+    s_fatal_error(1, "Cannot initialize NULL ring.");
+    return NULL;
+  } else if (obj_size == 0 || capacity == 0) {
+    s_log_error("Invalid ring element size (%zu) or capacity (%zu).", obj_size, capacity);
+    return NULL;
+  }
+
+  memset(ring, 0, sizeof(*ring));
+  capacity = ring_round_capacity(capacity);
+
+  ring->buf = (char *)com_malloc_uninit(alloc, capacity * obj_size);
+  if (ring->buf == NULL) {
+    s_log_error("Unable to allocate ring of %zu elements.", capacity);
+    return NULL;
+  }
+
+  if (blocking && ring_waiter_init(&ring->waiter)) {
+    com_free(alloc, ring->buf);
+    ring->buf = NULL;
+    return NULL;
+  }
+
+  ring->obj_size = obj_size;
+  ring->mask = capacity - 1;
+  ring->alloc = alloc;
+  ring->blocking = blocking;
+
+  return ring;
+}
+
+
+void spsc_ring_destroy(spsc_ring_t *ring)
+{
+  if (ring == NULL) {
+    s_fatal_error(1, "Cannot destroy NULL ring.");
+    return;
+  }
+
+  if (ring->blocking)
+    ring_waiter_destroy(&ring->waiter);
+
+  if (ring->buf)
+    com_free(ring->alloc, ring->buf);
+
+  memset(ring, 0, sizeof(*ring));
+}
+
+
+size_t spsc_ring_capacity(const spsc_ring_t *ring)
+{
+  return ring->mask + 1;
+}
+
+
+size_t spsc_ring_size(const spsc_ring_t *ring)
+{
+  const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+
+size_t spsc_ring_push_n(spsc_ring_t *ring, const void *items, size_t count)
+{
+  const size_t capacity = ring->mask + 1;
+  const size_t tail = ring->tail;
+  size_t free_slots = capacity - (tail - ring->head_cache);
+
+  if (free_slots < count) {
+    ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    free_slots = capacity - (tail - ring->head_cache);
+  }
+
+  if (count > free_slots)
+    count = free_slots;
+
+  if (count == 0)
+    return 0;
+
+  ring_copy_in(ring->buf, ring->mask, ring->obj_size, tail, (const char *)items, count);
+  __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+
+  if (ring->blocking)
+    ring_wake(&ring->waiter, &ring->waiter.consumers_waiting, &ring->waiter.not_empty);
+
+  return count;
+}
+
+
+bool spsc_ring_push(spsc_ring_t *ring, const void *item)
+{
+  return spsc_ring_push_n(ring, item, 1) == 1;
+}
+
+
+size_t spsc_ring_pop_n(spsc_ring_t *ring, void *items, size_t max)
+{
+  const size_t head = ring->head;
+  size_t available = ring->tail_cache - head;
+
+  if (available < max) {
+    ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    available = ring->tail_cache - head;
+  }
+
+  if (max > available)
+    max = available;
+
+  if (max == 0)
+    return 0;
+
+  ring_copy_out(ring->buf, ring->mask, ring->obj_size, head, (char *)items, max);
+  __atomic_store_n(&ring->head, head + max, __ATOMIC_RELEASE);
+
+  if (ring->blocking)
+    ring_wake(&ring->waiter, &ring->waiter.producers_waiting, &ring->waiter.not_full);
+
+  return max;
+}
+
+
+bool spsc_ring_pop(spsc_ring_t *ring, void *item)
+{
+  return spsc_ring_pop_n(ring, item, 1) == 1;
+}
+
+
+static bool spsc_ring_has_room(const void *p)
+{
+  const spsc_ring_t *ring = (const spsc_ring_t *)p;
+  return ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= ring->mask;
+}
+
+
+static bool spsc_ring_has_elements(const void *p)
+{
+  const spsc_ring_t *ring = (const spsc_ring_t *)p;
+  return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head;
+}
+
+
+size_t spsc_ring_push_wait(spsc_ring_t *ring, const void *items, size_t count, s_time_t timeout)
+{
+  const char *next = (const char *)items;
+  size_t pushed = 0;
+
+  if (! ring->blocking) {
+    s_log_error("Attempt to wait on a non-blocking ring.");
+    return spsc_ring_push_n(ring, items, count);
+  }
+
+  for (;;) {
+    pushed += spsc_ring_push_n(ring, next + pushed * ring->obj_size, count - pushed);
+    if (pushed == count)
+      break;
+
+    if (!ring_block(&ring->waiter, &ring->waiter.producers_waiting, &ring->waiter.not_full,
+                    spsc_ring_has_room, ring, timeout))
+      break;
+  }
+
+  return pushed;
+}
+
+
+size_t spsc_ring_pop_wait(spsc_ring_t *ring, void *items, size_t max, s_time_t timeout)
+{
+  size_t popped;
+
+  if (! ring->blocking) {
+    s_log_error("Attempt to wait on a non-blocking ring.");
+    return spsc_ring_pop_n(ring, items, max);
+  }
+
+  popped = spsc_ring_pop_n(ring, items, max);
+  if (popped == 0 && max != 0 &&
+      ring_block(&ring->waiter, &ring->waiter.consumers_waiting, &ring->waiter.not_empty,
+                 spsc_ring_has_elements, ring, timeout))
+    popped = spsc_ring_pop_n(ring, items, max);
+
+  return popped;
+}
+
+
+//////// MPSC
+
+mpsc_ring_t *mpsc_ring_init(mpsc_ring_t *ring, size_t obj_size, size_t capacity, bool blocking, allocator_t *alloc)
+{
+  if (alloc == NULL)
+    alloc = g_default_allocator;
+
+  if (ring == NULL) {
+    s_fatal_error(1, "Cannot initialize NULL ring.");
+    return NULL;
+  } else if (obj_size == 0 || capacity == 0) {
+    s_log_error("Invalid ring element size (%zu) or capacity (%zu).", obj_size, capacity);
+    return NULL;
+  }
+
+  memset(ring, 0, sizeof(*ring));
+  capacity = ring_round_capacity(capacity);
+
+  ring->buf = (char *)com_malloc_uninit(alloc, capacity * obj_size);
+  // zeroed, so no slot reads as published until it's written
+  ring->published = (size_t *)com_calloc(alloc, capacity, sizeof(size_t));
+  if (ring->buf == NULL || ring->published == NULL) {
+    s_log_error("Unable to allocate ring of %zu elements.", capacity);
+    goto mpsc_ring_init_error;
+  }
+
+  if (blocking && ring_waiter_init(&ring->waiter))
+    goto mpsc_ring_init_error;
+
+  ring->obj_size = obj_size;
+  ring->mask = capacity - 1;
+  ring->alloc = alloc;
+  ring->blocking = blocking;
+
+  return ring;
+
+mpsc_ring_init_error:
+  if (ring->buf)
+    com_free(alloc, ring->buf);
+  if (ring->published)
+    com_free(alloc, ring->published);
+  memset(ring, 0, sizeof(*ring));
+  return NULL;
+}
+
+
+void mpsc_ring_destroy(mpsc_ring_t *ring)
+{
+  if (ring == NULL) {
+    s_fatal_error(1, "Cannot destroy NULL ring.");
+    return;
+  }
+
+  if (ring->blocking)
+    ring_waiter_destroy(&ring->waiter);
+
+  if (ring->buf)
+    com_free(ring->alloc, ring->buf);
+  if (ring->published)
+    com_free(ring->alloc, ring->published);
+
+  memset(ring, 0, sizeof(*ring));
+}
+
+
+size_t mpsc_ring_capacity(const mpsc_ring_t *ring)
+{
+  return ring->mask + 1;
+}
+
+
+size_t mpsc_ring_size(const mpsc_ring_t *ring)
+{
+  const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+
+size_t mpsc_ring_push_n(mpsc_ring_t *ring, const void *items, size_t count)
+{
+  const size_t capacity = ring->mask + 1;
+  const char *src = (const char *)items;
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  size_t reserved;
+  size_t index;
+
+  // claim [tail, tail + reserved) -- head is read after tail, so if the
+  // exchange succeeds, tail hasn't moved and tail - head is accurate
+  do {
+    const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    const size_t free_slots = capacity - (tail - head);
+
+    reserved = count < free_slots ? count : free_slots;
+    if (reserved == 0)
+      return 0;
+  } while (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + reserved, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  ring_copy_in(ring->buf, ring->mask, ring->obj_size, tail, src, reserved);
+
+  for (index = tail; index < tail + reserved; ++index)
+    __atomic_store_n(&ring->published[index & ring->mask], index + 1, __ATOMIC_RELEASE);
+
+  if (ring->blocking)
+    ring_wake(&ring->waiter, &ring->waiter.consumers_waiting, &ring->waiter.not_empty);
+
+  return reserved;
+}
+
+
+bool mpsc_ring_push(mpsc_ring_t *ring, const void *item)
+{
+  return mpsc_ring_push_n(ring, item, 1) == 1;
+}
+
+
+size_t mpsc_ring_pop_n(mpsc_ring_t *ring, void *items, size_t max)
+{
+  const size_t head = ring->head;
+  size_t count = 0;
+
+  while (count < max &&
+         __atomic_load_n(&ring->published[(head + count) & ring->mask], __ATOMIC_ACQUIRE) == head + count + 1)
+    ++count;
+
+  if (count == 0)
+    return 0;
+
+  ring_copy_out(ring->buf, ring->mask, ring->obj_size, head, (char *)items, count);
+  __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+
+  if (ring->blocking)
+    ring_wake(&ring->waiter, &ring->waiter.producers_waiting, &ring->waiter.not_full);
+
+  return count;
+}
+
+
+bool mpsc_ring_pop(mpsc_ring_t *ring, void *item)
+{
+  return mpsc_ring_pop_n(ring, item, 1) == 1;
+}
+
+
+static bool mpsc_ring_has_room(const void *p)
+{
+  const mpsc_ring_t *ring = (const mpsc_ring_t *)p;
+  return mpsc_ring_size(ring) <= ring->mask;
+}
+
+
+static bool mpsc_ring_has_elements(const void *p)
+{
+  const mpsc_ring_t *ring = (const mpsc_ring_t *)p;
+  const size_t head = ring->head;
+  return __atomic_load_n(&ring->published[head & ring->mask], __ATOMIC_ACQUIRE) == head + 1;
+}
+
+
+size_t mpsc_ring_push_wait(mpsc_ring_t *ring, const void *items, size_t count, s_time_t timeout)
+{
+  const char *next = (const char *)items;
+  size_t pushed = 0;
+
+  if (! ring->blocking) {
+    s_log_error("Attempt to wait on a non-blocking ring.");
+    return mpsc_ring_push_n(ring, items, count);
+  }
+
+  for (;;) {
+    pushed += mpsc_ring_push_n(ring, next + pushed * ring->obj_size, count - pushed);
+    if (pushed == count)
+      break;
+
+    if (!ring_block(&ring->waiter, &ring->waiter.producers_waiting, &ring->waiter.not_full,
+                    mpsc_ring_has_room, ring, timeout))
+      break;
+  }
+
+  return pushed;
+}
+
+
+size_t mpsc_ring_pop_wait(mpsc_ring_t *ring, void *items, size_t max, s_time_t timeout)
+{
+  size_t popped;
+
+  if (! ring->blocking) {
+    s_log_error("Attempt to wait on a non-blocking ring.");
+    return mpsc_ring_pop_n(ring, items, max);
+  }
+
+  popped = mpsc_ring_pop_n(ring, items, max);
+  if (popped == 0 && max != 0 &&
+      ring_block(&ring->waiter, &ring->waiter.consumers_waiting, &ring->waiter.not_empty,
+                 mpsc_ring_has_elements, ring, timeout))
+    popped = mpsc_ring_pop_n(ring, items, max);
+
+  return popped;
+}
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
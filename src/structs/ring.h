@@ -0,0 +1,182 @@
+/*
+  Bounded lock-free ring buffers
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__RING_H__
+
+#define __SNOW__RING_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include <threads/mutex.h>
+#include <threads/cond.h>
+#include <time/time.h>
+
+/*!
+  \file
+
+  Fixed-capacity queues of fixed-size elements for passing data between
+  threads without locks.
+
+  - spsc_ring_t allows one producer thread and one consumer thread.
+  - mpsc_ring_t allows any number of producer threads and one consumer
+    thread.
+
+  Pushing and popping never block or allocate. When the ring is full, a push
+  takes as many elements as fit and returns how many it took. Batch
+  operations publish all their elements at once.
+
+  Rings created as blocking also have _wait variants that sleep until there
+  is room or there are elements. Blocking costs non-waiting callers one
+  fence and one load per operation. The mutex is only taken when a thread is
+  actually waiting.
+
+  The head and tail indices sit on separate cache lines, so the producer and
+  consumer don't contend for the same line except when the ring is nearly
+  empty or nearly full.
+*/
+
+#ifdef __SNOW__RING_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*! Assumed cache line size. A full line of padding separates each group of
+    indices, so they never share a line however the ring is aligned. */
+#define RING_CACHE_LINE (64)
+/*! Pass as the timeout to a _wait routine to wait indefinitely. */
+#define RING_WAIT_FOREVER (-1.0)
+
+typedef struct s_ring_waiter ring_waiter_t;
+typedef struct s_spsc_ring spsc_ring_t;
+typedef struct s_mpsc_ring mpsc_ring_t;
+
+struct s_ring_waiter
+{
+  mutex_t lock;
+  cond_t not_empty;
+  cond_t not_full;
+  /*! Number of threads waiting on each condition. Updated atomically. */
+  int consumers_waiting;
+  int producers_waiting;
+};
+
+struct s_spsc_ring
+{
+  char *buf;
+  size_t obj_size;
+  /*! Capacity minus one. The capacity is a power of two. */
+  size_t mask;
+  allocator_t *alloc;
+  bool blocking;
+  ring_waiter_t waiter;
+
+  char producer_pad[RING_CACHE_LINE];
+  /*! Index of the next element to push. Only the producer writes it. */
+  size_t tail;
+  /*! The producer's most recent read of head. */
+  size_t head_cache;
+
+  char consumer_pad[RING_CACHE_LINE];
+  /*! Index of the next element to pop. Only the consumer writes it. */
+  size_t head;
+  /*! The consumer's most recent read of tail. */
+  size_t tail_cache;
+
+  char end_pad[RING_CACHE_LINE];
+};
+
+struct s_mpsc_ring
+{
+  char *buf;
+  /*! One entry per slot, set to the slot's index plus one once a producer has
+      written it. The consumer reads a slot only once this is set. */
+  size_t *published;
+  size_t obj_size;
+  size_t mask;
+  allocator_t *alloc;
+  bool blocking;
+  ring_waiter_t waiter;
+
+  char producer_pad[RING_CACHE_LINE];
+  /*! Index of the next slot to reserve. Producers claim slots by advancing
+      it with a compare-and-swap. */
+  size_t tail;
+
+  char consumer_pad[RING_CACHE_LINE];
+  size_t head;
+
+  char end_pad[RING_CACHE_LINE];
+};
+
+/*!
+ * Initializes a ring holding at least capacity elements of obj_size bytes.
+ * The capacity is rounded up to a power of two. If blocking is true, the
+ * _wait routines may be used with the ring. Returns NULL on failure.
+ */
+spsc_ring_t *spsc_ring_init(spsc_ring_t *ring, size_t obj_size, size_t capacity, bool blocking, allocator_t *alloc);
+/*! Destroys the ring. No other thread may be using it. */
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+size_t spsc_ring_capacity(const spsc_ring_t *ring);
+/*! Returns the number of elements in the ring. This is only a snapshot when
+    other threads are using the ring. */
+size_t spsc_ring_size(const spsc_ring_t *ring);
+
+/*! Pushes one element. Returns false if the ring is full. Producer only. */
+bool spsc_ring_push(spsc_ring_t *ring, const void *item);
+/*! Pushes up to count elements from items. Returns how many were pushed.
+    Producer only. */
+size_t spsc_ring_push_n(spsc_ring_t *ring, const void *items, size_t count);
+/*! Pops one element into item. Returns false if the ring is empty. Consumer
+    only. */
+bool spsc_ring_pop(spsc_ring_t *ring, void *item);
+/*! Pops up to max elements into items. Returns how many were popped.
+    Consumer only. */
+size_t spsc_ring_pop_n(spsc_ring_t *ring, void *items, size_t max);
+
+/*!
+ * Pushes all count elements, waiting for room as needed. Returns how many
+ * were pushed, which is less than count only if timeout seconds pass first.
+ * Blocking rings only.
+ */
+size_t spsc_ring_push_wait(spsc_ring_t *ring, const void *items, size_t count, s_time_t timeout);
+/*!
+ * Waits until the ring isn't empty, then pops up to max elements. Returns
+ * how many were popped, which is zero only if timeout seconds pass first.
+ * Blocking rings only.
+ */
+size_t spsc_ring_pop_wait(spsc_ring_t *ring, void *items, size_t max, s_time_t timeout);
+
+/*! As the spsc_ring_ routines, except any number of threads may push. */
+mpsc_ring_t *mpsc_ring_init(mpsc_ring_t *ring, size_t obj_size, size_t capacity, bool blocking, allocator_t *alloc);
+void mpsc_ring_destroy(mpsc_ring_t *ring);
+
+size_t mpsc_ring_capacity(const mpsc_ring_t *ring);
+size_t mpsc_ring_size(const mpsc_ring_t *ring);
+
+bool mpsc_ring_push(mpsc_ring_t *ring, const void *item);
+size_t mpsc_ring_push_n(mpsc_ring_t *ring, const void *items, size_t count);
+bool mpsc_ring_pop(mpsc_ring_t *ring, void *item);
+/*! Pops up to max elements. An element a producer is still writing ends the
+    batch early, even if later elements are ready. */
+size_t mpsc_ring_pop_n(mpsc_ring_t *ring, void *items, size_t max);
+
+size_t mpsc_ring_push_wait(mpsc_ring_t *ring, const void *items, size_t count, s_time_t timeout);
+size_t mpsc_ring_pop_wait(mpsc_ring_t *ring, void *items, size_t max, s_time_t timeout);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__RING_H__ */
@@ -0,0 +1,257 @@
+/*
+  Slot map collection
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__SLOTMAP_C__
+
+#include "slotmap.h"
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define SLOT_INDEX_MASK ((uint32_t)SLOTMAP_MAX_SLOTS - 1)
+#define SLOT_GENERATION_MASK (((uint32_t)1 << SLOTMAP_GENERATION_BITS) - 1)
+#define NO_FREE_SLOT ((uint32_t)SLOTMAP_MAX_SLOTS)
+/* generation of a slot that's used up -- no handle ever carries it */
+#define RETIRED_GENERATION ((uint32_t)0)
+
+typedef struct s_slotmap_slot slotmap_slot_t;
+
+struct s_slotmap_slot
+{
+  /*! Index of the slot's value in the dense arrays, or of the next free slot
+      if this one is free. */
+  uint32_t index;
+  /*! Generation of handles currently issued for the slot, or
+      RETIRED_GENERATION if the slot is never handed out again. */
+  uint32_t generation;
+};
+
+
+static handle_t slot_handle(uint32_t slot_index, uint32_t generation)
+{
+  return (handle_t)((generation << SLOTMAP_INDEX_BITS) | slot_index);
+}
+
+
+/*
+  Bumps a slot's generation and puts it on the free list. A slot whose
+  generation would wrap is retired instead, since reusing it would let old
+  handles to it resolve again.
+*/
+static void slotmap_release_slot(slotmap_t *map, uint32_t slot_index)
+{
+  slotmap_slot_t *slot = (slotmap_slot_t *)map->slots.buf + slot_index;
+
+  if (slot->generation == SLOT_GENERATION_MASK) {
+    slot->generation = RETIRED_GENERATION;
+    return;
+  }
+
+  slot->generation += 1;
+  slot->index = map->free_slot;
+  map->free_slot = slot_index;
+}
+
+
+/* Returns the slot for handle if the handle is current, otherwise NULL. */
+static slotmap_slot_t *slotmap_find_slot(const slotmap_t *map, handle_t handle)
+{
+  const uint32_t bits = (uint32_t)handle;
+  const uint32_t slot_index = bits & SLOT_INDEX_MASK;
+  slotmap_slot_t *slot;
+
+  if (handle <= 0 || slot_index >= map->slots.size)
+    return NULL;
+
+  slot = (slotmap_slot_t *)map->slots.buf + slot_index;
+  if (slot->generation == RETIRED_GENERATION || slot->generation != (bits >> SLOTMAP_INDEX_BITS))
+    return NULL;
+
+  return slot;
+}
+
+
+slotmap_t *slotmap_init(slotmap_t *map, size_t obj_size, size_t capacity, allocator_t *alloc)
+{
+  if (map == NULL) {
+    s_fatal_error(1, "Cannot initialize NULL slot map.");
+    return NULL;
+  }
+
+  if (capacity > SLOTMAP_MAX_SLOTS)
+    capacity = SLOTMAP_MAX_SLOTS;
+
+  memset(map, 0, sizeof(*map));
+
+  if (!array_init(&map->values, obj_size, capacity, alloc))
+    return NULL;
+
+  if (!array_init(&map->handles, sizeof(handle_t), capacity, alloc)) {
+    array_destroy(&map->values);
+    return NULL;
+  }
+
+  if (!array_init(&map->slots, sizeof(slotmap_slot_t), capacity, alloc)) {
+    array_destroy(&map->handles);
+    array_destroy(&map->values);
+    return NULL;
+  }
+
+  map->free_slot = NO_FREE_SLOT;
+
+  return map;
+}
+
+
+void slotmap_destroy(slotmap_t *map)
+{
+  if (map == NULL) {
+    s_fatal_error(1, "Cannot destroy NULL slot map.");
+    return;
+  }
+
+  array_destroy(&map->slots);
+  array_destroy(&map->handles);
+  array_destroy(&map->values);
+  map->free_slot = NO_FREE_SLOT;
+}
+
+
+handle_t slotmap_insert(slotmap_t *map, const void *value)
+{
+  const size_t dense_index = map->values.size;
+  slotmap_slot_t *slot;
+  uint32_t slot_index;
+  handle_t handle;
+
+  if (dense_index >= SLOTMAP_MAX_SLOTS) {
+    s_log_error("Slot map is full (%d values).", SLOTMAP_MAX_SLOTS);
+    return SLOTMAP_NULL_HANDLE;
+  }
+
+  if (map->free_slot == NO_FREE_SLOT && map->slots.size >= SLOTMAP_MAX_SLOTS) {
+    s_log_error("Slot map has no slots left (%zu values, the rest retired).", dense_index);
+    return SLOTMAP_NULL_HANDLE;
+  }
+
+  // grow everything up front so a failure leaves the map untouched
+  if (!array_reserve(&map->values, dense_index + 1) ||
+      !array_reserve(&map->handles, dense_index + 1) ||
+      (map->free_slot == NO_FREE_SLOT && !array_reserve(&map->slots, map->slots.size + 1)))
+    return SLOTMAP_NULL_HANDLE;
+
+  if (map->free_slot == NO_FREE_SLOT) {
+    slot_index = (uint32_t)map->slots.size;
+    array_push(&map->slots, NULL);
+    slot = (slotmap_slot_t *)map->slots.buf + slot_index;
+    slot->generation = 1;
+  } else {
+    slot_index = map->free_slot;
+    slot = (slotmap_slot_t *)map->slots.buf + slot_index;
+    map->free_slot = slot->index;
+  }
+
+  slot->index = (uint32_t)dense_index;
+  handle = slot_handle(slot_index, slot->generation);
+
+  array_push(&map->values, value);
+  array_push(&map->handles, &handle);
+
+  return handle;
+}
+
+
+bool slotmap_remove(slotmap_t *map, handle_t handle)
+{
+  slotmap_slot_t *slot = slotmap_find_slot(map, handle);
+  const size_t obj_size = map->values.obj_size;
+  size_t last;
+  size_t dense_index;
+
+  if (slot == NULL)
+    return false;
+
+  dense_index = slot->index;
+  last = map->values.size - 1;
+
+  // fill the hole with the last value and point its slot at the new spot
+  if (dense_index != last) {
+    handle_t *handles = (handle_t *)map->handles.buf;
+    slotmap_slot_t *moved;
+
+    memcpy(map->values.buf + dense_index * obj_size, map->values.buf + last * obj_size, obj_size);
+    handles[dense_index] = handles[last];
+
+    moved = (slotmap_slot_t *)map->slots.buf + ((uint32_t)handles[dense_index] & SLOT_INDEX_MASK);
+    moved->index = (uint32_t)dense_index;
+  }
+
+  array_resize(&map->values, last);
+  array_resize(&map->handles, last);
+
+  slotmap_release_slot(map, (uint32_t)handle & SLOT_INDEX_MASK);
+
+  return true;
+}
+
+
+void slotmap_clear(slotmap_t *map)
+{
+  const handle_t *handles = (const handle_t *)map->handles.buf;
+  size_t index;
+
+  for (index = 0; index < map->handles.size; ++index)
+    slotmap_release_slot(map, (uint32_t)handles[index] & SLOT_INDEX_MASK);
+
+  array_clear(&map->values);
+  array_clear(&map->handles);
+}
+
+
+void *slotmap_get(slotmap_t *map, handle_t handle)
+{
+  slotmap_slot_t *slot = slotmap_find_slot(map, handle);
+
+  if (slot == NULL)
+    return NULL;
+
+  return map->values.buf + slot->index * map->values.obj_size;
+}
+
+
+bool slotmap_contains(const slotmap_t *map, handle_t handle)
+{
+  return slotmap_find_slot(map, handle) != NULL;
+}
+
+
+size_t slotmap_size(const slotmap_t *map)
+{
+  return map->values.size;
+}
+
+
+void *slotmap_values(slotmap_t *map)
+{
+  return map->values.buf;
+}
+
+
+handle_t slotmap_handle_at(const slotmap_t *map, size_t index)
+{
+  if (index >= map->handles.size) {
+    s_fatal_error(1, "Index %zu out of range [0..%zu]", index, map->handles.size);
+    return SLOTMAP_NULL_HANDLE;
+  }
+
+  return ((const handle_t *)map->handles.buf)[index];
+}
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
@@ -0,0 +1,115 @@
+/*
+  Slot map collection
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__SLOTMAP_H__
+
+#define __SNOW__SLOTMAP_H__
+
+#include <snow-config.h>
+#include <memory/allocator.h>
+#include "dynarray.h"
+
+/*!
+  \file
+
+  A container that hands out a handle_t for each value inserted into it.
+
+  Values are kept packed together in insertion order, except that removing a
+  value moves the last value into its place. They can be iterated as a plain
+  array with ::slotmap_values. Each handle names a slot in a sparse table.
+  The slot records where its value currently sits in the dense array and
+  carries a generation counter that is bumped whenever the slot is freed.
+  A handle stores the generation it was issued with, so once its value is
+  removed the handle stops resolving, even after the slot is reused.
+
+  Insertion, removal and lookup are all O(1). Pointers to values are only
+  valid until the next insertion or removal. Hold on to handles instead.
+
+  A handle packs the slot index into its low SLOTMAP_INDEX_BITS bits and the
+  generation into the bits above, leaving the sign bit clear. Generations
+  start at 1, so SLOTMAP_NULL_HANDLE is never a valid handle.
+
+  That leaves SLOTMAP_GENERATION_BITS for the generation, so a slot only has
+  2047 generations. Rather than wrap around and revive old handles, a slot
+  is retired once its last generation is freed and is never handed out
+  again. Retired slots aren't reclaimed, even by ::slotmap_clear, so a map
+  that keeps inserting and removing values slowly uses up its
+  SLOTMAP_MAX_SLOTS slots and starts failing inserts after roughly two
+  billion removals.
+*/
+
+#ifdef __SNOW__SLOTMAP_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define SLOTMAP_INDEX_BITS (20)
+/*! Most values a slot map can hold at once. */
+#define SLOTMAP_MAX_SLOTS (1 << SLOTMAP_INDEX_BITS)
+#define SLOTMAP_GENERATION_BITS (31 - SLOTMAP_INDEX_BITS)
+#define SLOTMAP_NULL_HANDLE ((handle_t)0)
+
+typedef struct s_slotmap slotmap_t;
+
+struct s_slotmap
+{
+  /*! Values, packed. */
+  array_t values;
+  /*! Handle for each value in values, in the same order. */
+  array_t handles;
+  /*! The sparse table of slotmap_slot_t, indexed by the low bits of a
+      handle. */
+  array_t slots;
+  /*! First free slot, or SLOTMAP_MAX_SLOTS if there are none. Free slots are
+      chained through their index fields. */
+  uint32_t free_slot;
+};
+
+/*!
+ * Initializes a slot map holding values of obj_size bytes, with room for
+ * capacity values before it has to grow. Returns NULL on failure.
+ */
+slotmap_t *slotmap_init(slotmap_t *map, size_t obj_size, size_t capacity, allocator_t *alloc);
+void slotmap_destroy(slotmap_t *map);
+
+/*!
+ * Copies value into the map and returns its handle. If value is NULL, the
+ * new value is zeroed. Returns SLOTMAP_NULL_HANDLE if the map is full or
+ * can't grow.
+ */
+handle_t slotmap_insert(slotmap_t *map, const void *value);
+/*!
+ * Removes the value for handle. Returns false if the handle is stale or
+ * invalid. The last value in the dense array takes the removed value's place.
+ */
+bool slotmap_remove(slotmap_t *map, handle_t handle);
+/*! Removes every value. All handles issued so far become stale. */
+void slotmap_clear(slotmap_t *map);
+
+/*! Returns a pointer to the value for handle, or NULL if the handle is stale
+    or invalid. */
+void *slotmap_get(slotmap_t *map, handle_t handle);
+bool slotmap_contains(const slotmap_t *map, handle_t handle);
+
+size_t slotmap_size(const slotmap_t *map);
+/*! Returns the dense array of values. There are ::slotmap_size of them. */
+void *slotmap_values(slotmap_t *map);
+/*! Returns the handle of the value at index in the dense array. */
+handle_t slotmap_handle_at(const slotmap_t *map, size_t index);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__SLOTMAP_H__ */
@@ -3,6 +3,7 @@
 #include "system.h"
 #include "sgl.h"
 #include <events/events.h>
+#include <memory/arena.h>
 #include <threads/mutex.h>
 
 #ifdef __cplusplus
@@ -106,6 +107,9 @@ int sys_frame(const s_time_t frame_time)
 {
   sys_lock(SYS_LOCK_FRAME);
 
+  // release temporaries from two frames ago
+  sys_frame_arena_reset();
+
   glClear(GL_COLOR_BUFFER_BIT);
   com_process_event_queue();
 
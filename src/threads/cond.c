@@ -0,0 +1,160 @@
+/*
+  Condition variable object
+
+  See LICENSE.md for license information
+*/
+
+#define __SNOW__COND_C__
+
+#include "cond.h"
+
+#if S_USE_PTHREADS
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#if S_USE_PTHREADS
+
+/* possible errors */
+static const char *c_cond_err_unknown         = "unknown error";
+static const char *c_cond_err_invalid_cond    = "condition variable or mutex value is invalid";
+static const char *c_cond_err_permission      = "the current thread does not hold a lock on the mutex";
+static const char *c_cond_err_currently_used  = "the condition variable is being waited on";
+static const char *c_cond_err_no_memory       = "the system cannot allocate enough memory for a new condition variable";
+static const char *c_cond_err_temp_no_memory  = "the system temporarily lacks the resources for a new condition variable";
+
+int cond_init(cond_t *cond)
+{
+  int error = pthread_cond_init((pthread_cond_t *)cond, NULL);
+
+  if (error) {
+    const char *reason = c_cond_err_unknown;
+
+    switch (error) {
+    case EAGAIN: reason = c_cond_err_temp_no_memory; break;
+    case ENOMEM: reason = c_cond_err_no_memory; break;
+    default: break;
+    }
+
+    s_log_error("Error initializing condition variable: %s", reason);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int cond_destroy(cond_t *cond)
+{
+  int error = pthread_cond_destroy((pthread_cond_t *)cond);
+
+  if (error) {
+    const char *reason = c_cond_err_unknown;
+    switch (error) {
+    case EINVAL: reason = c_cond_err_invalid_cond; break;
+    case EBUSY: reason = c_cond_err_currently_used; break;
+    default: break;
+    }
+
+    s_log_error("Error destroying condition variable: %s", reason);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int cond_wait(cond_t *cond, mutex_t *lock)
+{
+  int error = pthread_cond_wait((pthread_cond_t *)cond, (pthread_mutex_t *)lock);
+
+  if (error) {
+    const char *reason = c_cond_err_unknown;
+    switch (error) {
+    case EINVAL: reason = c_cond_err_invalid_cond; break;
+    case EPERM: reason = c_cond_err_permission; break;
+    default: break;
+    }
+
+    s_log_error("Error waiting on condition variable: %s", reason);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int cond_timedwait(cond_t *cond, mutex_t *lock, double seconds)
+{
+  struct timeval now;
+  struct timespec deadline;
+  long nanoseconds;
+  int error;
+
+  if (seconds < 0)
+    seconds = 0;
+
+  /* pthread_cond_timedwait takes an absolute time on the realtime clock */
+  gettimeofday(&now, NULL);
+  nanoseconds = (long)now.tv_usec * 1000 + (long)((seconds - floor(seconds)) * 1e9);
+  deadline.tv_sec = now.tv_sec + (time_t)seconds + nanoseconds / 1000000000L;
+  deadline.tv_nsec = nanoseconds % 1000000000L;
+
+  error = pthread_cond_timedwait((pthread_cond_t *)cond, (pthread_mutex_t *)lock, &deadline);
+
+  if (error == ETIMEDOUT) {
+    return 1;
+  } else if (error) {
+    const char *reason = c_cond_err_unknown;
+    switch (error) {
+    case EINVAL: reason = c_cond_err_invalid_cond; break;
+    case EPERM: reason = c_cond_err_permission; break;
+    default: break;
+    }
+
+    s_log_error("Error waiting on condition variable (timed): %s", reason);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int cond_signal(cond_t *cond)
+{
+  int error = pthread_cond_signal((pthread_cond_t *)cond);
+
+  if (error) {
+    s_log_error("Error signaling condition variable: %s", c_cond_err_invalid_cond);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cond_broadcast(cond_t *cond)
+{
+  int error = pthread_cond_broadcast((pthread_cond_t *)cond);
+
+  if (error) {
+    s_log_error("Error broadcasting condition variable: %s", c_cond_err_invalid_cond);
+    return -1;
+  }
+
+  return 0;
+}
+
+#else /* S_USE_PTHREADS */
+
+#error "No condition variable implementation for this platform"
+
+#endif
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
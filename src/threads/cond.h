@@ -0,0 +1,59 @@
+/*
+  Condition variable object
+
+  See LICENSE.md for license information
+*/
+
+#ifndef __SNOW__COND_H__
+
+#define __SNOW__COND_H__
+
+#include <snow-config.h>
+#include "mutex.h"
+
+#ifdef __SNOW__COND_C__
+#define S_INLINE
+#else
+#define S_INLINE inline
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif /* __cplusplus */
+
+#if S_USE_PTHREADS
+
+typedef pthread_cond_t cond_t;
+
+#else
+
+typedef int cond_t;
+
+#endif
+
+/* All condition variable routines return 0 on success, negative values on
+  failure. */
+
+int cond_init(cond_t *cond);
+int cond_destroy(cond_t *cond);
+
+/* Unlocks the mutex, which must be locked by the calling thread, and waits
+  for the condition to be signaled. The mutex is locked again before
+  returning. Waits can end spuriously, so callers must check their condition
+  in a loop. */
+int cond_wait(cond_t *cond, mutex_t *lock);
+/* As cond_wait, but gives up after the given number of seconds. Returns 1 if
+  the wait timed out (which isn't an error). */
+int cond_timedwait(cond_t *cond, mutex_t *lock, double seconds);
+
+int cond_signal(cond_t *cond);
+int cond_broadcast(cond_t *cond);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include <inline.end>
+
+#endif /* end of include guard: __SNOW__COND_H__ */
@@ -27,10 +27,11 @@ typedef void *(*thread_fn_t)(void *context);
 #if S_USE_PTHREADS
 typedef pthread_t thread_t;
 
-/*! Initializes a thread. */
-S_INLINE void thread_create(thread_t *thread, thread_fn_t fn, void *context)
+/*! Initializes a thread. Returns 0 on success or an error number if the
+    thread couldn't be created. */
+S_INLINE int thread_create(thread_t *thread, thread_fn_t fn, void *context)
 {
-  pthread_create(thread, NULL, fn, context);
+  return pthread_create(thread, NULL, fn, context);
 }
 
 S_INLINE void thread_kill(thread_t thread)
@@ -65,9 +66,9 @@ S_INLINE thread_t thread_current_thread(void)
 
 #else /* S_USE_PTHREADS */
 
-/*! Initializes a thread. */
-void thread_create(thread_t *thread, thread_fn_t fn, void *context);
-void thread_create(thread_t *thread, thread_fn_t fn, void *context);
+/*! Initializes a thread. Returns 0 on success or an error number if the
+    thread couldn't be created. */
+int thread_create(thread_t *thread, thread_fn_t fn, void *context);
 void thread_kill(thread_t thread);
 int thread_equals(thread_t left, thread_t right);
 void thread_detach(thread_t thread);
@@ -3,6 +3,7 @@
 
 #include "thread.h"
 #include "mutex.h"
+#include "cond.h"
 #include "threadstorage.h"
 
 #endif /* end of include guard: __SNOW__THREADS_H__ */
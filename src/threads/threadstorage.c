@@ -16,7 +16,6 @@ extern "C"
 
 #if S_USE_PTHREADS
 
-#define DTOR_KV_CAPACITY 32
 #define TLS_ALLOC_TAG 0x006000F8
 
 typedef struct s_tls_base tls_base_t;
@@ -24,7 +23,7 @@ typedef struct s_tls_entry tls_entry_t;
 
 struct s_tls_base
 {
-  map_t kvmap;
+  hashmap_t kvmap;
 };
 
 struct s_tls_entry
@@ -38,30 +37,32 @@ static pthread_key_t g_tls_key;
 
 static void tls_specific_dtor(void *value)
 {
-  int kvindex;
-  mapkey_t keys[32];
-  void *values[32];
   tls_base_t *base;
+  mapkey_t key;
+  void *entry_value;
+  size_t iter;
 
   if (!value) return;
 
   base = (tls_base_t *)value;
 
-  while ((kvindex = map_get_values(&base->kvmap, keys, values, DTOR_KV_CAPACITY)))
-  {
-    while (kvindex--) {
-      tls_entry_t *entry = (tls_entry_t *)(values[kvindex]);
+  /* Destructors may put new values, which can grow the map mid-walk, so keep
+     walking until it's empty. */
+  while (hashmap_size(&base->kvmap)) {
+    iter = 0;
+    while (hashmap_iter_next(&base->kvmap, &iter, &key, &entry_value)) {
+      tls_entry_t *entry = (tls_entry_t *)entry_value;
 
-      map_remove(&base->kvmap, keys[kvindex]);
+      hashmap_remove(&base->kvmap, key);
 
       if (entry->dtor != NULL)
-        entry->dtor(keys[kvindex], entry->value);
+        entry->dtor(key, entry->value);
 
       com_free(g_tls_allocator, entry);
     }
   }
 
-  map_destroy(&base->kvmap);
+  hashmap_destroy(&base->kvmap);
 
   com_free(g_tls_allocator, base);
 }
@@ -88,13 +89,13 @@ void tls_put(tlskey_t key, void *value, tls_destructor_t dtor)
 
   if (specific == NULL) {
     base = (tls_base_t *)com_malloc(g_tls_allocator, sizeof(*base));
-    map_init(&base->kvmap, g_mapops_default, NULL);
+    hashmap_init(&base->kvmap, g_mapops_default, NULL, NULL);
     pthread_setspecific(g_tls_key, (void *)base);
   } else {
     base = (tls_base_t *)specific;
   }
   
-  entry = map_get(&base->kvmap, key);
+  entry = hashmap_get(&base->kvmap, key);
   if (!entry) {
     entry = (tls_entry_t *)com_malloc(g_tls_allocator, sizeof(*entry));
   }
@@ -102,7 +103,7 @@ void tls_put(tlskey_t key, void *value, tls_destructor_t dtor)
   entry->dtor = dtor;
   entry->value = value;
 
-  map_insert(&base->kvmap, key, entry);
+  hashmap_insert(&base->kvmap, key, entry);
 }
 
 void *tls_get(tlskey_t key)
@@ -111,7 +112,7 @@ void *tls_get(tlskey_t key)
 
   if (specific) {
     tls_base_t *base = (tls_base_t *)specific;
-    tls_entry_t *entry = map_get(&base->kvmap, key);
+    tls_entry_t *entry = hashmap_get(&base->kvmap, key);
     if (entry) return entry->value;
   }
 
@@ -10,7 +10,7 @@
 #define __SNOW__THREADSTORAGE_H__
 
 #include <snow-config.h>
-#include <structs/map.h>
+#include <structs/hashmap.h>
 #include <memory/allocator.h>
 
 #ifdef __SNOW__THREADSTORAGE_C__
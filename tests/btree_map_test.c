@@ -0,0 +1,117 @@
+/*
+  btree_map_build regression test
+
+  Builds a map from every count of sorted keys from 0 to BUILD_MAX and checks
+  each lookup, the in-order walk and the node invariants, then removes every
+  key. Build and run from the repository root:
+
+    cc -std=gnu99 -Isrc -o btree_map_test tests/btree_map_test.c \
+      src/structs/btree_map.c src/structs/map.c src/memory/allocator.c \
+      src/log/log.c -lphysfs && ./btree_map_test
+
+  See LICENSE.md for license information
+*/
+
+#include <structs/btree_map.h>
+#include <stdio.h>
+
+#define BUILD_MAX (5000)
+
+static int failures = 0;
+
+#define CHECK(COND, N) do {                                       \
+    if (!(COND)) {                                                \
+      fprintf(stderr, "n=%d: %s failed (line %d)\n", (N), #COND,  \
+              __LINE__);                                          \
+      ++failures;                                                 \
+      return;                                                     \
+    }                                                             \
+  } while (0)
+
+/*
+  Returns the height of the subtree at node, or -1 if its leaves aren't all
+  at the same depth or a node holds too few or too many keys.
+*/
+static int check_node(const btree_node_t *node, bool root)
+{
+  int height = -2;
+  int index;
+
+  if (node->count > BTREE_MAX_KEYS)
+    return -1;
+  if (!root && node->count < BTREE_MIN_DEGREE - 1)
+    return -1;
+  if (node->leaf)
+    return 1;
+
+  for (index = 0; index <= node->count; ++index) {
+    int child = check_node(node->children[index], false);
+    if (child < 0 || (height != -2 && child != height))
+      return -1;
+    height = child;
+  }
+
+  return height + 1;
+}
+
+static mapkey_t key_at(int index)
+{
+  // keys are compared by address, so leave gaps for lookups that miss
+  return (mapkey_t)(uintptr_t)(2 * index + 2);
+}
+
+static void test_build(int count, mapkey_t *keys)
+{
+  btree_map_t map;
+  btree_iter_t iter;
+  mapkey_t key;
+  void *value;
+  int index;
+
+  btree_map_init(&map, g_mapops_default, NULL);
+  CHECK(btree_map_build(&map, keys, (void *const *)keys, count) == 0, count);
+  CHECK(btree_map_size(&map) == count, count);
+  CHECK(count == 0 || check_node(map.root, true) > 0, count);
+
+  for (index = 0; index < count; ++index) {
+    CHECK(btree_map_get(&map, keys[index]) == keys[index], count);
+    CHECK(btree_map_get(&map, (mapkey_t)((uintptr_t)keys[index] + 1)) == NULL, count);
+  }
+  CHECK(btree_map_get(&map, (mapkey_t)(uintptr_t)1) == NULL, count);
+
+  btree_map_begin(&map, &iter);
+  for (index = 0; btree_iter_next(&iter, &key, &value); ++index) {
+    CHECK(index < count, count);
+    CHECK(key == keys[index] && value == keys[index], count);
+  }
+  CHECK(index == count, count);
+
+  // removal relies on the same invariants the build has to set up
+  for (index = 0; index < count; index += 2)
+    CHECK(btree_map_remove(&map, keys[index]), count);
+  for (index = 1; index < count; index += 2)
+    CHECK(btree_map_remove(&map, keys[index]), count);
+  CHECK(btree_map_size(&map) == 0, count);
+
+  btree_map_destroy(&map);
+}
+
+int main(void)
+{
+  mapkey_t keys[BUILD_MAX];
+  int count;
+
+  for (count = 0; count < BUILD_MAX; ++count)
+    keys[count] = key_at(count);
+
+  for (count = 0; count <= BUILD_MAX; ++count)
+    test_build(count, keys);
+
+  if (failures) {
+    fprintf(stderr, "%d of %d builds failed\n", failures, BUILD_MAX + 1);
+    return 1;
+  }
+
+  printf("btree_map_build: %d builds ok\n", BUILD_MAX + 1);
+  return 0;
+}